@@ -17,94 +17,106 @@
 //  */
 
 #define _CRT_SECURE_NO_WARNINGS
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "dcvcore.h"
 #include "simplelogger.h"
 #include "extensions.pb-c.h"
 
+#ifdef _WIN32
 #define LOG_FILE "C:\\Temp\\DcvExtensionVirtualChannelsC"
-#define READ_BUFFER_SIZE 4096
+#define getpid() ((int)GetCurrentProcessId())
+#else
+#define LOG_FILE "/tmp/DcvExtensionVirtualChannelsC"
+#define Sleep(milliseconds) sleep((milliseconds) / 1000)
+#endif
+
+// Request ids come from the core, a counter as text
+#define REQUEST_ID_SIZE 32
 
 char log_file[sizeof(LOG_FILE) + 20];
 char* CHANNEL_NAME = "echo";
-char read_buffer[READ_BUFFER_SIZE];
 
-void
-WriteMessage(Dcv__Extensions__ExtensionMessage* msg);
+// stdin and stdout, framed by the protocol core shared with the C++ extension
+dcv_core* core;
 
-BOOL
-ReadFromHandle(HANDLE handle,
-               uint8_t* buffer,
-               DWORD size)
+Dcv__Extensions__DcvMessage*
+UnpackMessage(dcv_core_status status,
+              const uint8_t* buf,
+              size_t msg_sz)
 {
-    DWORD bytes_read = 0;
+    Dcv__Extensions__DcvMessage* msg;
 
-    while (bytes_read < size) {
-        DWORD curr_read;
-        uint8_t* offset_buf = buffer + bytes_read;
-        DWORD remaining_bytes = size - bytes_read;
+    if (status != DCV_CORE_OK) {
+        log_f("Error reading message: %i", status);
+        return NULL;
+    }
 
-        if (!ReadFile(handle, offset_buf, remaining_bytes, &curr_read, NULL)) {
-            log_f("Could not read from handle: 0x%X", GetLastError());
-            return FALSE;
-        }
+    log_f("Received message, %zu bytes", msg_sz);
 
-        if (curr_read == 0) {
-            log_f("Read 0 bytes, stopping read");
-            return FALSE;
-        }
-
-        bytes_read += curr_read;
+    msg = dcv__extensions__dcv_message__unpack(NULL, msg_sz, buf);
+    if (msg == NULL) {
+        log_f("Could not unpack message from std input");
     }
 
-    return TRUE;
+    return msg;
 }
 
 Dcv__Extensions__DcvMessage*
 ReadNextMessage()
 {
-    uint8_t* buf;
-    uint32_t msg_sz = 0;
-    Dcv__Extensions__DcvMessage* msg;
-    HANDLE input_handle = GetStdHandle(STD_INPUT_HANDLE);
+    const uint8_t* buf;
+    size_t msg_sz;
+    dcv_core_status status = dcv_core_read(core, &buf, &msg_sz);
 
-    if (input_handle == INVALID_HANDLE_VALUE) {
-        log_f("Error getting stdin handle: 0x%X", GetLastError());
-        return NULL;
-    }
+    return UnpackMessage(status, buf, msg_sz);
+}
 
-    /*
-     * Read size of message, 32 bits
-     */
-    if (!ReadFromHandle(input_handle, (uint8_t*)&msg_sz, sizeof(msg_sz))) {
-        log_f("Error reading message size: 0x%X", GetLastError());
-        return NULL;
-    }
+// Messages that come before the response are kept for ReadNextMessage()
+Dcv__Extensions__DcvMessage*
+ReadResponse(const char* request_id)
+{
+    const uint8_t* buf;
+    size_t msg_sz;
+    dcv_core_status status = dcv_core_read_response(core, request_id, &buf, &msg_sz);
 
-    buf = calloc(1, msg_sz);
-    if (buf == NULL) {
-        log_f("Could not allocate buffer to read message: 0x%X", GetLastError());
-        return NULL;
+    return UnpackMessage(status, buf, msg_sz);
+}
+
+void
+WriteMessage(Dcv__Extensions__ExtensionMessage* msg)
+{
+    size_t msg_sz;
+    uint8_t* buf;
+    dcv_core_status status;
+
+    msg_sz = dcv__extensions__extension_message__get_packed_size(msg);
+    if (msg_sz == 0) {
+        log_f("Could not pack message into buffer");
+        return;
     }
 
     /*
-     * Read message and unpack it
+     * Packed straight into the buffer the core writes with its size
      */
-    if (!ReadFromHandle(input_handle, buf, msg_sz)) {
-        log_f("Error reading message body: 0x%X", GetLastError());
-        free(buf);
-        return NULL;
+    buf = dcv_core_prepare_write(core, msg_sz);
+    if (buf == NULL) {
+        log_f("Could not allocate buffer to write message");
+        return;
     }
 
-    log_f("Received message, %i bytes", msg_sz);
+    dcv__extensions__extension_message__pack(msg, buf);
 
-    msg = dcv__extensions__dcv_message__unpack(NULL, msg_sz, buf);
-    free(buf);
-    if (msg == NULL) {
-        log_f("Could not unpack message from std input");
+    status = dcv_core_commit_write(core);
+    if (status != DCV_CORE_OK) {
+        log_f("Could not write message: %i", status);
     }
-
-    return msg;
 }
 
 void
@@ -119,36 +131,30 @@ WriteRequest(Dcv__Extensions__Request* request)
 }
 
 void
-RequestVirtualChannel()
+RequestVirtualChannel(char* request_id)
 {
-    UUID req_id;
-
     Dcv__Extensions__Request request = DCV__EXTENSIONS__REQUEST__INIT;
     Dcv__Extensions__SetupVirtualChannelRequest msg = DCV__EXTENSIONS__SETUP_VIRTUAL_CHANNEL_REQUEST__INIT;
 
     msg.virtual_channel_name = CHANNEL_NAME;
-    msg.relay_client_process_id = GetCurrentProcessId();
+    msg.relay_client_process_id = getpid();
 
     log_f("About to send SetupVirtualChannelRequest with virtual_channel_name = '%s', relay_client_process_id = %lld",
           msg.virtual_channel_name,
-          msg.relay_client_process_id);
+          (long long)msg.relay_client_process_id);
 
     request.request_case = DCV__EXTENSIONS__REQUEST__REQUEST_SETUP_VIRTUAL_CHANNEL_REQUEST;
     request.setup_virtual_channel_request = &msg;
-    UuidCreate(&req_id);
-    UuidToStringA(&req_id, &request.request_id);
-    // TODO: handle errors from uuid API
+    dcv_core_next_request_id(core, request_id, REQUEST_ID_SIZE);
+    request.request_id = request_id;
 
     WriteRequest(&request);
-
-    RpcStringFreeA(&request.request_id);
 }
 
 void
-CloseVirtualChannel()
+CloseVirtualChannel(char* request_id)
 {
     // TODO: actually call local closure
-    UUID req_id;
 
     Dcv__Extensions__Request request = DCV__EXTENSIONS__REQUEST__INIT;
     Dcv__Extensions__CloseVirtualChannelRequest msg = DCV__EXTENSIONS__CLOSE_VIRTUAL_CHANNEL_REQUEST__INIT;
@@ -157,137 +163,37 @@ CloseVirtualChannel()
 
     request.request_case = DCV__EXTENSIONS__REQUEST__REQUEST_CLOSE_VIRTUAL_CHANNEL_REQUEST;
     request.close_virtual_channel_request = &msg;
-    UuidCreate(&req_id);
-    UuidToStringA(&req_id, &request.request_id);
-    // TODO: handle errors from uuid API
+    dcv_core_next_request_id(core, request_id, REQUEST_ID_SIZE);
+    request.request_id = request_id;
 
     WriteRequest(&request);
-
-    RpcStringFreeA(&request.request_id);
-}
-
-BOOL
-WriteToHandle(HANDLE handle,
-              uint8_t* buffer,
-              DWORD size)
-{
-    DWORD bytes_written = 0;
-
-    while (bytes_written < size) {
-        DWORD curr_written;
-        uint8_t* offset_buf = buffer + bytes_written;
-        DWORD remaining_bytes = size - bytes_written;
-
-        if (!WriteFile(handle, offset_buf, remaining_bytes, &curr_written, NULL)) {
-            log_f("Could not write to handle: 0x%X", GetLastError());
-            return FALSE;
-        }
-
-        bytes_written += curr_written;
-    }
-
-    return TRUE;
-}
-
-void
-WriteMessage(Dcv__Extensions__ExtensionMessage* msg)
-{
-    uint32_t msg_sz;
-    uint8_t* buf;
-    HANDLE output_handle = GetStdHandle(STD_OUTPUT_HANDLE);
-
-    if (output_handle == INVALID_HANDLE_VALUE) {
-        log_f("Error getting stdout handle: 0x%X", GetLastError());
-        return;
-    }
-
-    msg_sz = (uint32_t)dcv__extensions__extension_message__get_packed_size(msg);
-    if (msg_sz == 0) {
-        log_f("Could not pack message into buffer");
-        return;
-    }
-
-    buf = calloc(1, msg_sz);
-    if (buf == NULL) {
-        log_f("Could not allocate buffer to write message: 0x%X", GetLastError());
-        return;
-    }
-
-    dcv__extensions__extension_message__pack(msg, buf);
-
-    /*
-     * Write size of message, 32 bits
-     */
-    if (!WriteToHandle(output_handle, (uint8_t*)&msg_sz, sizeof(msg_sz))) {
-        free(buf);
-        return;
-    }
-
-    /*
-     * Write message
-     */
-    WriteToHandle(output_handle, buf, msg_sz);
-    FlushFileBuffers(output_handle);
-
-    free(buf);
-}
-
-HANDLE
-SetupAndConnectNamedPipe(const char* relay_path)
-{
-    HANDLE named_pipe_handle;
-
-    while (TRUE) {
-        BOOL res;
-
-        named_pipe_handle = CreateFileA(
-            relay_path,
-            GENERIC_READ | GENERIC_WRITE,
-            0,
-            NULL,
-            OPEN_EXISTING,
-            0,
-            NULL);
-
-        if (named_pipe_handle != INVALID_HANDLE_VALUE) {
-            break;
-        }
-
-        res = GetLastError();
-        if (res != ERROR_PIPE_BUSY) {
-            log_f("Failed to open pipe with error: 0x%x", res);
-
-            break;
-        }
-
-        if (!WaitNamedPipeA(relay_path, 10000)) {
-            log_f("Failed to open pipe, timeout reached");
-
-            break;
-        }
-    }
-
-    return named_pipe_handle;
 }
 
 int
 main()
 {
     Dcv__Extensions__DcvMessage* msg;
-    HANDLE named_pipe_handle;
+    dcv_channel* channel;
+    dcv_core_status status;
+    char request_id[REQUEST_ID_SIZE];
     int num_message = 0;
-    DWORD written_bytes;
 
-    sprintf(log_file, "%s_%i.log", LOG_FILE, GetCurrentProcessId());
+    sprintf(log_file, "%s_%i.log", LOG_FILE, getpid());
     log_init(log_file);
 
+    core = dcv_core_open(NULL);
+    if (core == NULL) {
+        log_f("Could not open stdin and stdout");
+        return -1;
+    }
+
     log_f("Sending request to setup virtual channel");
 
-    RequestVirtualChannel();
+    RequestVirtualChannel(request_id);
 
     log_f("Reading response");
 
-    msg = ReadNextMessage();
+    msg = ReadResponse(request_id);
     if (msg == NULL) {
         log_f("Could not get messages from stdin");
         return -1;
@@ -315,31 +221,17 @@ main()
     log_f("Response successful, connecting to named pipe: %s",
           msg->response->setup_virtual_channel_response->relay_path);
 
-    // Connect to named pipe
-    named_pipe_handle = SetupAndConnectNamedPipe(msg->response->setup_virtual_channel_response->relay_path);
-    if (named_pipe_handle == INVALID_HANDLE_VALUE) {
-        log_f("Failed to create and setup named pipe");
+    // Connect to named pipe and send auth token on it
+    status = dcv_channel_connect(msg->response->setup_virtual_channel_response->relay_path,
+                                 msg->response->setup_virtual_channel_response->virtual_channel_auth_token.data,
+                                 msg->response->setup_virtual_channel_response->virtual_channel_auth_token.len,
+                                 &channel);
+    if (status != DCV_CORE_OK) {
+        log_f("Failed to connect to named pipe: %i", status);
         dcv__extensions__dcv_message__free_unpacked(msg, NULL);
         return -1;
     }
 
-    // Send auth token on pipe
-    if (!WriteFile(named_pipe_handle,
-                   msg->response->setup_virtual_channel_response->virtual_channel_auth_token.data,
-                   msg->response->setup_virtual_channel_response->virtual_channel_auth_token.len,
-                   &written_bytes,
-                   NULL)) {
-        log_f("WriteFile of auth token failed with error 0x%x", GetLastError());
-
-        return -1;
-    }
-
-    if (FlushFileBuffers(named_pipe_handle) == 0) {
-        log_f("FlushFileBuffers of vc pipe failed with error 0x%x", GetLastError());
-
-        return -1;
-    }
-
     dcv__extensions__dcv_message__free_unpacked(msg, NULL);
 
     log_f("Waiting for pipe ready event");
@@ -370,45 +262,47 @@ main()
     // Write to / Read from named pipe
     for (num_message = 0; num_message < 100; ++num_message) {
         char message[100];
-        DWORD read_bytes;
+        dcv_buffer reply;
 
         sprintf(message, "Echo Test %i", num_message);
 
         log_f("Write: %s", message);
 
-        if (!WriteFile(named_pipe_handle, message, sizeof(message) + 1, &written_bytes, NULL)) {
-            log_f("WriteFile failed with error 0x%x", GetLastError());
+        status = dcv_channel_write(channel, message, strlen(message) + 1);
+        if (status != DCV_CORE_OK) {
+            log_f("Write failed: %i", status);
 
             break;
         }
 
-        if (!ReadFile(named_pipe_handle, read_buffer, READ_BUFFER_SIZE - 1, &read_bytes, NULL)) {
-            log_f("ReadFile failed with error 0x%x", GetLastError());
+        // Received into a pooled buffer, handed back once logged
+        status = dcv_channel_receive(channel, &reply);
+        if (status != DCV_CORE_OK) {
+            log_f("Read failed: %i", status);
 
             break;
         }
 
-        read_buffer[read_bytes] = '\0';
-        log_f("Read: %s", read_buffer);
-        memset(read_buffer, 0, READ_BUFFER_SIZE);
+        log_f("Read: %.*s", (int)reply.size, (const char*)reply.data);
+        dcv_buffer_release(&reply);
 
         Sleep(1000);
     }
 
     log_f("Closing named pipe");
 
-    CloseHandle(named_pipe_handle);
+    dcv_channel_close(channel);
 
     dcv__extensions__dcv_message__free_unpacked(msg, NULL);
 
     log_f("Sending close virtual channel request");
 
-    CloseVirtualChannel();
+    CloseVirtualChannel(request_id);
 
     log_f("Waiting for response");
 
     // Wait for response
-    msg = ReadNextMessage();
+    msg = ReadResponse(request_id);
     if (msg == NULL) {
         log_f("Could not get messages from stdin");
         return -1;
@@ -429,6 +323,9 @@ main()
 
     dcv__extensions__dcv_message__free_unpacked(msg, NULL);
 
+    dcv_core_log_stats(core);
+    dcv_core_close(core);
+
     log_f("Exiting");
 
     // We closed!
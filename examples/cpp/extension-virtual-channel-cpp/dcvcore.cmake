@@ -0,0 +1,53 @@
+# The protocol core shared by the C and C++ extensions, see src/dcvcore.h.
+# Included by both CMakeLists.txt files:
+#
+#   dcvcore         static library, what the extensions link
+#   dcvcore_shared  libdcvcore.so, only the dcv_* C functions exported
+#
+# The core has no protobuf dependency, the extensions pack and unpack
+# messages with their own runtime.
+
+set(DCVCORE_DIR ${CMAKE_CURRENT_LIST_DIR}/src)
+
+find_package(Threads REQUIRED)
+
+if(NOT DEFINED DCVEXT_MEMORY_ACCOUNTING)
+    option(DCVEXT_MEMORY_ACCOUNTING "Count C++ allocations by subsystem, see src/memstats.h" OFF)
+endif()
+
+set(DCVCORE_SOURCES
+    ${DCVCORE_DIR}/bufferpool.cpp
+    ${DCVCORE_DIR}/controlreader.cpp
+    ${DCVCORE_DIR}/dcvcore.cpp
+    ${DCVCORE_DIR}/memstats.cpp
+    ${DCVCORE_DIR}/simplelogger.c)
+
+add_library(dcvcore STATIC ${DCVCORE_SOURCES})
+target_include_directories(dcvcore PUBLIC ${DCVCORE_DIR})
+target_compile_definitions(dcvcore PUBLIC DCV_CORE_STATIC)
+target_compile_features(dcvcore PUBLIC cxx_std_20)
+target_compile_options(dcvcore PRIVATE -Wall -Wextra)
+if(DCVEXT_MEMORY_ACCOUNTING)
+    target_compile_definitions(dcvcore PRIVATE DCVEXT_MEMORY_ACCOUNTING)
+endif()
+target_link_libraries(dcvcore PUBLIC Threads::Threads)
+
+# A shared library must not replace operator new for its host, so no
+# memory accounting here
+add_library(dcvcore_shared SHARED ${DCVCORE_SOURCES})
+set_target_properties(dcvcore_shared PROPERTIES
+    OUTPUT_NAME dcvcore
+    VERSION 1.0.0
+    SOVERSION 1
+    C_VISIBILITY_PRESET hidden
+    CXX_VISIBILITY_PRESET hidden
+    VISIBILITY_INLINES_HIDDEN ON)
+target_include_directories(dcvcore_shared PUBLIC ${DCVCORE_DIR})
+target_compile_definitions(dcvcore_shared PRIVATE DCV_CORE_BUILD)
+target_compile_features(dcvcore_shared PUBLIC cxx_std_20)
+target_compile_options(dcvcore_shared PRIVATE -Wall -Wextra)
+# Template instantiations from the standard headers are exported even
+# with hidden visibility, the version script keeps them local
+target_link_options(dcvcore_shared PRIVATE -Wl,--version-script=${DCVCORE_DIR}/dcvcore.map)
+set_property(TARGET dcvcore_shared APPEND PROPERTY LINK_DEPENDS ${DCVCORE_DIR}/dcvcore.map)
+target_link_libraries(dcvcore_shared PRIVATE Threads::Threads)
@@ -0,0 +1,698 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "asyncecho.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "asyncextension.h"
+#include "handlerpool.h"
+#include "simplelogger.h"
+
+using namespace dcvext;
+
+namespace {
+
+const char CHANNEL_NAME[] = "echo";
+
+/*
+ * Echo of one channel checked by handlers on the pool. They run one at a
+ * time, in order, on the stream of the channel, and wake the channel
+ * coroutine once the message in flight has come back whole.
+ */
+struct PooledEcho
+{
+    PooledEcho(EventLoop& loop,
+               const std::string& name,
+               bool log_text)
+        : loop(loop),
+          name(name),
+          log_text(log_text)
+    {
+    }
+
+    EventLoop& loop;
+    const std::string name;
+    const bool log_text;
+
+    std::mutex lock;
+    const std::string* message = nullptr;
+    size_t received = 0;
+    bool matches = true;
+    // Cleared once ReceiveToPool() has completed and its reads have been checked
+    bool receiving = true;
+    std::coroutine_handle<> waiter;
+};
+
+// Echo of one channel read as a stream while the messages are sent back to back
+struct BatchedEcho
+{
+    EventLoop& loop;
+    bool reading;
+    bool ok;
+    std::coroutine_handle<> waiter;
+};
+
+// Shared by the channel coroutines, the last one to finish stops the loop
+struct EchoRun
+{
+    const EchoOptions& options;
+    int running;
+    int failed;
+    HandlerPool* pool;
+    // Outlive the coroutines, handlers may still run until the pool is drained
+    std::vector<std::unique_ptr<PooledEcho>> echoes;
+};
+
+Task<void>
+LogDcvInfo(AsyncExtension& extension)
+{
+    dcv::extensions::Request request;
+    request.mutable_get_dcv_info_request();
+
+    auto msg = co_await extension.Request(request);
+    if (msg == nullptr || !msg->has_response()) {
+        log_f("No response to DCV info request");
+        co_return;
+    }
+
+    log_f("Launched by DCV %s",
+          msg->response().get_dcv_info_response().dcv_role() == dcv::extensions::GetDcvInfoResponse_DcvRole_Client
+              ? "client"
+              : "server");
+}
+
+// The text message of main(), or one of the configured size filled with it
+void
+MakeMessage(const EchoOptions& options,
+            int channel_index,
+            int msg_number,
+            std::string& message)
+{
+    message = "C++ Async Test " + std::to_string(msg_number);
+
+    if (options.sizes.empty()) {
+        message.push_back('\0');
+        return;
+    }
+
+    size_t size = options.sizes[static_cast<size_t>(msg_number + channel_index) % options.sizes.size()];
+    size_t text_length = message.size();
+
+    message.resize(size);
+    for (size_t i = text_length; i < size; ++i) {
+        message[i] = message[i % text_length];
+    }
+}
+
+// Read back as many bytes as were written, false if they differ or the channel failed
+Task<bool>
+ReceiveEcho(AsyncVirtualChannel& channel,
+            const std::string& message,
+            bool log_text)
+{
+    size_t received = 0;
+
+    while (received < message.size()) {
+        BufferSlice reply = co_await channel.Receive();
+        if (reply.Empty()) {
+            log_f("Read failed");
+            co_return false;
+        }
+
+        if (log_text) {
+            // The slice may share its block with other data, print it without terminating it
+            const char* text = reinterpret_cast<const char*>(reply.Data());
+            log_f("Read: %.*s", static_cast<int>(strnlen(text, reply.Size())), text);
+        }
+
+        if (received + reply.Size() > message.size()
+            || memcmp(reply.Data(), message.data() + received, reply.Size()) != 0) {
+            log_f("Echo on channel '%s' does not match what was sent", channel.Name().c_str());
+            co_return false;
+        }
+
+        received += reply.Size();
+    }
+
+    co_return true;
+}
+
+// With echo.lock held
+bool
+EchoDone(const PooledEcho& echo)
+{
+    return !echo.receiving || (echo.message != nullptr && echo.received >= echo.message->size());
+}
+
+void
+CheckEcho(void* context,
+          BufferSlice& reply)
+{
+    PooledEcho& echo = *static_cast<PooledEcho*>(context);
+    std::coroutine_handle<> waiter;
+
+    {
+        std::lock_guard<std::mutex> lock(echo.lock);
+
+        if (echo.log_text) {
+            const char* text = reinterpret_cast<const char*>(reply.Data());
+            log_f("Read: %.*s", static_cast<int>(strnlen(text, reply.Size())), text);
+        }
+
+        if (echo.message == nullptr || echo.received + reply.Size() > echo.message->size()
+            || memcmp(reply.Data(), echo.message->data() + echo.received, reply.Size()) != 0) {
+            if (echo.matches) {
+                log_f("Echo on channel '%s' does not match what was sent", echo.name.c_str());
+            }
+            echo.matches = false;
+        }
+
+        echo.received += reply.Size();
+        if (EchoDone(echo)) {
+            waiter = std::exchange(echo.waiter, nullptr);
+        }
+    }
+
+    // Last, the channel coroutine may go on as soon as it is posted
+    if (waiter) {
+        echo.loop.PostFromThread(waiter);
+    }
+}
+
+// Waits for the message in flight to come back, or without one for the receiver to complete
+struct EchoAwaiter
+{
+    PooledEcho& echo;
+
+    bool
+    await_ready()
+    {
+        std::lock_guard<std::mutex> lock(echo.lock);
+        return EchoDone(echo);
+    }
+
+    bool
+    await_suspend(std::coroutine_handle<> handle)
+    {
+        std::lock_guard<std::mutex> lock(echo.lock);
+        if (EchoDone(echo)) {
+            return false;
+        }
+
+        echo.waiter = handle;
+        return true;
+    }
+
+    void
+    await_resume()
+    {
+    }
+};
+
+// False when the receiver stopped before the message in flight came back whole
+bool
+EchoReceived(PooledEcho& echo)
+{
+    std::lock_guard<std::mutex> lock(echo.lock);
+    return echo.received >= echo.message->size();
+}
+
+void
+ExpectEcho(PooledEcho& echo,
+           const std::string* message)
+{
+    std::lock_guard<std::mutex> lock(echo.lock);
+    echo.message = message;
+    echo.received = 0;
+}
+
+// Everything the channel will echo, ReceiveToPool() stops after that so the channel can be closed
+uint64_t
+EchoBytes(const EchoOptions& options,
+          int channel_index)
+{
+    uint64_t bytes = 0;
+    std::string message;
+
+    for (int msg_number = 0; msg_number < options.messages; ++msg_number) {
+        MakeMessage(options, channel_index, msg_number, message);
+        bytes += message.size();
+    }
+
+    return bytes;
+}
+
+// Handler queued behind every read on the stream, all of them have been checked when it runs
+void
+EndEchoes(void* context,
+          BufferSlice& /*message*/)
+{
+    PooledEcho& echo = *static_cast<PooledEcho*>(context);
+    std::coroutine_handle<> waiter;
+
+    {
+        std::lock_guard<std::mutex> lock(echo.lock);
+        echo.receiving = false;
+        waiter = std::exchange(echo.waiter, nullptr);
+    }
+
+    if (waiter) {
+        echo.loop.PostFromThread(waiter);
+    }
+}
+
+Task<void>
+ReceiveEchoes(AsyncVirtualChannel& channel,
+              HandlerPool& pool,
+              PooledEcho& echo,
+              uint64_t bytes)
+{
+    HandlerStream* stream = pool.OpenStream();
+
+    co_await channel.ReceiveToPool(pool, stream, CheckEcho, &echo, bytes);
+    co_await pool.SubmitAsync(echo.loop, stream, EndEchoes, &echo, BufferSlice());
+}
+
+// Read back every message of the channel, the echo may split or merge them in any way
+Task<bool>
+ReceiveEchoStream(AsyncVirtualChannel& channel,
+                  const EchoOptions& options,
+                  int channel_index,
+                  bool log_text)
+{
+    std::string message;
+    size_t offset = 0;
+    int msg_number = 0;
+
+    MakeMessage(options, channel_index, msg_number, message);
+
+    while (msg_number < options.messages) {
+        BufferSlice reply = co_await channel.Receive();
+        if (reply.Empty()) {
+            log_f("Read failed");
+            co_return false;
+        }
+
+        const uint8_t* data = reply.Data();
+        size_t size = reply.Size();
+
+        while (size > 0) {
+            size_t length = std::min(size, message.size() - offset);
+            if (msg_number == options.messages || memcmp(data, message.data() + offset, length) != 0) {
+                log_f("Echo on channel '%s' does not match what was sent", channel.Name().c_str());
+                co_return false;
+            }
+
+            data += length;
+            size -= length;
+            offset += length;
+
+            if (offset == message.size()) {
+                if (log_text) {
+                    log_f("Read: %s", message.c_str());
+                }
+
+                offset = 0;
+                if (++msg_number < options.messages) {
+                    MakeMessage(options, channel_index, msg_number, message);
+                }
+            }
+        }
+    }
+
+    co_return true;
+}
+
+Task<void>
+ReadBatchedEchoes(AsyncVirtualChannel& channel,
+                  const EchoOptions& options,
+                  int channel_index,
+                  bool log_text,
+                  BatchedEcho& echo)
+{
+    echo.ok = co_await ReceiveEchoStream(channel, options, channel_index, log_text);
+    echo.reading = false;
+
+    if (echo.waiter) {
+        echo.loop.Post(echo.waiter);
+        echo.waiter = nullptr;
+    }
+}
+
+struct BatchedEchoAwaiter
+{
+    BatchedEcho& echo;
+
+    bool
+    await_ready() const noexcept
+    {
+        return !echo.reading;
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+        echo.waiter = handle;
+    }
+
+    void
+    await_resume() const noexcept
+    {
+    }
+};
+
+// Same for a framed message, pings among the echoes are answered by ReadFrame()
+Task<bool>
+ReceiveFramedEcho(AsyncVirtualChannel& channel,
+                  const std::string& message,
+                  bool log_text)
+{
+    Frame frame;
+    if (!co_await channel.ReadFrame(frame)) {
+        log_f("Read failed");
+        co_return false;
+    }
+
+    if (log_text) {
+        const char* text = reinterpret_cast<const char*>(frame.data);
+        log_f("Read: %.*s", static_cast<int>(strnlen(text, frame.size)), text);
+    }
+
+    if (frame.size != message.size() || memcmp(frame.data, message.data(), frame.size) != 0) {
+        log_f("Echo on channel '%s' does not match what was sent", channel.Name().c_str());
+        co_return false;
+    }
+
+    co_return true;
+}
+
+// Write the message and wait for its echo, read here or checked on the pool
+Task<bool>
+EchoMessage(AsyncVirtualChannel& channel,
+            PooledEcho* echo,
+            const std::string& message,
+            bool log_text)
+{
+    if (echo != nullptr) {
+        ExpectEcho(*echo, &message);
+    }
+
+    IoResult res = co_await channel.Write(message.data(), message.size());
+    if (!res.Ok()) {
+        log_f("Write failed with error 0x%x", res.error);
+        co_return false;
+    }
+
+    if (echo == nullptr) {
+        co_return co_await ReceiveEcho(channel, message, log_text);
+    }
+
+    co_await EchoAwaiter{ *echo };
+    if (!EchoReceived(*echo)) {
+        log_f("Read failed");
+        co_return false;
+    }
+
+    co_return true;
+}
+
+void
+FinishChannel(AsyncExtension& extension,
+              EchoRun& run)
+{
+    if (--run.running > 0) {
+        return;
+    }
+
+    DefaultBufferPool().LogStats("Receive");
+    extension.Loop().Stop();
+}
+
+Task<void>
+EchoChannel(AsyncExtension& extension,
+            int index,
+            EchoRun& run)
+{
+    const EchoOptions& options = run.options;
+    std::string name = index == 0 ? CHANNEL_NAME : std::string(CHANNEL_NAME) + "-" + std::to_string(index);
+
+    log_f("Setting up virtual channel '%s'", name.c_str());
+
+    std::unique_ptr<AsyncVirtualChannel> channel = co_await extension.SetupChannel(name);
+    if (channel == nullptr) {
+        log_f("Failed to set up virtual channel '%s'", name.c_str());
+        run.failed++;
+        FinishChannel(extension, run);
+        co_return;
+    }
+
+    log_f("Write to / Read from virtual channel '%s'", name.c_str());
+
+    // The peer echoes our pings, we answer them and take the echo of the pong, a sample spans two round trips
+    bool framed = options.rtt_ms > 0;
+    if (framed) {
+        RttProbeOptions probe;
+        probe.interval = std::chrono::milliseconds(options.rtt_ms);
+        channel->SetRttProbe(probe);
+    }
+
+    // Per message logs only for the text messages, sized ones are for load tests
+    bool log_text = options.sizes.empty();
+    bool ok = true;
+    std::string message;
+
+    // Batched sends are read back by a coroutine of their own, the writer does not wait for them
+    bool batching = options.batch && options.messages > 0;
+    BatchedEcho batched = { extension.Loop(), batching, false, nullptr };
+    Clock::time_point started = Clock::now();
+    if (batching) {
+        BatchOptions batch;
+        batch.max_bytes = options.batch_bytes;
+        channel->SetBatchOptions(batch);
+        Spawn(ReadBatchedEchoes(*channel, options, index, log_text, batched));
+    }
+
+    // With a pool the echoes are checked there as they arrive, a mismatch fails the channel at the end
+    PooledEcho* echo = nullptr;
+    if (run.pool != nullptr && options.messages > 0) {
+        run.echoes.push_back(std::make_unique<PooledEcho>(extension.Loop(), name, log_text));
+        echo = run.echoes.back().get();
+        Spawn(ReceiveEchoes(*channel, *run.pool, *echo, EchoBytes(options, index)));
+    }
+
+    for (int msg_number = 0; msg_number < options.messages; ++msg_number) {
+        MakeMessage(options, index, msg_number, message);
+
+        if (log_text) {
+            log_f("Write: '%s'", message.c_str());
+        }
+
+        if (options.batch) {
+            ok = co_await channel->Send(message.data(), message.size());
+            if (!ok) {
+                log_f("Send failed");
+            }
+        } else if (framed) {
+            ok = co_await channel->WriteFrame(message.data(), message.size())
+                 && co_await ReceiveFramedEcho(*channel, message, log_text);
+        } else {
+            ok = co_await EchoMessage(*channel, echo, message, log_text);
+        }
+
+        if (!ok) {
+            break;
+        }
+
+        if (options.interval_ms > 0) {
+            co_await extension.Loop().Sleep(std::chrono::milliseconds(options.interval_ms));
+        }
+    }
+
+    if (batching) {
+        // The last messages may still wait for their deadline, a failed send leaves the reader to fail as well
+        if (!co_await channel->Flush()) {
+            ok = false;
+        }
+
+        co_await BatchedEchoAwaiter{ batched };
+        if (!batched.ok) {
+            ok = false;
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+        log_f("Channel '%s': %d messages echoed in %.1f ms through Send() %s",
+              name.c_str(),
+              options.messages,
+              seconds * 1000,
+              options.batch_bytes > 0 ? "with batching" : "without batching");
+    }
+
+    if (echo != nullptr) {
+        // No read may be pending when the channel is closed
+        ExpectEcho(*echo, nullptr);
+        co_await EchoAwaiter{ *echo };
+
+        std::lock_guard<std::mutex> lock(echo->lock);
+        if (!echo->matches) {
+            ok = false;
+        }
+    }
+
+    if (!co_await channel->Close()) {
+        ok = false;
+    }
+
+    if (!ok) {
+        run.failed++;
+    }
+    FinishChannel(extension, run);
+}
+
+} // namespace
+
+bool
+ParseSizes(const char* list,
+           std::vector<size_t>& sizes)
+{
+    sizes.clear();
+
+    while (*list != '\0') {
+        char* end;
+        unsigned long long size = strtoull(list, &end, 10);
+
+        if (end == list || size == 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+
+        sizes.push_back(static_cast<size_t>(size));
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return !sizes.empty();
+}
+
+bool
+ParseEchoOptions(int argc,
+                 char* argv[],
+                 EchoOptions& options)
+{
+    for (int arg = 0; arg < argc; ++arg) {
+        if (arg + 1 >= argc) {
+            log_f("Missing value for %s", argv[arg]);
+            return false;
+        }
+
+        const char* value = argv[++arg];
+        const char* option = argv[arg - 1];
+
+        if (strcmp(option, "--busy-poll") == 0) {
+            options.busy_poll = true;
+            options.cpu = atoi(value);
+        } else if (strcmp(option, "--channels") == 0) {
+            options.channels = atoi(value);
+        } else if (strcmp(option, "--messages") == 0) {
+            options.messages = atoi(value);
+        } else if (strcmp(option, "--size") == 0) {
+            if (!ParseSizes(value, options.sizes)) {
+                log_f("Invalid message sizes '%s'", value);
+                return false;
+            }
+        } else if (strcmp(option, "--interval") == 0) {
+            options.interval_ms = atoi(value);
+        } else if (strcmp(option, "--rtt") == 0) {
+            options.rtt_ms = atoi(value);
+        } else if (strcmp(option, "--batch") == 0) {
+            options.batch = true;
+            options.batch_bytes = static_cast<size_t>(strtoull(value, nullptr, 10));
+        } else if (strcmp(option, "--pool") == 0) {
+            options.pool = true;
+            options.pool_workers = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        } else {
+            log_f("Unknown option %s", option);
+            return false;
+        }
+    }
+
+    if (options.channels <= 0 || options.messages < 0 || options.interval_ms < 0 || options.rtt_ms < 0) {
+        log_f("Invalid echo options");
+        return false;
+    }
+
+    if (static_cast<int>(options.pool) + static_cast<int>(options.rtt_ms > 0) + static_cast<int>(options.batch) > 1) {
+        log_f("--pool, --rtt and --batch each read the echoes their own way, only one of them can be used");
+        return false;
+    }
+
+    return true;
+}
+
+int
+RunAsyncEcho(const EchoOptions& options)
+{
+    EventLoop loop;
+    if (!loop.IsValid()) {
+        return -1;
+    }
+
+    if (options.busy_poll) {
+        BusyPollOptions busy_poll;
+        busy_poll.enabled = true;
+        busy_poll.cpu = options.cpu;
+        loop.SetBusyPoll(busy_poll);
+    }
+
+    AsyncExtension extension(loop);
+    if (!extension.Start()) {
+        return -1;
+    }
+
+    std::unique_ptr<HandlerPool> pool;
+    if (options.pool) {
+        pool = std::make_unique<HandlerPool>(options.pool_workers);
+    }
+
+    EchoRun run = { options, options.channels, 0, pool.get(), {} };
+
+    // Runs while the channels are being set up, the responses are matched by id
+    Spawn(LogDcvInfo(extension));
+    for (int i = 0; i < options.channels; ++i) {
+        Spawn(EchoChannel(extension, i, run));
+    }
+    loop.Run();
+
+    if (pool != nullptr) {
+        pool->Drain();
+        pool->LogStats();
+    }
+
+    extension.LogControlStats();
+    if (options.busy_poll) {
+        loop.LogBusyPollStats();
+    }
+
+    return run.failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,61 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_ASYNC_ECHO
+#define DCV_EXTENSION_ASYNC_ECHO
+
+#include <cstddef>
+#include <vector>
+
+struct EchoOptions
+{
+    // Channels set up and echoed on at the same time
+    int channels = 1;
+    int messages = 100;
+    // Message sizes used in turn, empty for the text messages of main()
+    std::vector<size_t> sizes;
+    int interval_ms = 1000;
+    // Spin for channel data, pinned to cpu unless it is -1
+    bool busy_poll = false;
+    int cpu = -1;
+    // Check the echoes on a handler pool of that many workers, 0 for one per core
+    bool pool = false;
+    unsigned pool_workers = 0;
+    // Probe the round trip every rtt_ms, the messages are then sent as frames
+    int rtt_ms = 0;
+    // Send the messages back to back through a send batch of that many bytes, 0 for Send() without one
+    bool batch = false;
+    size_t batch_bytes = 0;
+};
+
+// Parse a comma separated list of sizes, each above 0
+bool
+ParseSizes(const char* list,
+           std::vector<size_t>& sizes);
+
+// Parse the command line options of the coroutine based flow
+bool
+ParseEchoOptions(int argc,
+                 char* argv[],
+                 EchoOptions& options);
+
+// Same echo sequence as main(), written on top of AsyncExtension
+int
+RunAsyncEcho(const EchoOptions& options);
+
+#endif // DCV_EXTENSION_ASYNC_ECHO
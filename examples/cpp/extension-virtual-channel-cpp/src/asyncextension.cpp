@@ -0,0 +1,1201 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "asyncextension.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "memstats.h"
+#include "simplelogger.h"
+#include "trafficlog.h"
+
+using namespace dcv::extensions;
+
+namespace dcvext {
+
+namespace {
+
+enum
+{
+    CONNECT_ATTEMPTS = 200,
+    CONNECT_RETRY_MS = 50
+};
+
+int64_t
+CurrentProcessId()
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+bool
+WriteAll(NativeHandle handle,
+         const uint8_t* buffer,
+         size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+#ifdef _WIN32
+        DWORD curr_written;
+        DWORD remaining = static_cast<DWORD>(size - written);
+
+        if (!WriteFile(handle, buffer + written, remaining, &curr_written, nullptr)) {
+            log_f("Could not write to handle: 0x%X", GetLastError());
+            return false;
+        }
+#else
+        ssize_t curr_written = write(handle, buffer + written, size - written);
+
+        if (curr_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // stdout may share its file description with the non-blocking stdin
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd = { handle, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            log_f("Could not write to handle: %i", errno);
+            return false;
+        }
+#endif
+
+        written += static_cast<size_t>(curr_written);
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool
+RequestAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    if (m_extension.m_closed) {
+        return false;
+    }
+
+    m_id = ++m_extension.m_last_request_id;
+    m_request.set_request_id(std::to_string(m_id));
+
+    // The request is borrowed from the caller, hand it back before msg goes away
+    ExtensionMessage msg;
+    msg.set_allocated_request(&m_request);
+    bool sent = m_extension.Send(msg);
+    static_cast<void>(msg.release_request());
+
+    if (!sent) {
+        return false;
+    }
+
+    m_waiter = handle;
+    m_extension.AddPending(this);
+
+    return true;
+}
+
+bool
+EventAwaiter::await_ready()
+{
+    if (!m_extension.m_events.empty()) {
+        m_event = std::move(m_extension.m_events.front());
+        m_extension.m_events.pop_front();
+        return true;
+    }
+
+    return m_extension.m_closed;
+}
+
+void
+EventAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_waiter = handle;
+
+    if (m_extension.m_event_waiters_tail != nullptr) {
+        m_extension.m_event_waiters_tail->m_next = this;
+    } else {
+        m_extension.m_event_waiters = this;
+    }
+    m_extension.m_event_waiters_tail = this;
+}
+
+AsyncVirtualChannel::AsyncVirtualChannel(AsyncExtension& extension,
+                                         const std::string& name)
+    : m_extension(extension),
+      m_name(name),
+      m_receive(DefaultBufferPool())
+{
+    m_relay.socket = true;
+    m_batch_timer.callback = OnBatchDeadline;
+    m_batch_timer.channel = this;
+    m_probe_timer.callback = OnProbeTimer;
+    m_probe_timer.channel = this;
+    m_dedup_decoder.SetMaxCacheBytes(m_dedup_options.max_peer_cache_bytes);
+    m_extension.m_channels.push_back(this);
+}
+
+AsyncVirtualChannel::~AsyncVirtualChannel()
+{
+    // Their frames would resume into a destroyed channel
+    if (m_detached != 0) {
+        log_f("Channel '%s' destroyed with %u writes still running, it must be closed first",
+              m_name.c_str(),
+              m_detached);
+    }
+    assert(m_detached == 0);
+
+    m_extension.m_loop.CancelTimer(&m_batch_timer);
+    m_extension.m_loop.CancelTimer(&m_probe_timer);
+    CloseRelay();
+    m_extension.RemoveChannel(this);
+}
+
+IoResult
+ChannelIoAwaiter::await_resume() const
+{
+    IoResult res = IoAwaiter::await_resume();
+
+    if (capture_enabled) {
+        if (res.bytes > 0) {
+            CaptureRecord(write ? TRAFFIC_CHANNEL_OUT : TRAFFIC_CHANNEL_IN, m_capture_index, buffer, res.bytes);
+        }
+        if (!res.Ok() || (!write && res.bytes == 0)) {
+            CaptureRecord(TRAFFIC_CHANNEL_CLOSED, m_capture_index, nullptr, 0);
+        }
+    }
+
+    return res;
+}
+
+ChannelIoAwaiter
+AsyncVirtualChannel::Read(void* buffer,
+                          size_t size)
+{
+    return ChannelIoAwaiter(m_extension.m_loop, m_relay, buffer, size, false, m_capture_index);
+}
+
+ChannelIoAwaiter
+AsyncVirtualChannel::Write(const void* buffer,
+                           size_t size)
+{
+    return ChannelIoAwaiter(m_extension.m_loop, m_relay, buffer, size, true, m_capture_index);
+}
+
+Task<BufferSlice>
+AsyncVirtualChannel::Receive()
+{
+    size_t size;
+    uint8_t* buffer = m_receive.Prepare(size);
+    if (buffer == nullptr) {
+        co_return BufferSlice();
+    }
+
+    IoResult res = co_await Read(buffer, size);
+    if (!res.Ok() || res.bytes == 0) {
+        co_return BufferSlice();
+    }
+
+    co_return m_receive.Commit(res.bytes);
+}
+
+Task<void>
+AsyncVirtualChannel::ReceiveToPool(HandlerPool& pool,
+                                   HandlerStream* stream,
+                                   MessageHandler handler,
+                                   void* context,
+                                   uint64_t limit)
+{
+    uint64_t received = 0;
+
+    while (limit == 0 || received < limit) {
+        BufferSlice message = co_await Receive();
+        if (message.Empty()) {
+            co_return;
+        }
+
+        received += message.Size();
+        co_await pool.SubmitAsync(m_extension.m_loop, stream, handler, context, std::move(message));
+    }
+}
+
+Task<bool>
+AsyncVirtualChannel::Connect(const std::string& relay_path)
+{
+#ifdef _WIN32
+    for (int attempt = 0;; ++attempt) {
+        m_relay.handle = CreateFileA(relay_path.c_str(),
+                                     GENERIC_READ | GENERIC_WRITE,
+                                     0,
+                                     nullptr,
+                                     OPEN_EXISTING,
+                                     FILE_FLAG_OVERLAPPED,
+                                     nullptr);
+
+        if (m_relay.handle != INVALID_HANDLE_VALUE) {
+            break;
+        }
+
+        DWORD res = GetLastError();
+        if (res != ERROR_PIPE_BUSY || attempt == CONNECT_ATTEMPTS) {
+            log_f("Failed to open pipe with error: 0x%x", res);
+            co_return false;
+        }
+
+        // Unlike WaitNamedPipe this keeps the loop running while we wait
+        co_await m_extension.m_loop.Sleep(std::chrono::milliseconds(CONNECT_RETRY_MS));
+    }
+#else
+    sockaddr_un addr = {};
+    socklen_t addr_len;
+
+    if (relay_path.empty() || relay_path.size() >= sizeof addr.sun_path - 1) {
+        log_f("Invalid relay path '%s'", relay_path.c_str());
+        co_return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+#ifdef __linux__
+    // On Linux DCV creates the relay in the abstract namespace
+    memcpy(addr.sun_path + 1, relay_path.data(), relay_path.size());
+    addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + relay_path.size());
+#else
+    memcpy(addr.sun_path, relay_path.data(), relay_path.size());
+    addr_len = static_cast<socklen_t>(sizeof addr);
+#endif
+
+    m_relay.handle = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_relay.handle < 0) {
+        log_f("Could not create relay socket: %i", errno);
+        co_return false;
+    }
+
+    if (connect(m_relay.handle, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0) {
+        log_f("Could not connect to relay '%s': %i", relay_path.c_str(), errno);
+        close(m_relay.handle);
+        co_return false;
+    }
+#endif
+
+    if (!m_extension.m_loop.Register(m_relay)) {
+#ifdef _WIN32
+        CloseHandle(m_relay.handle);
+#else
+        close(m_relay.handle);
+#endif
+        co_return false;
+    }
+
+    m_connected = true;
+    m_capture_index = CaptureChannelOpen(m_name);
+
+    co_return true;
+}
+
+void
+AsyncVirtualChannel::CloseRelay()
+{
+    if (!m_connected) {
+        return;
+    }
+
+    m_extension.m_loop.Unregister(m_relay);
+#ifdef _WIN32
+    CloseHandle(m_relay.handle);
+#else
+    close(m_relay.handle);
+#endif
+    m_connected = false;
+}
+
+Task<bool>
+AsyncVirtualChannel::Close()
+{
+    if (!co_await Flush()) {
+        log_f("Could not flush the send batch of channel '%s'", m_name.c_str());
+    }
+    if (m_batch_stats.batches > 0) {
+        LogBatchStats();
+    }
+
+    // Let probes, pongs and deadline flushes finish, they hold on to the channel
+    m_extension.m_loop.CancelTimer(&m_probe_timer);
+    co_await DetachedIdleAwaiter{ *this };
+    co_await FrameWriterAwaiter{ *this };
+    ReleaseFrameWriter();
+    if (m_pings_sent > 0) {
+        LogRttStats();
+    }
+    if (GetSentDedupStats().messages > 0 || GetReceivedDedupStats().messages > 0) {
+        LogDedupStats();
+    }
+
+    // No read or write may be pending on the relay at this point
+    CloseRelay();
+
+    dcv::extensions::Request request;
+    request.mutable_close_virtual_channel_request()->set_virtual_channel_name(m_name);
+
+    auto msg = co_await m_extension.Request(request);
+    if (msg == nullptr || !msg->has_response()) {
+        log_f("No response to close request for channel '%s'", m_name.c_str());
+        co_return false;
+    }
+
+    if (msg->response().status() != Response_Status_SUCCESS) {
+        log_f("Error in response for close request %u", msg->response().status());
+        co_return false;
+    }
+
+    co_return true;
+}
+
+Task<bool>
+AsyncVirtualChannel::ReadFrame(Frame& frame)
+{
+    if (m_frame_failed) {
+        co_return false;
+    }
+
+    // The frame returned last time is no longer in use
+    m_rx_begin += m_rx_returned;
+    m_rx_returned = 0;
+    if (m_rx_begin == m_rx_end) {
+        m_rx_begin = 0;
+        m_rx_end = 0;
+    }
+
+    for (;;) {
+        size_t wire_size = 0;
+        char error[128];
+
+        FrameStatus status = DecodeFrame(m_rx.data() + m_rx_begin,
+                                         m_rx_end - m_rx_begin,
+                                         m_frame_options,
+                                         frame,
+                                         wire_size,
+                                         error,
+                                         &m_rx_progress);
+
+        if (status == FRAME_COMPLETE) {
+            m_frames_read++;
+
+            if (frame.type == FRAME_TYPE_DEDUP) {
+                MemoryScope scope(MEMORY_CHANNELS);
+                if (!m_dedup_decoder.Decode(frame.data,
+                                            frame.size,
+                                            m_frame_options.max_payload,
+                                            frame.type,
+                                            m_dedup_rx,
+                                            error)) {
+                    log_f("Could not decode frame %llu on channel '%s': %s",
+                          static_cast<unsigned long long>(m_frames_read),
+                          m_name.c_str(),
+                          error);
+                    m_frame_failed = true;
+                    co_return false;
+                }
+
+                frame.data = m_dedup_rx.data();
+                frame.size = m_dedup_rx.size();
+                m_rx_returned = wire_size;
+                co_return true;
+            }
+
+            if (frame.type >= FRAME_TYPE_RESERVED) {
+                HandleControlFrame(frame, m_rx_time);
+                m_rx_begin += wire_size;
+                continue;
+            }
+
+            m_rx_returned = wire_size;
+            co_return true;
+        }
+
+        if (status != FRAME_INCOMPLETE) {
+            log_f("Corrupted frame %llu on channel '%s': %s",
+                  static_cast<unsigned long long>(m_frames_read + 1),
+                  m_name.c_str(),
+                  error);
+            m_frame_failed = true;
+            co_return false;
+        }
+
+        // Make room for the rest of the frame, or at least its header
+        size_t needed = wire_size != 0 ? wire_size : size_t(FRAME_HEADER_SIZE);
+        if (m_rx_begin > 0 && m_rx_begin + needed > m_rx.size()) {
+            memmove(m_rx.data(), m_rx.data() + m_rx_begin, m_rx_end - m_rx_begin);
+            m_rx_end -= m_rx_begin;
+            m_rx_begin = 0;
+        }
+        if (needed > m_rx.size() || m_rx_end == m_rx.size()) {
+            MemoryScope scope(MEMORY_CHANNELS);
+            m_rx.resize(std::max<size_t>({ needed, FRAME_READ_SIZE, m_rx.size() * 2 }));
+        }
+
+        IoResult res = co_await Read(m_rx.data() + m_rx_end, m_rx.size() - m_rx_end);
+        if (!res.Ok() || res.bytes == 0) {
+            co_return false;
+        }
+        m_rx_end += res.bytes;
+        m_rx_time = Clock::now();
+    }
+}
+
+Task<bool>
+AsyncVirtualChannel::WriteFrame(const void* payload,
+                                size_t size,
+                                uint8_t type)
+{
+    // The peer drops the channel on a frame over the limit, better to fail this write only
+    if (size > m_frame_options.max_payload || size > UINT32_MAX) {
+        log_f("Frame of %zu bytes exceeds the limit of %zu", size, m_frame_options.max_payload);
+        co_return false;
+    }
+
+    // Those would be taken for the channel layer's own frames on the other end
+    if (type >= FRAME_TYPE_RESERVED) {
+        log_f("Frame type 0x%02x is reserved for the channel layer", type);
+        co_return false;
+    }
+
+    co_await FrameWriterAwaiter{ *this };
+
+    // Encoded in write order, the peer decodes in the same order
+    {
+        MemoryScope scope(MEMORY_CHANNELS);
+
+        // Sent as is when the encoding could grow past the limit, which a barely compressible message can
+        m_tx.clear();
+        if (m_dedup_options.enabled && size >= m_dedup_options.min_size
+            && DedupEncoder::MaxEncodedSize(size) <= m_frame_options.max_payload) {
+            m_dedup_tx.clear();
+            m_dedup_encoder.Encode(type, payload, size, m_dedup_tx);
+            EncodeFrame(FRAME_TYPE_DEDUP, m_dedup_tx.data(), m_dedup_tx.size(), m_frame_options, m_tx);
+        } else {
+            EncodeFrame(type, payload, size, m_frame_options, m_tx);
+        }
+    }
+
+    IoResult res = co_await Write(m_tx.data(), m_tx.size());
+
+    ReleaseFrameWriter();
+
+    co_return res.Ok();
+}
+
+void
+AsyncVirtualChannel::ReleaseFrameWriter()
+{
+    if (m_frame_writers.empty()) {
+        m_frame_writing = false;
+        return;
+    }
+
+    // The next writer runs with m_frame_writing still set
+    m_extension.m_loop.Post(m_frame_writers.front());
+    m_frame_writers.pop_front();
+}
+
+void
+AsyncVirtualChannel::SpawnDetached(Task<void> task)
+{
+    m_detached++;
+    Spawn(RunDetached(std::move(task)));
+}
+
+Task<void>
+AsyncVirtualChannel::RunDetached(Task<void> task)
+{
+    co_await task;
+
+    if (--m_detached == 0 && m_detached_waiter) {
+        m_extension.m_loop.Post(m_detached_waiter);
+        m_detached_waiter = nullptr;
+    }
+}
+
+void
+AsyncVirtualChannel::SetRttProbe(const RttProbeOptions& options)
+{
+    m_extension.m_loop.CancelTimer(&m_probe_timer);
+
+    m_probe_options = options;
+    m_rtt_window.Reset(options.window);
+    m_pings_sent = 0;
+    m_pongs_received = 0;
+    m_pongs_dropped = 0;
+    m_ping_outstanding = false;
+
+    if (options.interval > Clock::duration::zero()) {
+        m_probe_timer.deadline = Clock::now() + options.interval;
+        m_extension.m_loop.AddTimer(&m_probe_timer);
+    }
+}
+
+RttStats
+AsyncVirtualChannel::GetRttStats() const
+{
+    RttStats stats;
+
+    m_rtt_window.Stats(stats);
+    stats.pings_sent = m_pings_sent;
+    stats.pongs_received = m_pongs_received;
+    stats.pongs_dropped = m_pongs_dropped;
+
+    return stats;
+}
+
+void
+AsyncVirtualChannel::LogRttStats() const
+{
+    std::string name = "Channel '" + m_name + "'";
+
+    dcvext::LogRttStats(name.c_str(), GetRttStats());
+}
+
+void
+AsyncVirtualChannel::SetDedupOptions(const DedupOptions& options)
+{
+    m_dedup_options = options;
+    m_dedup_decoder.SetMaxCacheBytes(options.max_peer_cache_bytes);
+
+    if (options.enabled) {
+        m_dedup_encoder.Reset(options.cache_bytes);
+    }
+}
+
+void
+AsyncVirtualChannel::LogDedupStats() const
+{
+    std::string name = "Channel '" + m_name + "' sent";
+    dcvext::LogDedupStats(name.c_str(), GetSentDedupStats());
+
+    name = "Channel '" + m_name + "' received";
+    dcvext::LogDedupStats(name.c_str(), GetReceivedDedupStats());
+}
+
+void
+AsyncVirtualChannel::OnProbeTimer(TimerNode* timer)
+{
+    AsyncVirtualChannel* channel = static_cast<ProbeTimer*>(timer)->channel;
+
+    if (!channel->m_connected) {
+        return;
+    }
+
+    // Only one ping in flight, a slow peer is not sent more of them
+    if (!channel->m_ping_outstanding) {
+        channel->m_ping_outstanding = true;
+        channel->m_ping_sequence = channel->m_pings_sent;
+        channel->SpawnDetached(channel->SendPing());
+    }
+
+    // Keep the cadence, unless the loop fell behind by more than an interval
+    Clock::time_point now = Clock::now();
+    timer->deadline += channel->m_probe_options.interval;
+    if (timer->deadline <= now) {
+        timer->deadline = now + channel->m_probe_options.interval;
+    }
+    channel->m_extension.m_loop.AddTimer(timer);
+}
+
+void
+AsyncVirtualChannel::HandleControlFrame(const Frame& frame,
+                                        Clock::time_point when)
+{
+    switch (frame.type) {
+    case FRAME_TYPE_PING: {
+        std::array<uint8_t, RTT_PING_SIZE> ping;
+
+        if (frame.size != ping.size()) {
+            log_f("Ignoring ping of %zu bytes on channel '%s'", frame.size, m_name.c_str());
+            break;
+        }
+
+        memcpy(ping.data(), frame.data, ping.size());
+        SpawnDetached(SendPong(ping, when));
+        break;
+    }
+
+    case FRAME_TYPE_PONG: {
+        uint64_t sequence;
+        Clock::time_point sent;
+        Clock::duration hold;
+
+        if (!DecodePong(frame.data, frame.size, sequence, sent, hold)) {
+            log_f("Ignoring pong of %zu bytes on channel '%s'", frame.size, m_name.c_str());
+            break;
+        }
+
+        // A pong to an earlier ping, repeated, or from before SetRttProbe() would be a wrong sample
+        if (!m_ping_outstanding || sequence != m_ping_sequence) {
+            m_pongs_dropped++;
+            break;
+        }
+
+        m_pongs_received++;
+        m_ping_outstanding = false;
+        m_rtt_window.Add(when - sent - hold, hold);
+        break;
+    }
+
+    default:
+        log_f("Ignoring frame of unknown type 0x%x on channel '%s'", frame.type, m_name.c_str());
+        break;
+    }
+}
+
+/*
+ * Probes are timestamped once they hold the writer role, time spent queued
+ * behind other frames on this side is not part of the round trip. On the
+ * answering side it is, as hold time.
+ */
+Task<void>
+AsyncVirtualChannel::SendPing()
+{
+    uint8_t payload[RTT_PING_SIZE];
+
+    co_await FrameWriterAwaiter{ *this };
+
+    if (m_connected) {
+        m_tx.clear();
+        EncodePing(m_ping_sequence, Clock::now(), payload);
+        m_pings_sent++;
+        EncodeFrame(FRAME_TYPE_PING, payload, sizeof payload, m_frame_options, m_tx);
+        co_await Write(m_tx.data(), m_tx.size());
+    } else {
+        m_ping_outstanding = false;
+    }
+
+    ReleaseFrameWriter();
+}
+
+Task<void>
+AsyncVirtualChannel::SendPong(std::array<uint8_t, RTT_PING_SIZE> ping,
+                              Clock::time_point received)
+{
+    uint8_t payload[RTT_PONG_SIZE];
+
+    co_await FrameWriterAwaiter{ *this };
+
+    if (m_connected) {
+        m_tx.clear();
+        EncodePong(ping.data(), ping.size(), Clock::now() - received, payload);
+        EncodeFrame(FRAME_TYPE_PONG, payload, sizeof payload, m_frame_options, m_tx);
+        co_await Write(m_tx.data(), m_tx.size());
+    }
+
+    ReleaseFrameWriter();
+}
+
+Task<bool>
+AsyncVirtualChannel::Send(const void* buffer,
+                          size_t size,
+                          bool flush)
+{
+    if (m_batch_options.max_bytes == 0) {
+        IoResult res = co_await Write(buffer, size);
+        co_return res.Ok();
+    }
+
+    if (m_batch_failed) {
+        co_return false;
+    }
+
+    // The deadline is set by the oldest write in the batch
+    if (m_batch.empty()) {
+        m_batch_timer.deadline = Clock::now() + m_batch_options.latency_budget;
+        m_extension.m_loop.AddTimer(&m_batch_timer);
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(buffer);
+    m_batch.insert(m_batch.end(), data, data + size);
+    m_batch_messages++;
+
+    if (flush) {
+        co_return co_await FlushBatch(FLUSH_EXPLICIT);
+    }
+    if (m_batch.size() >= m_batch_options.max_bytes) {
+        co_return co_await FlushBatch(FLUSH_FULL);
+    }
+
+    co_return true;
+}
+
+Task<bool>
+AsyncVirtualChannel::Flush()
+{
+    return FlushBatch(FLUSH_EXPLICIT);
+}
+
+void
+AsyncVirtualChannel::OnBatchDeadline(TimerNode* timer)
+{
+    AsyncVirtualChannel* channel = static_cast<BatchTimer*>(timer)->channel;
+
+    // The running write picks the batch up when it is done
+    if (channel->m_batch_writing) {
+        channel->m_batch_due = true;
+        return;
+    }
+
+    channel->SpawnDetached(channel->WriteBatch(FLUSH_DEADLINE));
+}
+
+Task<bool>
+AsyncVirtualChannel::FlushBatch(FlushReason reason)
+{
+    // A deadline flush may have started again before we got to run
+    while (m_batch_writing) {
+        co_await BatchIdleAwaiter{ *this };
+    }
+
+    if (m_batch.empty()) {
+        co_return !m_batch_failed;
+    }
+
+    co_await WriteBatch(reason);
+
+    co_return !m_batch_failed;
+}
+
+/*
+ * Write the current batch, new sends go to the other buffer meanwhile. Only
+ * one batch write runs at a time: a deadline expiring during the write is
+ * handled when it completes, a flushing Send() waits for it.
+ */
+Task<void>
+AsyncVirtualChannel::WriteBatch(FlushReason reason)
+{
+    m_batch_writing = true;
+
+    do {
+        m_batch_due = false;
+        m_extension.m_loop.CancelTimer(&m_batch_timer);
+
+        if (m_batch.empty() || m_batch_failed) {
+            break;
+        }
+
+        size_t bytes = m_batch.size();
+        int message_bucket = 0;
+        int byte_bucket = 0;
+        while (message_bucket < BATCH_HISTOGRAM_BUCKETS - 1 && (m_batch_messages >> (message_bucket + 1)) != 0) {
+            message_bucket++;
+        }
+        while (byte_bucket < BATCH_HISTOGRAM_BUCKETS - 1 && (bytes >> (byte_bucket + 1)) != 0) {
+            byte_bucket++;
+        }
+
+        m_batch_stats.messages += m_batch_messages;
+        m_batch_stats.bytes += bytes;
+        m_batch_stats.batches++;
+        m_batch_stats.messages_per_batch[message_bucket]++;
+        m_batch_stats.bytes_per_batch[byte_bucket]++;
+        switch (reason) {
+        case FLUSH_FULL:
+            m_batch_stats.flushed_full++;
+            break;
+        case FLUSH_DEADLINE:
+            m_batch_stats.flushed_deadline++;
+            break;
+        case FLUSH_EXPLICIT:
+            m_batch_stats.flushed_explicit++;
+            break;
+        }
+
+        m_batch.swap(m_batch_writing_buffer);
+        m_batch.clear();
+        m_batch_messages = 0;
+
+        IoResult res = co_await Write(m_batch_writing_buffer.data(), bytes);
+        if (!res.Ok()) {
+            log_f("Batch write on channel '%s' failed with error 0x%x", m_name.c_str(), res.error);
+            m_batch_failed = true;
+        }
+
+        reason = FLUSH_DEADLINE;
+    } while (m_batch_due);
+
+    m_batch_writing = false;
+
+    if (m_batch_waiter) {
+        m_extension.m_loop.Post(m_batch_waiter);
+        m_batch_waiter = nullptr;
+    }
+}
+
+void
+AsyncVirtualChannel::LogBatchStats() const
+{
+    const BatchStats& stats = m_batch_stats;
+
+    log_f("Channel '%s': %llu messages, %llu bytes in %llu batches (full %llu, deadline %llu, explicit %llu)",
+          m_name.c_str(),
+          static_cast<unsigned long long>(stats.messages),
+          static_cast<unsigned long long>(stats.bytes),
+          static_cast<unsigned long long>(stats.batches),
+          static_cast<unsigned long long>(stats.flushed_full),
+          static_cast<unsigned long long>(stats.flushed_deadline),
+          static_cast<unsigned long long>(stats.flushed_explicit));
+
+    for (int i = 0; i < BATCH_HISTOGRAM_BUCKETS; ++i) {
+        if (stats.messages_per_batch[i] != 0) {
+            log_f("  %llu-%llu messages: %llu batches",
+                  1ull << i,
+                  (2ull << i) - 1,
+                  static_cast<unsigned long long>(stats.messages_per_batch[i]));
+        }
+    }
+    for (int i = 0; i < BATCH_HISTOGRAM_BUCKETS; ++i) {
+        if (stats.bytes_per_batch[i] != 0) {
+            log_f("  %llu-%llu bytes: %llu batches",
+                  1ull << i,
+                  (2ull << i) - 1,
+                  static_cast<unsigned long long>(stats.bytes_per_batch[i]));
+        }
+    }
+}
+
+AsyncExtension::AsyncExtension(EventLoop& loop)
+    : m_loop(loop)
+{
+#ifdef _WIN32
+    m_input.handle = GetStdHandle(STD_INPUT_HANDLE);
+    m_input.blocking = true;
+    m_output = GetStdHandle(STD_OUTPUT_HANDLE);
+#else
+    m_input.handle = STDIN_FILENO;
+    m_output = STDOUT_FILENO;
+#endif
+}
+
+AsyncExtension::~AsyncExtension()
+{
+    if (m_started) {
+        m_loop.Unregister(m_input);
+    }
+}
+
+bool
+AsyncExtension::Start()
+{
+#ifdef _WIN32
+    if (m_input.handle == INVALID_HANDLE_VALUE || m_output == INVALID_HANDLE_VALUE) {
+        log_f("Error getting std handles: 0x%X", GetLastError());
+        return false;
+    }
+#endif
+
+    if (!m_loop.Register(m_input)) {
+        return false;
+    }
+
+    m_started = true;
+    Spawn(ReadLoop());
+
+    return true;
+}
+
+bool
+AsyncExtension::Send(const ExtensionMessage& msg)
+{
+    uint32_t msg_sz = static_cast<uint32_t>(msg.ByteSizeLong());
+
+    /*
+     * Size and message go out with a single write
+     */
+    {
+        MemoryScope scope(MEMORY_CONTROL);
+        m_write_buffer.resize(sizeof msg_sz + msg_sz);
+    }
+    memcpy(m_write_buffer.data(), &msg_sz, sizeof msg_sz);
+    if (!msg.SerializeToArray(m_write_buffer.data() + sizeof msg_sz, static_cast<int>(msg_sz))) {
+        log_f("Could not serialize message");
+        return false;
+    }
+
+    CaptureRecord(TRAFFIC_CONTROL_OUT, 0, m_write_buffer.data() + sizeof msg_sz, msg_sz);
+
+    return WriteAll(m_output, m_write_buffer.data(), m_write_buffer.size());
+}
+
+Task<void>
+AsyncExtension::ReadLoop()
+{
+    for (;;) {
+        size_t space;
+        uint8_t* buffer = m_reader.Prepare(space);
+
+        IoResult res = co_await m_loop.Read(m_input, buffer, space);
+        if (!res.Ok() || res.bytes == 0) {
+            log_f("Stopped reading from stdin: %u", res.error);
+            FailAll();
+            co_return;
+        }
+        m_reader.Commit(res.bytes);
+
+        /*
+         * Dispatch everything the read completed, a burst of events from DCV
+         * is taken in with one read
+         */
+        const uint8_t* data;
+        uint32_t msg_sz;
+        FrameStatus status;
+
+        while ((status = m_reader.Next(data, msg_sz)) == FRAME_COMPLETE) {
+            std::unique_ptr<DcvMessage> msg;
+            {
+                MemoryScope scope(MEMORY_MESSAGES);
+
+                msg = std::make_unique<DcvMessage>();
+                if (!msg->ParseFromArray(data, static_cast<int>(msg_sz))) {
+                    log_f("Could not unpack message from std input");
+                    continue;
+                }
+            }
+
+            CaptureDcvMessage(*msg, data, msg_sz);
+            Dispatch(std::move(msg));
+        }
+
+        if (status != FRAME_INCOMPLETE) {
+            FailAll();
+            co_return;
+        }
+    }
+}
+
+void
+AsyncExtension::Dispatch(std::unique_ptr<DcvMessage> msg)
+{
+    if (msg->has_response()) {
+        DispatchResponse(std::move(msg));
+    } else if (msg->has_event()) {
+        DispatchEvent(std::move(msg));
+    } else {
+        log_f("Unexpected message case %u", msg->msg_case());
+    }
+}
+
+void
+AsyncExtension::AddPending(RequestAwaiter* awaiter)
+{
+    RequestAwaiter*& bucket = m_pending[awaiter->m_id % PENDING_BUCKETS];
+
+    awaiter->m_next = bucket;
+    bucket = awaiter;
+}
+
+void
+AsyncExtension::DispatchResponse(std::unique_ptr<DcvMessage> msg)
+{
+    uint64_t id = strtoull(msg->response().request_id().c_str(), nullptr, 10);
+    RequestAwaiter** link = &m_pending[id % PENDING_BUCKETS];
+
+    while (*link != nullptr && (*link)->m_id != id) {
+        link = &(*link)->m_next;
+    }
+
+    if (*link == nullptr) {
+        log_f("Response for unknown request '%s'", msg->response().request_id().c_str());
+        return;
+    }
+
+    RequestAwaiter* awaiter = *link;
+    *link = awaiter->m_next;
+
+    awaiter->m_response = std::move(msg);
+    m_loop.Post(awaiter->m_waiter);
+}
+
+void
+AsyncExtension::DispatchEvent(std::unique_ptr<DcvMessage> msg)
+{
+    const Event& event = msg->event();
+
+    if (event.has_virtual_channel_ready_event() || event.has_virtual_channel_closed_event()) {
+        const std::string& name = event.has_virtual_channel_ready_event()
+            ? event.virtual_channel_ready_event().virtual_channel_name()
+            : event.virtual_channel_closed_event().virtual_channel_name();
+
+        AsyncVirtualChannel* channel = FindChannel(name);
+        if (channel == nullptr) {
+            log_f("Event %u for unknown channel '%s'", event.event_case(), name.c_str());
+            return;
+        }
+
+        if (event.has_virtual_channel_ready_event()) {
+            channel->m_ready = true;
+        } else {
+            channel->m_closed = true;
+        }
+
+        if (channel->m_ready_waiter) {
+            m_loop.Post(std::exchange(channel->m_ready_waiter, nullptr));
+        }
+
+        return;
+    }
+
+    EventAwaiter* waiter = m_event_waiters;
+    if (waiter == nullptr) {
+        m_events.push_back(std::move(msg));
+        return;
+    }
+
+    m_event_waiters = waiter->m_next;
+    if (m_event_waiters == nullptr) {
+        m_event_waiters_tail = nullptr;
+    }
+
+    waiter->m_event = std::move(msg);
+    m_loop.Post(waiter->m_waiter);
+}
+
+void
+AsyncExtension::FailAll()
+{
+    m_closed = true;
+
+    for (RequestAwaiter*& bucket : m_pending) {
+        for (RequestAwaiter* awaiter = bucket; awaiter != nullptr; awaiter = awaiter->m_next) {
+            m_loop.Post(awaiter->m_waiter);
+        }
+        bucket = nullptr;
+    }
+
+    for (EventAwaiter* waiter = m_event_waiters; waiter != nullptr; waiter = waiter->m_next) {
+        m_loop.Post(waiter->m_waiter);
+    }
+    m_event_waiters = nullptr;
+    m_event_waiters_tail = nullptr;
+
+    for (AsyncVirtualChannel* channel : m_channels) {
+        channel->m_closed = true;
+        if (channel->m_ready_waiter) {
+            m_loop.Post(std::exchange(channel->m_ready_waiter, nullptr));
+        }
+    }
+}
+
+AsyncVirtualChannel*
+AsyncExtension::FindChannel(const std::string& name)
+{
+    for (AsyncVirtualChannel* channel : m_channels) {
+        if (channel->m_name == name) {
+            return channel;
+        }
+    }
+
+    return nullptr;
+}
+
+void
+AsyncExtension::RemoveChannel(AsyncVirtualChannel* channel)
+{
+    for (auto it = m_channels.begin(); it != m_channels.end(); ++it) {
+        if (*it == channel) {
+            m_channels.erase(it);
+            return;
+        }
+    }
+}
+
+Task<std::unique_ptr<AsyncVirtualChannel>>
+AsyncExtension::SetupChannel(const std::string& name)
+{
+    // Registered right away, the ready event may arrive while we are still connecting
+    std::unique_ptr<AsyncVirtualChannel> channel(new AsyncVirtualChannel(*this, name));
+
+    dcv::extensions::Request request;
+    SetupVirtualChannelRequest* setup = request.mutable_setup_virtual_channel_request();
+    setup->set_virtual_channel_name(name);
+    setup->set_relay_client_process_id(CurrentProcessId());
+
+    auto msg = co_await Request(request);
+    if (msg == nullptr || !msg->has_response()) {
+        log_f("No response to setup request for channel '%s'", name.c_str());
+        co_return nullptr;
+    }
+
+    if (msg->response().status() != Response_Status_SUCCESS) {
+        log_f("Error in response for setup request %u", msg->response().status());
+        co_return nullptr;
+    }
+
+    const SetupVirtualChannelResponse& response = msg->response().setup_virtual_channel_response();
+
+    if (!co_await channel->Connect(response.relay_path())) {
+        co_return nullptr;
+    }
+
+    // Straight to the loop rather than channel->Write(), the token must not be captured
+    const std::string& token = response.virtual_channel_auth_token();
+    IoResult res = co_await m_loop.Write(channel->m_relay, token.data(), token.size());
+    if (!res.Ok()) {
+        log_f("Could not write auth token on relay: %u", res.error);
+        co_return nullptr;
+    }
+
+    if (!co_await AsyncVirtualChannel::ReadyAwaiter{ *channel }) {
+        log_f("Channel '%s' closed before becoming ready", name.c_str());
+        co_return nullptr;
+    }
+
+    co_return std::move(channel);
+}
+
+std::unique_ptr<AsyncVirtualChannel>
+AsyncExtension::AttachChannel(const std::string& name,
+                              NativeHandle relay)
+{
+    std::unique_ptr<AsyncVirtualChannel> channel(new AsyncVirtualChannel(*this, name));
+
+    channel->m_relay.handle = relay;
+    if (!m_loop.Register(channel->m_relay)) {
+        return nullptr;
+    }
+
+    channel->m_connected = true;
+    channel->m_ready = true;
+    channel->m_capture_index = CaptureChannelOpen(name);
+
+    return channel;
+}
+
+} // namespace dcvext
@@ -0,0 +1,668 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_ASYNC_EXTENSION
+#define DCV_EXTENSION_ASYNC_EXTENSION
+
+#include "extensions.pb.h"
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bufferpool.h"
+#include "channelframing.h"
+#include "controlreader.h"
+#include "dedup.h"
+#include "eventloop.h"
+#include "handlerpool.h"
+#include "rttprobe.h"
+#include "task.h"
+
+namespace dcvext {
+
+class AsyncExtension;
+
+/*
+ * Awaitable for a response to a request sent to DCV. Requests are matched
+ * to responses through their request_id, so any number of them can be
+ * outstanding at once. The awaiter itself is the entry of the pending
+ * table, no allocation happens to track it.
+ */
+class RequestAwaiter
+{
+public:
+    RequestAwaiter(AsyncExtension& extension,
+                   dcv::extensions::Request& request)
+        : m_extension(extension),
+          m_request(request)
+    {
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool
+    await_suspend(std::coroutine_handle<> handle);
+
+    // Returns nullptr if the request could not be sent or DCV went away
+    std::unique_ptr<dcv::extensions::DcvMessage>
+    await_resume() noexcept
+    {
+        return std::move(m_response);
+    }
+
+private:
+    friend class AsyncExtension;
+
+    AsyncExtension& m_extension;
+    dcv::extensions::Request& m_request;
+    uint64_t m_id = 0;
+    RequestAwaiter* m_next = nullptr;
+    std::coroutine_handle<> m_waiter;
+    std::unique_ptr<dcv::extensions::DcvMessage> m_response;
+};
+
+/*
+ * Awaitable for the next event which is not about a virtual channel (those
+ * are consumed by the channels themselves).
+ */
+class EventAwaiter
+{
+public:
+    explicit EventAwaiter(AsyncExtension& extension)
+        : m_extension(extension)
+    {
+    }
+
+    bool
+    await_ready();
+
+    void
+    await_suspend(std::coroutine_handle<> handle);
+
+    // Returns nullptr if DCV went away
+    std::unique_ptr<dcv::extensions::DcvMessage>
+    await_resume() noexcept
+    {
+        return std::move(m_event);
+    }
+
+private:
+    friend class AsyncExtension;
+
+    AsyncExtension& m_extension;
+    EventAwaiter* m_next = nullptr;
+    std::coroutine_handle<> m_waiter;
+    std::unique_ptr<dcv::extensions::DcvMessage> m_event;
+};
+
+/*
+ * IoAwaiter on a relay which also records the data when capturing traffic.
+ */
+class ChannelIoAwaiter : public IoAwaiter
+{
+public:
+    ChannelIoAwaiter(EventLoop& loop,
+                     IoObject& relay,
+                     const void* buffer,
+                     size_t size,
+                     bool is_write,
+                     uint32_t capture_index)
+        : IoAwaiter(loop, relay, buffer, size, is_write),
+          m_capture_index(capture_index)
+    {
+    }
+
+    IoResult
+    await_resume() const;
+
+private:
+    uint32_t m_capture_index;
+};
+
+enum
+{
+    BATCH_HISTOGRAM_BUCKETS = 24
+};
+
+/*
+ * Send batching: small writes are collected and flushed as one write when
+ * the batch reaches max_bytes, when the oldest write in it has waited for
+ * latency_budget, or on an explicit flush.
+ */
+struct BatchOptions
+{
+    // 0 disables batching, every Send() is written right away
+    size_t max_bytes = 0;
+    Clock::duration latency_budget = std::chrono::microseconds(200);
+};
+
+struct BatchStats
+{
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t batches = 0;
+    uint64_t flushed_full = 0;
+    uint64_t flushed_deadline = 0;
+    uint64_t flushed_explicit = 0;
+
+    // Bucket i counts batches of [2^i, 2^(i+1)) messages, or bytes
+    uint64_t messages_per_batch[BATCH_HISTOGRAM_BUCKETS] = {};
+    uint64_t bytes_per_batch[BATCH_HISTOGRAM_BUCKETS] = {};
+};
+
+/*
+ * In-band round trip probing of a framed channel, see rttprobe.h. Pings are
+ * answered from ReadFrame() on the other end, so samples only come in while
+ * the peer reads frames.
+ */
+struct RttProbeOptions
+{
+    // 0 disables probing, pings from the peer are answered regardless
+    Clock::duration interval{};
+    // Samples the statistics are computed over
+    size_t window = RTT_DEFAULT_WINDOW;
+};
+
+/*
+ * Deduplication of written frames, see dedup.h. Deduplicated frames from the
+ * peer are decoded regardless.
+ */
+struct DedupOptions
+{
+    bool enabled = false;
+    // Smaller frames are written as they are
+    size_t min_size = 4096;
+    // Size of the chunk cache the peer keeps for our frames
+    size_t cache_bytes = 64 * 1024 * 1024;
+    // Largest cache the peer may ask us to keep for its frames
+    size_t max_peer_cache_bytes = 256 * 1024 * 1024;
+};
+
+class AsyncVirtualChannel
+{
+public:
+    ~AsyncVirtualChannel();
+
+    const std::string&
+    Name() const
+    {
+        return m_name;
+    }
+
+    // Read whatever is available on the channel, 0 bytes means closed
+    ChannelIoAwaiter
+    Read(void* buffer,
+         size_t size);
+
+    // Write the whole buffer on the channel
+    ChannelIoAwaiter
+    Write(const void* buffer,
+          size_t size);
+
+    /*
+     * Read whatever is available into a pooled buffer. The slice can be kept
+     * or passed on without copying, an empty one means closed or failed.
+     */
+    Task<BufferSlice>
+    Receive();
+
+    /*
+     * Receive until the channel closes, or until at least limit bytes have
+     * been read when it is not 0, and hand every read to a handler on pool,
+     * in order on stream if given. Reading pauses while the pool is
+     * saturated. Handlers may still be running when this completes.
+     */
+    Task<void>
+    ReceiveToPool(HandlerPool& pool,
+                  HandlerStream* stream,
+                  MessageHandler handler,
+                  void* context,
+                  uint64_t limit = 0);
+
+    // Ask DCV to close the channel and wait for the response
+    Task<bool>
+    Close();
+
+    // Framing used by ReadFrame() and WriteFrame(), see channelframing.h
+    void
+    SetFrameOptions(const FrameOptions& options)
+    {
+        m_frame_options = options;
+    }
+
+    /*
+     * Wait for the next frame, the payload stays valid until the next call.
+     * Returns false if the channel was closed or a corrupted frame arrived,
+     * after which the stream cannot be trusted any more. Frames of the
+     * channel layer (probes) are handled here and not returned.
+     */
+    Task<bool>
+    ReadFrame(Frame& frame);
+
+    /*
+     * Write one frame, frames and plain writes must not be mixed. Frame
+     * writes are queued behind each other, so several coroutines may write
+     * frames at once. A payload over the max_payload of the frame options,
+     * or of a type from FRAME_TYPE_RESERVED up, fails without being sent.
+     */
+    Task<bool>
+    WriteFrame(const void* payload,
+               size_t size,
+               uint8_t type = FRAME_TYPE_DATA);
+
+    // Start, change or stop probing, once the channel is set up
+    void
+    SetRttProbe(const RttProbeOptions& options);
+
+    RttStats
+    GetRttStats() const;
+
+    void
+    LogRttStats() const;
+
+    // Takes effect from the next frame written, the peer cache starts over
+    void
+    SetDedupOptions(const DedupOptions& options);
+
+    const DedupStats&
+    GetSentDedupStats() const
+    {
+        return m_dedup_encoder.Stats();
+    }
+
+    const DedupStats&
+    GetReceivedDedupStats() const
+    {
+        return m_dedup_decoder.Stats();
+    }
+
+    void
+    LogDedupStats() const;
+
+    void
+    SetBatchOptions(const BatchOptions& options)
+    {
+        m_batch_options = options;
+    }
+
+    /*
+     * Write through the send batch. Completes right away while the data fits
+     * in the batch, otherwise (or with flush set) when the batch has been
+     * written. Returns false once a batch write failed. Sends and flushes
+     * must come from one coroutine at a time and not be mixed with Write().
+     */
+    Task<bool>
+    Send(const void* buffer,
+         size_t size,
+         bool flush = false);
+
+    // Write whatever is in the send batch now
+    Task<bool>
+    Flush();
+
+    const BatchStats&
+    GetBatchStats() const
+    {
+        return m_batch_stats;
+    }
+
+    void
+    LogBatchStats() const;
+
+private:
+    friend class AsyncExtension;
+
+    struct ReadyAwaiter
+    {
+        AsyncVirtualChannel& channel;
+
+        bool
+        await_ready() const noexcept
+        {
+            return channel.m_ready || channel.m_closed;
+        }
+
+        void
+        await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            channel.m_ready_waiter = handle;
+        }
+
+        bool
+        await_resume() const noexcept
+        {
+            return channel.m_ready && !channel.m_closed;
+        }
+    };
+
+    AsyncVirtualChannel(AsyncExtension& extension,
+                        const std::string& name);
+
+    Task<bool>
+    Connect(const std::string& relay_path);
+
+    void
+    CloseRelay();
+
+    enum
+    {
+        FRAME_READ_SIZE = 64 * 1024
+    };
+
+    enum FlushReason
+    {
+        FLUSH_FULL,
+        FLUSH_DEADLINE,
+        FLUSH_EXPLICIT
+    };
+
+    struct BatchTimer : TimerNode
+    {
+        AsyncVirtualChannel* channel;
+    };
+
+    struct BatchIdleAwaiter
+    {
+        AsyncVirtualChannel& channel;
+
+        bool
+        await_ready() const noexcept
+        {
+            return !channel.m_batch_writing;
+        }
+
+        void
+        await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            channel.m_batch_waiter = handle;
+        }
+
+        void
+        await_resume() const noexcept
+        {
+        }
+    };
+
+    struct ProbeTimer : TimerNode
+    {
+        AsyncVirtualChannel* channel;
+    };
+
+    // Waits until no detached coroutine of the channel is running
+    struct DetachedIdleAwaiter
+    {
+        AsyncVirtualChannel& channel;
+
+        bool
+        await_ready() const noexcept
+        {
+            return channel.m_detached == 0;
+        }
+
+        void
+        await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            channel.m_detached_waiter = handle;
+        }
+
+        void
+        await_resume() const noexcept
+        {
+        }
+    };
+
+    // Takes the frame writer role, handed over in order by ReleaseFrameWriter()
+    struct FrameWriterAwaiter
+    {
+        AsyncVirtualChannel& channel;
+
+        bool
+        await_ready() const noexcept
+        {
+            if (channel.m_frame_writing) {
+                return false;
+            }
+            channel.m_frame_writing = true;
+            return true;
+        }
+
+        void
+        await_suspend(std::coroutine_handle<> handle)
+        {
+            channel.m_frame_writers.push_back(handle);
+        }
+
+        void
+        await_resume() const noexcept
+        {
+        }
+    };
+
+    static void
+    OnBatchDeadline(TimerNode* timer);
+
+    static void
+    OnProbeTimer(TimerNode* timer);
+
+    void
+    ReleaseFrameWriter();
+
+    /*
+     * Start a coroutine of the channel without awaiting it. They hold on to
+     * the channel, Close() waits for them and the channel must not be
+     * destroyed while any is running.
+     */
+    void
+    SpawnDetached(Task<void> task);
+
+    Task<void>
+    RunDetached(Task<void> task);
+
+    // Consume a frame of the channel layer, received at when
+    void
+    HandleControlFrame(const Frame& frame,
+                       Clock::time_point when);
+
+    Task<void>
+    SendPing();
+
+    Task<void>
+    SendPong(std::array<uint8_t, RTT_PING_SIZE> ping,
+             Clock::time_point received);
+
+    Task<bool>
+    FlushBatch(FlushReason reason);
+
+    Task<void>
+    WriteBatch(FlushReason reason);
+
+    AsyncExtension& m_extension;
+    std::string m_name;
+    IoObject m_relay;
+    bool m_connected = false;
+    bool m_ready = false;
+    bool m_closed = false;
+    uint32_t m_capture_index = 0;
+    std::coroutine_handle<> m_ready_waiter;
+    FrameOptions m_frame_options;
+    bool m_frame_failed = false;
+    uint64_t m_frames_read = 0;
+    std::vector<uint8_t> m_rx;
+    size_t m_rx_begin = 0;
+    size_t m_rx_end = 0;
+    size_t m_rx_returned = 0;
+    Clock::time_point m_rx_time;
+    FrameProgress m_rx_progress;
+    std::vector<uint8_t> m_tx;
+    bool m_frame_writing = false;
+    std::deque<std::coroutine_handle<>> m_frame_writers;
+    RttProbeOptions m_probe_options;
+    ProbeTimer m_probe_timer;
+    RttWindow m_rtt_window;
+    uint64_t m_pings_sent = 0;
+    uint64_t m_pongs_received = 0;
+    uint64_t m_pongs_dropped = 0;
+    bool m_ping_outstanding = false;
+    // Carried by the ping in flight, only its pong is taken as a sample
+    uint64_t m_ping_sequence = 0;
+    DedupOptions m_dedup_options;
+    DedupEncoder m_dedup_encoder;
+    DedupDecoder m_dedup_decoder;
+    std::vector<uint8_t> m_dedup_tx;
+    std::vector<uint8_t> m_dedup_rx;
+    ReceiveBuffer m_receive;
+    BatchOptions m_batch_options;
+    BatchStats m_batch_stats;
+    BatchTimer m_batch_timer;
+    std::vector<uint8_t> m_batch;
+    std::vector<uint8_t> m_batch_writing_buffer;
+    size_t m_batch_messages = 0;
+    bool m_batch_writing = false;
+    bool m_batch_due = false;
+    bool m_batch_failed = false;
+    std::coroutine_handle<> m_batch_waiter;
+    unsigned m_detached = 0;
+    std::coroutine_handle<> m_detached_waiter;
+};
+
+/*
+ * Coroutine based counterpart of the blocking flow in main.cpp: messages from
+ * DCV are read by a single reader coroutine and dispatched to whoever is
+ * waiting for them, so an extension can keep many requests and channels in
+ * flight while still being written as straight-line code.
+ */
+class AsyncExtension
+{
+public:
+    explicit AsyncExtension(EventLoop& loop);
+    ~AsyncExtension();
+
+    AsyncExtension(const AsyncExtension&) = delete;
+    AsyncExtension& operator=(const AsyncExtension&) = delete;
+
+    // Start reading messages from DCV on stdin
+    bool
+    Start();
+
+    EventLoop&
+    Loop()
+    {
+        return m_loop;
+    }
+
+    // Send a request and wait for its response, the request_id is assigned here
+    RequestAwaiter
+    Request(dcv::extensions::Request& request)
+    {
+        return RequestAwaiter(*this, request);
+    }
+
+    EventAwaiter
+    NextEvent()
+    {
+        return EventAwaiter(*this);
+    }
+
+    // Request a virtual channel, connect to its relay and wait until it is ready
+    Task<std::unique_ptr<AsyncVirtualChannel>>
+    SetupChannel(const std::string& name);
+
+    /*
+     * Wrap a relay that is already connected and authenticated, for tools
+     * that stand in for DCV. The channel owns the handle once returned, and
+     * cannot be closed through DCV.
+     */
+    std::unique_ptr<AsyncVirtualChannel>
+    AttachChannel(const std::string& name,
+                  NativeHandle relay);
+
+    bool
+    Send(const dcv::extensions::ExtensionMessage& msg);
+
+    // Reads from stdin and the messages they carried
+    const ControlReaderStats&
+    GetControlStats() const
+    {
+        return m_reader.Stats();
+    }
+
+    void
+    LogControlStats() const
+    {
+        m_reader.LogStats();
+    }
+
+private:
+    friend class RequestAwaiter;
+    friend class EventAwaiter;
+    friend class AsyncVirtualChannel;
+
+    enum
+    {
+        PENDING_BUCKETS = 256
+    };
+
+    Task<void>
+    ReadLoop();
+
+    void
+    Dispatch(std::unique_ptr<dcv::extensions::DcvMessage> msg);
+
+    void
+    DispatchResponse(std::unique_ptr<dcv::extensions::DcvMessage> msg);
+
+    void
+    DispatchEvent(std::unique_ptr<dcv::extensions::DcvMessage> msg);
+
+    void
+    AddPending(RequestAwaiter* awaiter);
+
+    void
+    FailAll();
+
+    AsyncVirtualChannel*
+    FindChannel(const std::string& name);
+
+    void
+    RemoveChannel(AsyncVirtualChannel* channel);
+
+    EventLoop& m_loop;
+    IoObject m_input;
+    NativeHandle m_output;
+    bool m_started = false;
+    bool m_closed = false;
+    uint64_t m_last_request_id = 0;
+    RequestAwaiter* m_pending[PENDING_BUCKETS] = {};
+    EventAwaiter* m_event_waiters = nullptr;
+    EventAwaiter* m_event_waiters_tail = nullptr;
+    std::deque<std::unique_ptr<dcv::extensions::DcvMessage>> m_events;
+    std::vector<AsyncVirtualChannel*> m_channels;
+    ControlReader m_reader;
+    std::vector<uint8_t> m_write_buffer;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_ASYNC_EXTENSION
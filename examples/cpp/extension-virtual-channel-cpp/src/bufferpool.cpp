@@ -0,0 +1,292 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "bufferpool.h"
+
+#include <new>
+
+#include "memstats.h"
+#include "simplelogger.h"
+
+namespace dcvext {
+
+namespace {
+
+// malloc only promises 16 bytes, blocks are cache line aligned
+constexpr std::align_val_t BLOCK_ALIGNMENT{ alignof(BufferBlock) };
+
+void*
+AllocateAligned(size_t size)
+{
+    return ::operator new(size, BLOCK_ALIGNMENT, std::nothrow);
+}
+
+void
+FreeAligned(void* memory)
+{
+    ::operator delete(memory, BLOCK_ALIGNMENT);
+}
+
+} // namespace
+
+BufferPool::~BufferPool()
+{
+    if (m_stats.bytes_outstanding != 0) {
+        log_f("Buffer pool destroyed with %zu bytes still in use", m_stats.bytes_outstanding);
+    }
+
+    while (m_slabs != nullptr) {
+        Slab* slab = m_slabs;
+        m_slabs = slab->next;
+        MemoryFreed(MEMORY_CHANNELS, slab->size);
+        FreeAligned(slab);
+    }
+}
+
+uint32_t
+BufferPool::ClassFor(size_t size)
+{
+    uint32_t size_class = 0;
+
+    while (size_class < BUFFER_CLASS_COUNT && ClassCapacity(size_class) < size) {
+        size_class++;
+    }
+
+    return size_class;
+}
+
+bool
+BufferPool::AddSlab(uint32_t size_class)
+{
+    size_t stride = sizeof(BufferBlock) + ClassCapacity(size_class);
+    size_t count = stride < BUFFER_SLAB_SIZE ? BUFFER_SLAB_SIZE / stride : 1;
+
+    // The slab link takes the first cache line, blocks follow
+    size_t size = sizeof(BufferBlock) + count * stride;
+    void* memory = AllocateAligned(size);
+    if (memory == nullptr) {
+        return false;
+    }
+    MemoryAllocated(MEMORY_CHANNELS, size);
+
+    Slab* slab = static_cast<Slab*>(memory);
+    slab->next = m_slabs;
+    slab->size = size;
+    m_slabs = slab;
+
+    uint8_t* p = static_cast<uint8_t*>(memory) + sizeof(BufferBlock);
+    for (size_t i = 0; i < count; ++i, p += stride) {
+        BufferBlock* block = new (p) BufferBlock;
+        block->size_class = size_class;
+        block->capacity = ClassCapacity(size_class);
+        block->pool = this;
+        block->next = m_free[size_class];
+        m_free[size_class] = block;
+    }
+
+    m_stats.slabs++;
+    m_stats.bytes_pooled += count * ClassCapacity(size_class);
+    m_stats.bytes_reserved += count * ClassCapacity(size_class);
+
+    return true;
+}
+
+BufferBlock*
+BufferPool::Acquire(size_t size)
+{
+    uint32_t size_class = ClassFor(size);
+    BufferBlock* block;
+
+    if (size_class == BUFFER_LARGE_CLASS) {
+        void* memory = AllocateAligned(sizeof(BufferBlock) + size);
+        if (memory == nullptr) {
+            return nullptr;
+        }
+        MemoryAllocated(MEMORY_CHANNELS, sizeof(BufferBlock) + size);
+
+        block = new (memory) BufferBlock;
+        block->size_class = BUFFER_LARGE_CLASS;
+        block->capacity = size;
+        block->pool = this;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.acquired++;
+        m_stats.large++;
+        m_stats.bytes_outstanding += size;
+    } else {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        if (m_free[size_class] != nullptr) {
+            m_stats.hits++;
+        } else if (!AddSlab(size_class)) {
+            return nullptr;
+        }
+
+        block = m_free[size_class];
+        m_free[size_class] = block->next;
+
+        m_stats.acquired++;
+        m_stats.bytes_pooled -= block->capacity;
+        m_stats.bytes_outstanding += block->capacity;
+    }
+
+    block->next = nullptr;
+    block->refs.store(1, std::memory_order_relaxed);
+
+    return block;
+}
+
+void
+BufferPool::Release(BufferBlock* block)
+{
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block->pool->Recycle(block);
+    }
+}
+
+void
+BufferPool::Recycle(BufferBlock* block)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_stats.bytes_outstanding -= block->capacity;
+
+    if (block->size_class == BUFFER_LARGE_CLASS) {
+        MemoryFreed(MEMORY_CHANNELS, sizeof(BufferBlock) + block->capacity);
+        block->~BufferBlock();
+        FreeAligned(block);
+        return;
+    }
+
+    m_stats.bytes_pooled += block->capacity;
+    block->next = m_free[block->size_class];
+    m_free[block->size_class] = block;
+}
+
+BufferPoolStats
+BufferPool::Stats()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    return m_stats;
+}
+
+void
+BufferPool::LogStats(const char* name)
+{
+    BufferPoolStats stats = Stats();
+
+    log_f("%s buffers: %llu acquired, %.1f%% from the pool, %llu slabs, %llu large, "
+          "%zu bytes outstanding, %zu pooled, %zu reserved",
+          name,
+          static_cast<unsigned long long>(stats.acquired),
+          stats.acquired != 0 ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.acquired) : 0.0,
+          static_cast<unsigned long long>(stats.slabs),
+          static_cast<unsigned long long>(stats.large),
+          stats.bytes_outstanding,
+          stats.bytes_pooled,
+          stats.bytes_reserved);
+}
+
+BufferPool&
+DefaultBufferPool()
+{
+    static BufferPool* pool = new BufferPool;
+
+    return *pool;
+}
+
+BufferSlice
+BufferSlice::Slice(size_t offset,
+                   size_t size) const
+{
+    if (m_block == nullptr || offset > m_size) {
+        return BufferSlice();
+    }
+    if (size > m_size - offset) {
+        size = m_size - offset;
+    }
+
+    m_block->refs.fetch_add(1, std::memory_order_relaxed);
+
+    return BufferSlice(m_block, m_offset + offset, size);
+}
+
+ReceiveBuffer::~ReceiveBuffer()
+{
+    if (m_block != nullptr) {
+        BufferPool::Release(m_block);
+    }
+}
+
+uint8_t*
+ReceiveBuffer::Prepare(size_t& size)
+{
+    if (m_block != nullptr && m_block->refs.load(std::memory_order_acquire) == 1) {
+        // Every slice of the block is gone, start over at its beginning
+        m_used = 0;
+    }
+
+    // A small tail would only split reads, as would a block of the wrong size
+    if (m_block != nullptr
+        && (m_block->size_class != m_class || m_block->capacity - m_used < m_block->capacity / 4)) {
+        BufferPool::Release(m_block);
+        m_block = nullptr;
+    }
+
+    if (m_block == nullptr) {
+        m_block = m_pool.Acquire(BufferPool::ClassCapacity(m_class));
+        m_used = 0;
+
+        if (m_block == nullptr) {
+            log_f("Out of memory for a %zu bytes receive buffer", BufferPool::ClassCapacity(m_class));
+            size = 0;
+            return nullptr;
+        }
+    }
+
+    m_prepared = m_block->capacity - m_used;
+    size = m_prepared;
+
+    return m_block->Data() + m_used;
+}
+
+BufferSlice
+ReceiveBuffer::Commit(size_t size)
+{
+    // Only a read filling a whole block says that more data was waiting
+    if (size == m_prepared && m_prepared == m_block->capacity && m_class + 1 < BUFFER_CLASS_COUNT) {
+        m_class++;
+        m_small_reads = 0;
+    } else if (size < BufferPool::ClassCapacity(m_class) / 8 && m_class > 0) {
+        if (++m_small_reads == SHRINK_AFTER_READS) {
+            m_class--;
+            m_small_reads = 0;
+        }
+    } else {
+        m_small_reads = 0;
+    }
+
+    m_block->refs.fetch_add(1, std::memory_order_relaxed);
+    BufferSlice slice(m_block, m_used, size);
+    m_used += size;
+
+    return slice;
+}
+
+} // namespace dcvext
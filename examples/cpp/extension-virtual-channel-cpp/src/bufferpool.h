@@ -0,0 +1,277 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_BUFFER_POOL
+#define DCV_EXTENSION_BUFFER_POOL
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace dcvext {
+
+enum
+{
+    BUFFER_MIN_CLASS_SHIFT = 12,        // 4 KB
+    BUFFER_CLASS_COUNT = 9,             // up to 1 MB
+    BUFFER_SLAB_SIZE = 256 * 1024,
+    BUFFER_LARGE_CLASS = BUFFER_CLASS_COUNT
+};
+
+class BufferPool;
+
+/*
+ * Header in front of the data of every pooled block. Blocks are never
+ * cleared: whatever a previous user left in them is overwritten by the
+ * next read.
+ */
+struct alignas(64) BufferBlock
+{
+    std::atomic<uint32_t> refs;
+    uint32_t size_class;
+    size_t capacity;
+    BufferPool* pool;
+    BufferBlock* next;
+
+    uint8_t*
+    Data()
+    {
+        return reinterpret_cast<uint8_t*>(this + 1);
+    }
+};
+
+struct BufferPoolStats
+{
+    uint64_t acquired = 0;          // blocks handed out
+    uint64_t hits = 0;              // of those, taken from a free list
+    uint64_t slabs = 0;             // slabs allocated for the size classes
+    uint64_t large = 0;             // blocks above the largest class, not pooled
+    size_t bytes_outstanding = 0;   // capacity of blocks in use
+    size_t bytes_pooled = 0;        // capacity of free blocks
+    size_t bytes_reserved = 0;      // total held by the pool
+};
+
+/*
+ * Pool of receive blocks in power of two size classes, carved out of slabs
+ * that stay with the pool. Blocks can be released from any thread.
+ */
+class BufferPool
+{
+public:
+    BufferPool() = default;
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // A block of at least size bytes with one reference, nullptr if out of memory
+    BufferBlock*
+    Acquire(size_t size);
+
+    // Drop a reference, the block goes back to the pool with the last one
+    static void
+    Release(BufferBlock* block);
+
+    BufferPoolStats
+    Stats();
+
+    void
+    LogStats(const char* name);
+
+    static size_t
+    ClassCapacity(uint32_t size_class)
+    {
+        return size_t(1) << (BUFFER_MIN_CLASS_SHIFT + size_class);
+    }
+
+    static uint32_t
+    ClassFor(size_t size);
+
+private:
+    struct Slab
+    {
+        Slab* next;
+        size_t size;
+    };
+
+    void
+    Recycle(BufferBlock* block);
+
+    bool
+    AddSlab(uint32_t size_class);
+
+    std::mutex m_lock;
+    BufferBlock* m_free[BUFFER_CLASS_COUNT] = {};
+    Slab* m_slabs = nullptr;
+    BufferPoolStats m_stats;
+};
+
+// Process wide pool, never destroyed so slices can outlive everything else
+BufferPool&
+DefaultBufferPool();
+
+/*
+ * Reference counted view of part of a pooled block, which is handed to
+ * application code instead of copying the data out.
+ */
+class BufferSlice
+{
+public:
+    BufferSlice() = default;
+
+    // Takes over one reference on block
+    BufferSlice(BufferBlock* block,
+                size_t offset,
+                size_t size)
+        : m_block(block),
+          m_offset(offset),
+          m_size(size)
+    {
+    }
+
+    BufferSlice(const BufferSlice& other)
+        : m_block(other.m_block),
+          m_offset(other.m_offset),
+          m_size(other.m_size)
+    {
+        if (m_block != nullptr) {
+            m_block->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    BufferSlice(BufferSlice&& other) noexcept
+        : m_block(other.m_block),
+          m_offset(other.m_offset),
+          m_size(other.m_size)
+    {
+        other.m_block = nullptr;
+        other.m_size = 0;
+    }
+
+    BufferSlice&
+    operator=(BufferSlice other) noexcept
+    {
+        std::swap(m_block, other.m_block);
+        std::swap(m_offset, other.m_offset);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~BufferSlice()
+    {
+        Reset();
+    }
+
+    void
+    Reset()
+    {
+        if (m_block != nullptr) {
+            BufferPool::Release(m_block);
+            m_block = nullptr;
+        }
+        m_size = 0;
+    }
+
+    uint8_t*
+    Data() const
+    {
+        return m_block != nullptr ? m_block->Data() + m_offset : nullptr;
+    }
+
+    size_t
+    Size() const
+    {
+        return m_size;
+    }
+
+    bool
+    Empty() const
+    {
+        return m_size == 0;
+    }
+
+    // Part of this slice sharing the same block
+    BufferSlice
+    Slice(size_t offset,
+          size_t size) const;
+
+    // Hand the reference over to the caller, to release with BufferPool::Release()
+    BufferBlock*
+    Detach()
+    {
+        BufferBlock* block = m_block;
+
+        m_block = nullptr;
+        m_size = 0;
+
+        return block;
+    }
+
+private:
+    BufferBlock* m_block = nullptr;
+    size_t m_offset = 0;
+    size_t m_size = 0;
+};
+
+/*
+ * Reads land in the free tail of the current block, so consecutive small
+ * reads share a block. The block size follows the reads: a read that fills
+ * the space moves to the next size class, a run of small reads moves back
+ * down. Once every slice of a block has been released the block is reused
+ * in place, so a steady receive loop does not touch the pool at all.
+ */
+class ReceiveBuffer
+{
+public:
+    explicit ReceiveBuffer(BufferPool& pool)
+        : m_pool(pool)
+    {
+    }
+
+    ~ReceiveBuffer();
+
+    ReceiveBuffer(const ReceiveBuffer&) = delete;
+    ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+
+    // Space for the next read, nullptr if out of memory
+    uint8_t*
+    Prepare(size_t& size);
+
+    // Hand out the first size bytes of the space returned by Prepare()
+    BufferSlice
+    Commit(size_t size);
+
+private:
+    enum
+    {
+        SHRINK_AFTER_READS = 16
+    };
+
+    BufferPool& m_pool;
+    BufferBlock* m_block = nullptr;
+    size_t m_used = 0;
+    size_t m_prepared = 0;
+    uint32_t m_class = 0;
+    uint32_t m_small_reads = 0;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_BUFFER_POOL
@@ -0,0 +1,257 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "channelframing.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "crc32c.h"
+
+namespace dcvext {
+
+namespace {
+
+inline void
+Store32(uint8_t* data,
+        uint32_t value)
+{
+    data[0] = static_cast<uint8_t>(value);
+    data[1] = static_cast<uint8_t>(value >> 8);
+    data[2] = static_cast<uint8_t>(value >> 16);
+    data[3] = static_cast<uint8_t>(value >> 24);
+}
+
+inline uint32_t
+Load32(const uint8_t* data)
+{
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+        | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+size_t
+ChunkCount(size_t payload_size,
+           uint8_t chunk_shift)
+{
+    if (chunk_shift == 0 || payload_size == 0) {
+        return 1;
+    }
+
+    return ((payload_size - 1) >> chunk_shift) + 1;
+}
+
+size_t
+WireSize(size_t payload_size,
+         bool crc32c,
+         uint8_t chunk_shift)
+{
+    size_t size = FRAME_HEADER_SIZE + payload_size;
+
+    if (crc32c) {
+        size += FRAME_CRC_SIZE * ChunkCount(payload_size, chunk_shift);
+    }
+
+    return size;
+}
+
+} // namespace
+
+size_t
+FrameWireSize(size_t payload_size,
+              const FrameOptions& options)
+{
+    return WireSize(payload_size, options.crc32c, options.chunk_shift);
+}
+
+void
+EncodeFrame(uint8_t type,
+            const void* payload,
+            size_t size,
+            const FrameOptions& options,
+            std::vector<uint8_t>& out)
+{
+    size_t offset = out.size();
+    out.resize(offset + FrameWireSize(size, options));
+
+    uint8_t* p = out.data() + offset;
+    Store32(p, static_cast<uint32_t>(size));
+    p[4] = type;
+    p[5] = options.crc32c ? FRAME_FLAG_CRC32C : 0;
+    p[6] = options.crc32c ? options.chunk_shift : 0;
+    p[7] = 0;
+    Store32(p + 8, options.crc32c ? Crc32c(0, p, 8) : 0);
+    p += FRAME_HEADER_SIZE;
+
+    const uint8_t* src = static_cast<const uint8_t*>(payload);
+    if (!options.crc32c) {
+        if (size > 0) {
+            memcpy(p, src, size);
+        }
+        return;
+    }
+
+    size_t chunk = options.chunk_shift != 0 ? size_t(1) << options.chunk_shift : size;
+    size_t chunks = ChunkCount(size, options.chunk_shift);
+    for (size_t i = 0; i < chunks; ++i) {
+        size_t length = size < chunk ? size : chunk;
+
+        Store32(p + length, Crc32cCopy(0, p, src, length));
+
+        p += length + FRAME_CRC_SIZE;
+        src += length;
+        size -= length;
+    }
+}
+
+namespace {
+
+FrameStatus
+Decode(uint8_t* data,
+       size_t size,
+       const FrameOptions& options,
+       Frame& frame,
+       size_t& wire_size,
+       char* error,
+       FrameProgress& progress,
+       bool incremental)
+{
+    if (size < FRAME_HEADER_SIZE) {
+        return FRAME_INCOMPLETE;
+    }
+
+    uint32_t length = Load32(data);
+    uint8_t flags = data[5];
+    uint8_t chunk_shift = data[6];
+    uint32_t header_crc = Load32(data + 8);
+    bool crc32c = (flags & FRAME_FLAG_CRC32C) != 0;
+
+    if (crc32c) {
+        uint32_t expected = Crc32c(0, data, 8);
+
+        if (header_crc != expected) {
+            snprintf(error, 128, "header CRC mismatch: expected 0x%08x, got 0x%08x", expected, header_crc);
+            return FRAME_CORRUPT;
+        }
+    } else if (options.crc32c) {
+        snprintf(error, 128, "frame without CRC while CRCs are required");
+        return FRAME_CORRUPT;
+    }
+
+    // Without a header CRC these are the only way to notice a damaged header
+    if ((flags & ~FRAME_FLAG_CRC32C) != 0 || data[7] != 0 || (!crc32c && (chunk_shift != 0 || header_crc != 0))
+        || (chunk_shift != 0 && (chunk_shift < FRAME_MIN_CHUNK_SHIFT || chunk_shift > FRAME_MAX_CHUNK_SHIFT))) {
+        snprintf(error, 128, "invalid header: flags 0x%02x, chunk shift %u", flags, chunk_shift);
+        return FRAME_CORRUPT;
+    }
+
+    if (length > options.max_payload) {
+        snprintf(error, 128, "frame of %u bytes exceeds the limit of %zu", length, options.max_payload);
+        return FRAME_TOO_LARGE;
+    }
+
+    wire_size = WireSize(length, crc32c, chunk_shift);
+    if (size < wire_size && (!crc32c || !incremental)) {
+        return FRAME_INCOMPLETE;
+    }
+
+    uint8_t* payload = data + FRAME_HEADER_SIZE;
+
+    if (crc32c) {
+        size_t chunk = chunk_shift != 0 ? size_t(1) << chunk_shift : length;
+        size_t chunks = ChunkCount(length, chunk_shift);
+        size_t received = (size < wire_size ? size : wire_size) - FRAME_HEADER_SIZE;
+
+        for (; progress.chunks < chunks; ++progress.chunks) {
+            size_t offset = progress.chunks * chunk;
+            size_t wire_offset = progress.chunks * (chunk + FRAME_CRC_SIZE);
+            size_t chunk_length = length - offset < chunk ? length - offset : chunk;
+            size_t chunk_received = received - wire_offset;
+            uint32_t expected;
+            uint32_t actual;
+
+            if (progress.chunks == 0) {
+                // Already in place, checked as it arrives
+                size_t checked = chunk_received < chunk_length ? chunk_received : chunk_length;
+
+                progress.crc = Crc32c(progress.crc, payload + progress.checked, checked - progress.checked);
+                progress.checked = checked;
+                if (chunk_received < chunk_length + FRAME_CRC_SIZE) {
+                    return FRAME_INCOMPLETE;
+                }
+                expected = progress.crc;
+                actual = Load32(payload + chunk_length);
+            } else {
+                if (chunk_received < chunk_length + FRAME_CRC_SIZE) {
+                    return FRAME_INCOMPLETE;
+                }
+
+                // Checked as it moves over the CRCs before it, which leaves the payload contiguous
+                actual = Load32(payload + wire_offset + chunk_length);
+                expected = Crc32cCopy(0, payload + offset, payload + wire_offset, chunk_length);
+            }
+
+            if (actual != expected) {
+                snprintf(error,
+                         128,
+                         "payload CRC mismatch in chunk %zu of %zu: expected 0x%08x, got 0x%08x",
+                         progress.chunks + 1,
+                         chunks,
+                         expected,
+                         actual);
+                return FRAME_CORRUPT;
+            }
+        }
+    }
+
+    frame.type = data[4];
+    frame.flags = flags;
+    frame.data = payload;
+    frame.size = length;
+
+    return FRAME_COMPLETE;
+}
+
+} // namespace
+
+FrameStatus
+DecodeFrame(uint8_t* data,
+            size_t size,
+            const FrameOptions& options,
+            Frame& frame,
+            size_t& wire_size,
+            char* error,
+            FrameProgress* progress)
+{
+    FrameProgress unused;
+    FrameStatus status = Decode(data,
+                                size,
+                                options,
+                                frame,
+                                wire_size,
+                                error,
+                                progress != nullptr ? *progress : unused,
+                                progress != nullptr);
+
+    if (progress != nullptr && status != FRAME_INCOMPLETE) {
+        *progress = FrameProgress();
+    }
+
+    return status;
+}
+
+} // namespace dcvext
@@ -0,0 +1,136 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_CHANNEL_FRAMING
+#define DCV_EXTENSION_CHANNEL_FRAMING
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dcvext {
+
+/*
+ * Message framing on top of the virtual channel byte stream. Every frame
+ * starts with a fixed header:
+ *
+ *   0  payload length, 32 bit little endian
+ *   4  frame type
+ *   5  flags
+ *   6  CRC chunk shift, CRCs cover chunks of 1 << shift bytes, 0 for one per frame
+ *   7  reserved, 0
+ *   8  CRC32C of bytes 0-7 with FRAME_FLAG_CRC32C, 0 otherwise
+ *
+ * With FRAME_FLAG_CRC32C each payload chunk is followed by its CRC32C, so a
+ * frame with one chunk carries a single trailer. Both ends must agree on
+ * whether CRCs are required, a receiver that requires them rejects frames
+ * without.
+ *
+ * Frame types from FRAME_TYPE_RESERVED up are used by the channel layer
+ * itself and never reach the application.
+ */
+enum
+{
+    FRAME_HEADER_SIZE = 12,
+    FRAME_CRC_SIZE = 4,
+    FRAME_TYPE_DATA = 0,
+    FRAME_TYPE_RESERVED = 0xf0,
+    FRAME_TYPE_PING = 0xf0,
+    FRAME_TYPE_PONG = 0xf1,
+    FRAME_TYPE_DEDUP = 0xf2,
+    FRAME_FLAG_CRC32C = 0x01,
+    FRAME_MIN_CHUNK_SHIFT = 10,
+    FRAME_MAX_CHUNK_SHIFT = 24,
+    FRAME_DEFAULT_MAX_PAYLOAD = 16 * 1024 * 1024
+};
+
+enum FrameStatus
+{
+    FRAME_INCOMPLETE,
+    FRAME_COMPLETE,
+    FRAME_CORRUPT,
+    FRAME_TOO_LARGE
+};
+
+struct FrameOptions
+{
+    // Add CRCs to written frames and require them on read frames
+    bool crc32c = false;
+    // Chunk size for CRCs as a power of two, 0 for one CRC per frame
+    uint8_t chunk_shift = 0;
+    size_t max_payload = FRAME_DEFAULT_MAX_PAYLOAD;
+};
+
+struct Frame
+{
+    uint8_t type = FRAME_TYPE_DATA;
+    uint8_t flags = 0;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Bytes a frame with a payload of the given size takes on the wire
+size_t
+FrameWireSize(size_t payload_size,
+              const FrameOptions& options);
+
+// Append a frame to out
+void
+EncodeFrame(uint8_t type,
+            const void* payload,
+            size_t size,
+            const FrameOptions& options,
+            std::vector<uint8_t>& out);
+
+/*
+ * How far the CRCs of an incomplete frame have been checked. Passed back to
+ * DecodeFrame() as more of the frame arrives, the payload is checked while
+ * it is still in the cache instead of in one pass once the frame is
+ * complete.
+ */
+struct FrameProgress
+{
+    // Chunks checked and moved into place
+    size_t chunks = 0;
+    // Bytes of the first chunk checked so far, and their CRC
+    size_t checked = 0;
+    uint32_t crc = 0;
+};
+
+/*
+ * Decode the frame at the start of data. Once the header has been read
+ * wire_size is the size of the whole frame, even if incomplete. Chunk CRCs
+ * are stripped in place so the payload in frame is contiguous; on anything
+ * but FRAME_INCOMPLETE the frame bytes must not be decoded again. With
+ * progress, chunks are checked and moved as they arrive, so an incomplete
+ * frame must only be decoded again with the same progress, which is reset
+ * once the frame is complete or failed. The reason of a failure is
+ * described in error, which must hold at least 128 bytes.
+ */
+FrameStatus
+DecodeFrame(uint8_t* data,
+            size_t size,
+            const FrameOptions& options,
+            Frame& frame,
+            size_t& wire_size,
+            char* error,
+            FrameProgress* progress = nullptr);
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_CHANNEL_FRAMING
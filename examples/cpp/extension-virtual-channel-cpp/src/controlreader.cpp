@@ -0,0 +1,127 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "controlreader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "memstats.h"
+#include "simplelogger.h"
+
+namespace dcvext {
+
+ControlReader::ControlReader(size_t max_message)
+    : m_max_message(max_message)
+{
+    MemoryScope scope(MEMORY_CONTROL);
+    m_buffer.resize(CONTROL_READ_SIZE);
+}
+
+uint8_t*
+ControlReader::Prepare(size_t& space)
+{
+    size_t pending = m_end - m_begin;
+    size_t needed = sizeof(uint32_t);
+
+    if (pending >= sizeof(uint32_t)) {
+        uint32_t size;
+        memcpy(&size, m_buffer.data() + m_begin, sizeof size);
+        // Bounded by Next() before anything is read past the size
+        needed += std::min<size_t>(size, m_max_message);
+    }
+
+    // Move the unfinished message to the front once the tail runs short
+    size_t wanted = std::max<size_t>(needed > pending ? needed - pending : 0, CONTROL_READ_SIZE / 2);
+    if (m_begin > 0 && m_buffer.size() - m_end < wanted) {
+        memmove(m_buffer.data(), m_buffer.data() + m_begin, pending);
+        m_begin = 0;
+        m_end = pending;
+    }
+    MemoryScope scope(MEMORY_CONTROL);
+    if (needed > m_buffer.size()) {
+        m_buffer.resize(needed);
+    }
+    if (m_end == m_buffer.size()) {
+        m_buffer.resize(m_buffer.size() + CONTROL_READ_SIZE);
+    }
+
+    space = m_buffer.size() - m_end;
+    return m_buffer.data() + m_end;
+}
+
+void
+ControlReader::Commit(size_t bytes)
+{
+    m_end += bytes;
+
+    if (m_stats.reads > 0 && m_read_messages == 0) {
+        m_stats.partial_reads++;
+    }
+
+    m_stats.reads++;
+    m_stats.bytes += bytes;
+    m_read_messages = 0;
+}
+
+FrameStatus
+ControlReader::Next(const uint8_t*& data,
+                    uint32_t& size)
+{
+    size_t pending = m_end - m_begin;
+
+    if (pending < sizeof size) {
+        return FRAME_INCOMPLETE;
+    }
+
+    memcpy(&size, m_buffer.data() + m_begin, sizeof size);
+    if (size > m_max_message) {
+        log_f("Message of %u bytes on stdin, the limit is %zu", size, m_max_message);
+        return FRAME_TOO_LARGE;
+    }
+    if (pending - sizeof size < size) {
+        return FRAME_INCOMPLETE;
+    }
+
+    data = m_buffer.data() + m_begin + sizeof size;
+    m_begin += sizeof size + size;
+    if (m_begin == m_end) {
+        m_begin = 0;
+        m_end = 0;
+    }
+
+    m_stats.messages++;
+    m_stats.max_messages_per_read = std::max(m_stats.max_messages_per_read, ++m_read_messages);
+
+    return FRAME_COMPLETE;
+}
+
+void
+ControlReader::LogStats() const
+{
+    log_f("Control reader: %llu messages in %llu reads (%.2f per read, at most %llu), %llu reads without a "
+          "complete message, %llu bytes",
+          static_cast<unsigned long long>(m_stats.messages),
+          static_cast<unsigned long long>(m_stats.reads),
+          m_stats.reads != 0 ? static_cast<double>(m_stats.messages) / static_cast<double>(m_stats.reads) : 0.0,
+          static_cast<unsigned long long>(m_stats.max_messages_per_read),
+          static_cast<unsigned long long>(m_stats.partial_reads),
+          static_cast<unsigned long long>(m_stats.bytes));
+}
+
+} // namespace dcvext
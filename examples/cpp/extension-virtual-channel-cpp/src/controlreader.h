@@ -0,0 +1,114 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_CONTROL_READER
+#define DCV_EXTENSION_CONTROL_READER
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "channelframing.h"
+
+namespace dcvext {
+
+enum
+{
+    CONTROL_READ_SIZE = 64 * 1024,
+    CONTROL_DEFAULT_MAX_MESSAGE = 16 * 1024 * 1024
+};
+
+struct ControlReaderStats
+{
+    uint64_t reads = 0;
+    uint64_t bytes = 0;
+    uint64_t messages = 0;
+    // Most messages completed by a single read
+    uint64_t max_messages_per_read = 0;
+    // Reads that did not complete any message
+    uint64_t partial_reads = 0;
+};
+
+/*
+ * Incremental decoder for the messages DCV writes on stdin, each a 32 bit
+ * size in native byte order followed by that many bytes of protobuf. Reads
+ * go into a read-ahead buffer CONTROL_READ_SIZE bytes at a time, so a burst
+ * of messages is taken in with a single read and then handed out one by one
+ * without touching the handle again. A message split across reads is
+ * completed by the following ones; only the unfinished tail is ever moved to
+ * the front of the buffer. The reader does no IO itself and works the same
+ * for blocking reads and for the event loop:
+ *
+ *   size_t space;
+ *   uint8_t* buffer = reader.Prepare(space);
+ *   ... read up to space bytes into buffer ...
+ *   reader.Commit(bytes);
+ *   while (reader.Next(data, size) == FRAME_COMPLETE) { ... }
+ */
+class ControlReader
+{
+public:
+    explicit ControlReader(size_t max_message = CONTROL_DEFAULT_MAX_MESSAGE);
+
+    /*
+     * Where to read next and how much, at least the rest of the message
+     * being read. Messages returned by Next() are only valid until the
+     * next call.
+     */
+    uint8_t*
+    Prepare(size_t& space);
+
+    // Account for bytes read into the buffer returned by Prepare()
+    void
+    Commit(size_t bytes);
+
+    /*
+     * Take the next complete message. FRAME_INCOMPLETE asks for another
+     * read; after FRAME_TOO_LARGE the stream cannot be resynchronised.
+     */
+    FrameStatus
+    Next(const uint8_t*& data,
+         uint32_t& size);
+
+    size_t
+    MaxMessage() const
+    {
+        return m_max_message;
+    }
+
+    const ControlReaderStats&
+    Stats() const
+    {
+        return m_stats;
+    }
+
+    void
+    LogStats() const;
+
+private:
+    std::vector<uint8_t> m_buffer;
+    size_t m_begin = 0;
+    size_t m_end = 0;
+    size_t m_max_message;
+    uint64_t m_read_messages = 0;
+    ControlReaderStats m_stats;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_CONTROL_READER
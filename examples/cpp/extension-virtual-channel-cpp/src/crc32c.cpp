@@ -0,0 +1,757 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define DCV_CRC32C_X86 1
+#include <immintrin.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define DCV_CRC32C_ARM 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <arm_acle.h>
+#endif
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if defined(__clang__)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_SSE42_PCLMUL __attribute__((target("sse4.2,pclmul")))
+#define TARGET_AVX512_VPCLMUL __attribute__((target("sse4.2,pclmul,avx512f,vpclmulqdq")))
+#define TARGET_ARM_CRC __attribute__((target("crc")))
+#elif defined(__GNUC__)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_SSE42_PCLMUL __attribute__((target("sse4.2,pclmul")))
+#define TARGET_AVX512_VPCLMUL __attribute__((target("sse4.2,pclmul,avx512f,vpclmulqdq")))
+#define TARGET_ARM_CRC __attribute__((target("+crc")))
+#else
+#define TARGET_SSE42
+#define TARGET_SSE42_PCLMUL
+#define TARGET_AVX512_VPCLMUL
+#define TARGET_ARM_CRC
+#endif
+
+namespace dcvext {
+
+namespace {
+
+typedef uint32_t (*UpdateFunction)(uint32_t crc, const uint8_t* data, size_t size);
+typedef uint32_t (*CopyFunction)(uint32_t crc, uint8_t* dst, const uint8_t* src, size_t size);
+
+// Reflected Castagnoli polynomial
+constexpr uint32_t CRC32C_POLY = 0x82F63B78;
+
+struct Crc32cTables
+{
+    uint32_t table[8][256];
+};
+
+constexpr Crc32cTables
+MakeTables()
+{
+    Crc32cTables tables = {};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        tables.table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            uint32_t prev = tables.table[k - 1][i];
+            tables.table[k][i] = (prev >> 8) ^ tables.table[0][prev & 0xFF];
+        }
+    }
+
+    return tables;
+}
+
+// Built at compile time, nothing runs at startup
+constexpr Crc32cTables crc_tables = MakeTables();
+
+inline uint32_t
+Load32(const uint8_t* data)
+{
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+        | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+inline uint64_t
+Load64(const uint8_t* data)
+{
+    uint64_t value;
+
+    memcpy(&value, data, sizeof value);
+
+    return value;
+}
+
+uint32_t
+UpdatePortable(uint32_t crc,
+               const uint8_t* data,
+               size_t size)
+{
+    const auto& t = crc_tables.table;
+
+    while (size >= 8) {
+        uint32_t lo = crc ^ Load32(data);
+        uint32_t hi = Load32(data + 4);
+
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/*
+ * Copy and CRC in pieces that stay in L1, so that large buffers are read
+ * from memory once instead of twice. memmove keeps a copy towards the start
+ * of an overlapping buffer correct.
+ */
+template<UpdateFunction update>
+uint32_t
+CopyPieces(uint32_t crc,
+           uint8_t* dst,
+           const uint8_t* src,
+           size_t size)
+{
+    const size_t piece = 16 * 1024;
+
+    while (size > 0) {
+        size_t length = size < piece ? size : piece;
+
+        memmove(dst, src, length);
+        crc = update(crc, dst, length);
+
+        dst += length;
+        src += length;
+        size -= length;
+    }
+
+    return crc;
+}
+
+#ifdef DCV_CRC32C_X86
+
+enum
+{
+    LONG_LANE = 4096,
+    SHORT_LANE = 256
+};
+
+/*
+ * Multiplying a CRC register by x^(8n) mod P appends n zero bytes to the
+ * data it covers. With k = x^(8n - 33) mod P a carry-less multiply gives
+ * crc * k * x (reflected operands), and running the 64 bit product through
+ * the crc32 instruction multiplies by x^32 and reduces mod P.
+ */
+constexpr uint32_t
+XPowModP(uint64_t power)
+{
+    uint32_t value = 0x80000000; // x^0, reflected
+
+    while (power-- > 0) {
+        value = (value & 1) ? (value >> 1) ^ CRC32C_POLY : value >> 1;
+    }
+
+    return value;
+}
+
+constexpr uint32_t LONG_LANE_SHIFT = XPowModP(8 * LONG_LANE - 33);
+constexpr uint32_t LONG_LANE_SHIFT2 = XPowModP(8 * 2 * LONG_LANE - 33);
+constexpr uint32_t SHORT_LANE_SHIFT = XPowModP(8 * SHORT_LANE - 33);
+constexpr uint32_t SHORT_LANE_SHIFT2 = XPowModP(8 * 2 * SHORT_LANE - 33);
+
+// Unaligned loads cost nothing extra on x86-64, so there is no alignment prologue
+TARGET_SSE42 uint32_t
+UpdateSse42(uint32_t crc,
+            const uint8_t* data,
+            size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        crc64 = _mm_crc32_u64(crc64, Load64(data));
+        data += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+
+    if (size >= 4) {
+        crc = _mm_crc32_u32(crc, Load32(data));
+        data += 4;
+        size -= 4;
+    }
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+
+TARGET_SSE42_PCLMUL inline uint32_t
+Shift(uint32_t crc,
+      uint32_t constant)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                                           _mm_cvtsi32_si128(static_cast<int>(constant)),
+                                           0);
+
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+/*
+ * The crc32 instruction has a latency of three cycles and a throughput of
+ * one per cycle: three independent streams over consecutive lanes keep it
+ * busy, then the lane CRCs are shifted into place and combined.
+ */
+TARGET_SSE42_PCLMUL uint32_t
+UpdateSse42Pclmul(uint32_t crc,
+                  const uint8_t* data,
+                  size_t size)
+{
+    if (size < 3 * SHORT_LANE) {
+        return UpdateSse42(crc, data, size);
+    }
+
+    const size_t lanes[2] = { LONG_LANE, SHORT_LANE };
+    const uint32_t shift1[2] = { LONG_LANE_SHIFT, SHORT_LANE_SHIFT };
+    const uint32_t shift2[2] = { LONG_LANE_SHIFT2, SHORT_LANE_SHIFT2 };
+
+    for (int l = 0; l < 2; ++l) {
+        size_t lane = lanes[l];
+
+        while (size >= 3 * lane) {
+            uint64_t a = crc;
+            uint64_t b = 0;
+            uint64_t c = 0;
+
+            for (size_t i = 0; i < lane; i += 8) {
+                a = _mm_crc32_u64(a, Load64(data + i));
+                b = _mm_crc32_u64(b, Load64(data + lane + i));
+                c = _mm_crc32_u64(c, Load64(data + 2 * lane + i));
+            }
+
+            crc = Shift(static_cast<uint32_t>(a), shift2[l]) ^ Shift(static_cast<uint32_t>(b), shift1[l])
+                ^ static_cast<uint32_t>(c);
+
+            data += 3 * lane;
+            size -= 3 * lane;
+        }
+    }
+
+    return UpdateSse42(crc, data, size);
+}
+
+/*
+ * Folding with carry-less multiplies: a 128 bit block followed by D bits of
+ * data is congruent mod P to lo * x^(D+32) + hi * x^(D-32) in the same
+ * position, so it can be multiplied forward and xored into the data D bits
+ * later. Sixteen blocks in four 512 bit registers are folded 256 bytes
+ * forward at a time, then onto each other down to one block, which the crc32
+ * instruction reduces. The constants are the reflected powers shifted by
+ * one, as the reflected product comes out one bit short.
+ */
+constexpr uint64_t
+FoldConstant(uint64_t power)
+{
+    return static_cast<uint64_t>(XPowModP(power)) << 1;
+}
+
+struct FoldConstants
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+constexpr FoldConstants
+FoldBy(uint64_t bits)
+{
+    return { FoldConstant(bits + 32), FoldConstant(bits - 32) };
+}
+
+constexpr FoldConstants FOLD_2048 = FoldBy(2048);
+constexpr FoldConstants FOLD_1536 = FoldBy(1536);
+constexpr FoldConstants FOLD_1024 = FoldBy(1024);
+constexpr FoldConstants FOLD_512 = FoldBy(512);
+constexpr FoldConstants FOLD_384 = FoldBy(384);
+constexpr FoldConstants FOLD_256 = FoldBy(256);
+constexpr FoldConstants FOLD_128 = FoldBy(128);
+
+TARGET_AVX512_VPCLMUL inline __m512i
+Broadcast(const FoldConstants& k)
+{
+    return _mm512_set_epi64(static_cast<long long>(k.hi),
+                            static_cast<long long>(k.lo),
+                            static_cast<long long>(k.hi),
+                            static_cast<long long>(k.lo),
+                            static_cast<long long>(k.hi),
+                            static_cast<long long>(k.lo),
+                            static_cast<long long>(k.hi),
+                            static_cast<long long>(k.lo));
+}
+
+// x folded forward by the distance of k, xored with data
+TARGET_AVX512_VPCLMUL inline __m512i
+Fold512(__m512i x,
+        __m512i k,
+        __m512i data)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                     _mm512_clmulepi64_epi128(x, k, 0x11),
+                                     data,
+                                     0x96);
+}
+
+TARGET_AVX512_VPCLMUL inline __m128i
+Fold128(__m128i x,
+        const FoldConstants& k,
+        __m128i data)
+{
+    __m128i constants = _mm_set_epi64x(static_cast<long long>(k.hi), static_cast<long long>(k.lo));
+
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, constants, 0x00),
+                                       _mm_clmulepi64_si128(x, constants, 0x11)),
+                         data);
+}
+
+/*
+ * With copy set the data is also stored to dst, from the registers it was
+ * loaded into, so copying and checking read the source once. Stores trail
+ * the loads of the same bytes, which keeps a copy towards the start of an
+ * overlapping buffer correct.
+ */
+template<bool copy>
+TARGET_AVX512_VPCLMUL uint32_t
+FoldAvx512(uint32_t crc,
+           uint8_t* dst,
+           const uint8_t* src,
+           size_t size)
+{
+    if (size < 256) {
+        if (copy) {
+            return CopyPieces<UpdateSse42>(crc, dst, src, size);
+        }
+        return UpdateSse42(crc, src, size);
+    }
+
+    __m512i x0 = _mm512_loadu_si512(src);
+    __m512i x1 = _mm512_loadu_si512(src + 64);
+    __m512i x2 = _mm512_loadu_si512(src + 128);
+    __m512i x3 = _mm512_loadu_si512(src + 192);
+    if (copy) {
+        _mm512_storeu_si512(dst, x0);
+        _mm512_storeu_si512(dst + 64, x1);
+        _mm512_storeu_si512(dst + 128, x2);
+        _mm512_storeu_si512(dst + 192, x3);
+        dst += 256;
+    }
+    x0 = _mm512_xor_si512(x0, _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, static_cast<long long>(crc)));
+    src += 256;
+    size -= 256;
+
+    const __m512i fold_2048 = Broadcast(FOLD_2048);
+    while (size >= 256) {
+        __m512i d0 = _mm512_loadu_si512(src);
+        __m512i d1 = _mm512_loadu_si512(src + 64);
+        __m512i d2 = _mm512_loadu_si512(src + 128);
+        __m512i d3 = _mm512_loadu_si512(src + 192);
+        if (copy) {
+            _mm512_storeu_si512(dst, d0);
+            _mm512_storeu_si512(dst + 64, d1);
+            _mm512_storeu_si512(dst + 128, d2);
+            _mm512_storeu_si512(dst + 192, d3);
+            dst += 256;
+        }
+
+        x0 = Fold512(x0, fold_2048, d0);
+        x1 = Fold512(x1, fold_2048, d1);
+        x2 = Fold512(x2, fold_2048, d2);
+        x3 = Fold512(x3, fold_2048, d3);
+
+        src += 256;
+        size -= 256;
+    }
+
+    __m512i x = Fold512(x0, Broadcast(FOLD_1536), x3);
+    x = Fold512(x1, Broadcast(FOLD_1024), x);
+    x = Fold512(x2, Broadcast(FOLD_512), x);
+
+    const __m512i fold_512 = Broadcast(FOLD_512);
+    while (size >= 64) {
+        __m512i d = _mm512_loadu_si512(src);
+        if (copy) {
+            _mm512_storeu_si512(dst, d);
+            dst += 64;
+        }
+
+        x = Fold512(x, fold_512, d);
+
+        src += 64;
+        size -= 64;
+    }
+
+    // Through memory once, the lane extracts trip a false uninitialized warning in GCC 12
+    alignas(64) __m128i lanes[4];
+    _mm512_store_si512(lanes, x);
+    __m128i y = Fold128(lanes[0], FOLD_384, lanes[3]);
+    y = Fold128(lanes[1], FOLD_256, y);
+    y = Fold128(lanes[2], FOLD_128, y);
+
+    while (size >= 16) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        if (copy) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), d);
+            dst += 16;
+        }
+
+        y = Fold128(y, FOLD_128, d);
+
+        src += 16;
+        size -= 16;
+    }
+
+    uint64_t crc64 = _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(y)));
+    crc64 = _mm_crc32_u64(crc64, static_cast<uint64_t>(_mm_extract_epi64(y, 1)));
+    crc = static_cast<uint32_t>(crc64);
+
+    if (copy) {
+        return CopyPieces<UpdateSse42>(crc, dst, src, size);
+    }
+    return UpdateSse42(crc, src, size);
+}
+
+TARGET_AVX512_VPCLMUL uint32_t
+UpdateAvx512(uint32_t crc,
+             const uint8_t* data,
+             size_t size)
+{
+    return FoldAvx512<false>(crc, nullptr, data, size);
+}
+
+TARGET_AVX512_VPCLMUL uint32_t
+CopyAvx512(uint32_t crc,
+           uint8_t* dst,
+           const uint8_t* src,
+           size_t size)
+{
+    return FoldAvx512<true>(crc, dst, src, size);
+}
+
+bool
+CpuHasAvx512Vpclmul()
+{
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned long long xcr0;
+
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0) {
+        return false;
+    }
+    xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    ebx = static_cast<unsigned int>(info[1]);
+    ecx = static_cast<unsigned int>(info[2]);
+#else
+    unsigned int eax, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (ecx & (1u << 27)) == 0) {
+        return false;
+    }
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+#endif
+
+    // The OS must save the SSE, AVX and AVX-512 registers
+    const unsigned long long state = 0xe6;
+
+    return (xcr0 & state) == state && (ebx & (1u << 16)) != 0 && (ecx & (1u << 10)) != 0;
+}
+
+bool
+CpuHasSse42(bool& pclmul)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    unsigned int ecx = static_cast<unsigned int>(info[2]);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        pclmul = false;
+        return false;
+    }
+#endif
+
+    pclmul = (ecx & (1u << 1)) != 0;
+
+    return (ecx & (1u << 20)) != 0;
+}
+
+#endif // DCV_CRC32C_X86
+
+#ifdef DCV_CRC32C_ARM
+
+TARGET_ARM_CRC uint32_t
+UpdateArmv8(uint32_t crc,
+            const uint8_t* data,
+            size_t size)
+{
+    while (size >= 8) {
+        crc = __crc32cd(crc, Load64(data));
+        data += 8;
+        size -= 8;
+    }
+
+    if (size >= 4) {
+        crc = __crc32cw(crc, Load32(data));
+        data += 4;
+        size -= 4;
+    }
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+
+    return crc;
+}
+
+bool
+CpuHasArmCrc()
+{
+#if defined(__APPLE__)
+    return true;
+#elif defined(_MSC_VER)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != 0;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // DCV_CRC32C_ARM
+
+UpdateFunction
+KernelFunction(Crc32cKernel kernel)
+{
+    switch (kernel) {
+#ifdef DCV_CRC32C_X86
+    case CRC32C_SSE42:
+        return UpdateSse42;
+    case CRC32C_SSE42_PCLMUL:
+        return UpdateSse42Pclmul;
+    case CRC32C_AVX512_VPCLMUL:
+        return UpdateAvx512;
+#endif
+#ifdef DCV_CRC32C_ARM
+    case CRC32C_ARMV8:
+        return UpdateArmv8;
+#endif
+    default:
+        return UpdatePortable;
+    }
+}
+
+CopyFunction
+KernelCopyFunction(Crc32cKernel kernel)
+{
+    switch (kernel) {
+#ifdef DCV_CRC32C_X86
+    case CRC32C_SSE42:
+        return CopyPieces<UpdateSse42>;
+    case CRC32C_SSE42_PCLMUL:
+        return CopyPieces<UpdateSse42Pclmul>;
+    case CRC32C_AVX512_VPCLMUL:
+        return CopyAvx512;
+#endif
+#ifdef DCV_CRC32C_ARM
+    case CRC32C_ARMV8:
+        return CopyPieces<UpdateArmv8>;
+#endif
+    default:
+        return CopyPieces<UpdatePortable>;
+    }
+}
+
+Crc32cKernel
+SelectKernel()
+{
+    if (Crc32cKernelAvailable(CRC32C_AVX512_VPCLMUL)) {
+        return CRC32C_AVX512_VPCLMUL;
+    }
+    if (Crc32cKernelAvailable(CRC32C_SSE42_PCLMUL)) {
+        return CRC32C_SSE42_PCLMUL;
+    }
+    if (Crc32cKernelAvailable(CRC32C_SSE42)) {
+        return CRC32C_SSE42;
+    }
+    if (Crc32cKernelAvailable(CRC32C_ARMV8)) {
+        return CRC32C_ARMV8;
+    }
+
+    return CRC32C_PORTABLE;
+}
+
+struct Dispatch
+{
+    Dispatch()
+        : kernel(SelectKernel())
+        , update(KernelFunction(kernel))
+        , copy(KernelCopyFunction(kernel))
+    {
+    }
+
+    Crc32cKernel kernel;
+    UpdateFunction update;
+    CopyFunction copy;
+};
+
+const Dispatch&
+GetDispatch()
+{
+    static const Dispatch dispatch;
+
+    return dispatch;
+}
+
+} // namespace
+
+bool
+Crc32cKernelAvailable(Crc32cKernel kernel)
+{
+    switch (kernel) {
+    case CRC32C_PORTABLE:
+        return true;
+#ifdef DCV_CRC32C_X86
+    case CRC32C_SSE42: {
+        bool pclmul;
+        return CpuHasSse42(pclmul);
+    }
+    case CRC32C_SSE42_PCLMUL: {
+        bool pclmul;
+        return CpuHasSse42(pclmul) && pclmul;
+    }
+    case CRC32C_AVX512_VPCLMUL: {
+        bool pclmul;
+        return CpuHasSse42(pclmul) && pclmul && CpuHasAvx512Vpclmul();
+    }
+#endif
+#ifdef DCV_CRC32C_ARM
+    case CRC32C_ARMV8:
+        return CpuHasArmCrc();
+#endif
+    default:
+        return false;
+    }
+}
+
+const char*
+Crc32cKernelName(Crc32cKernel kernel)
+{
+    switch (kernel) {
+    case CRC32C_PORTABLE:
+        return "portable";
+    case CRC32C_SSE42:
+        return "sse4.2";
+    case CRC32C_SSE42_PCLMUL:
+        return "sse4.2+pclmul";
+    case CRC32C_AVX512_VPCLMUL:
+        return "avx512+vpclmul";
+    case CRC32C_ARMV8:
+        return "armv8";
+    }
+
+    return "unknown";
+}
+
+Crc32cKernel
+Crc32cSelectedKernel()
+{
+    return GetDispatch().kernel;
+}
+
+uint32_t
+Crc32cWith(Crc32cKernel kernel,
+           uint32_t crc,
+           const void* data,
+           size_t size)
+{
+    return ~KernelFunction(kernel)(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t
+Crc32c(uint32_t crc,
+       const void* data,
+       size_t size)
+{
+    return ~GetDispatch().update(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t
+Crc32cCopyWith(Crc32cKernel kernel,
+               uint32_t crc,
+               void* dst,
+               const void* src,
+               size_t size)
+{
+    return ~KernelCopyFunction(kernel)(~crc, static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), size);
+}
+
+uint32_t
+Crc32cCopy(uint32_t crc,
+           void* dst,
+           const void* src,
+           size_t size)
+{
+    return ~GetDispatch().copy(~crc, static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), size);
+}
+
+} // namespace dcvext
@@ -0,0 +1,82 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_CRC32C
+#define DCV_EXTENSION_CRC32C
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dcvext {
+
+enum Crc32cKernel
+{
+    CRC32C_PORTABLE,        // slicing-by-8 tables
+    CRC32C_SSE42,           // crc32 instruction, one stream
+    CRC32C_SSE42_PCLMUL,    // crc32 instruction, three interleaved streams merged with carry-less multiplies
+    CRC32C_ARMV8,           // ARMv8 crc32c instructions
+    CRC32C_AVX512_VPCLMUL   // 512 bit carry-less multiplies folding 256 bytes at a time
+};
+
+/*
+ * CRC32C (Castagnoli) of data, continuing from crc: pass 0 for the first
+ * block and the previous result for the following ones. The fastest kernel
+ * supported by the CPU is picked on first use.
+ */
+uint32_t
+Crc32c(uint32_t crc,
+       const void* data,
+       size_t size);
+
+Crc32cKernel
+Crc32cSelectedKernel();
+
+bool
+Crc32cKernelAvailable(Crc32cKernel kernel);
+
+const char*
+Crc32cKernelName(Crc32cKernel kernel);
+
+// Same as Crc32c() with a given kernel, which must be available
+uint32_t
+Crc32cWith(Crc32cKernel kernel,
+           uint32_t crc,
+           const void* data,
+           size_t size);
+
+/*
+ * Copy size bytes from src to dst and return their CRC32C, continuing from
+ * crc, reading the source once. The buffers may overlap if dst is not after
+ * src, as when moving data towards the start of a buffer.
+ */
+uint32_t
+Crc32cCopy(uint32_t crc,
+           void* dst,
+           const void* src,
+           size_t size);
+
+uint32_t
+Crc32cCopyWith(Crc32cKernel kernel,
+               uint32_t crc,
+               void* dst,
+               const void* src,
+               size_t size);
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_CRC32C
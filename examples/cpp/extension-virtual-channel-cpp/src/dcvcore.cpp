@@ -0,0 +1,656 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "dcvcore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "bufferpool.h"
+#include "controlreader.h"
+#include "memstats.h"
+#include "simplelogger.h"
+
+using namespace dcvext;
+
+namespace {
+
+#ifdef _WIN32
+typedef HANDLE CoreHandle;
+const CoreHandle INVALID_CORE_HANDLE = INVALID_HANDLE_VALUE;
+#else
+typedef int CoreHandle;
+const CoreHandle INVALID_CORE_HANDLE = -1;
+#endif
+
+enum
+{
+    RELAY_BUSY_TIMEOUT_MS = 10000,
+    // Field numbers in extensions.proto
+    DCV_MESSAGE_RESPONSE_FIELD = 2,
+    RESPONSE_REQUEST_ID_FIELD = 1
+};
+
+dcv_core_status
+ReadSome(CoreHandle handle,
+         uint8_t* buffer,
+         size_t size,
+         size_t& read_bytes)
+{
+#ifdef _WIN32
+    DWORD curr_read;
+
+    if (!ReadFile(handle, buffer, static_cast<DWORD>(std::min<size_t>(size, MAXDWORD)), &curr_read, nullptr)) {
+        if (GetLastError() == ERROR_BROKEN_PIPE) {
+            return DCV_CORE_CLOSED;
+        }
+
+        log_f("Could not read from handle: 0x%X", GetLastError());
+        return DCV_CORE_ERROR_IO;
+    }
+
+    read_bytes = curr_read;
+#else
+    ssize_t res;
+
+    do {
+        res = read(handle, buffer, size);
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0) {
+        log_f("Could not read from handle: %i", errno);
+        return DCV_CORE_ERROR_IO;
+    }
+
+    read_bytes = static_cast<size_t>(res);
+#endif
+
+    return read_bytes == 0 ? DCV_CORE_CLOSED : DCV_CORE_OK;
+}
+
+dcv_core_status
+WriteAll(CoreHandle handle,
+         const uint8_t* buffer,
+         size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+#ifdef _WIN32
+        DWORD curr_written;
+        DWORD remaining = static_cast<DWORD>(std::min<size_t>(size - written, MAXDWORD));
+
+        if (!WriteFile(handle, buffer + written, remaining, &curr_written, nullptr)) {
+            log_f("Could not write to handle: 0x%X", GetLastError());
+            return DCV_CORE_ERROR_IO;
+        }
+#else
+        // send() keeps a closed relay from raising SIGPIPE, the standard streams are not sockets
+        ssize_t curr_written = send(handle, buffer + written, size - written, MSG_NOSIGNAL);
+        if (curr_written < 0 && errno == ENOTSOCK) {
+            curr_written = write(handle, buffer + written, size - written);
+        }
+
+        if (curr_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // stdout may share its file description with a non-blocking stdin
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd = { handle, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            log_f("Could not write to handle: %i", errno);
+            return DCV_CORE_ERROR_IO;
+        }
+#endif
+
+        written += static_cast<size_t>(curr_written);
+    }
+
+    return DCV_CORE_OK;
+}
+
+bool
+ReadVarint(const uint8_t*& data,
+           const uint8_t* end,
+           uint64_t& value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        uint8_t byte = *data++;
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Find a length delimited field of a serialized message by walking the
+ * protobuf wire format, false if it is not there or the message is broken
+ */
+bool
+FindField(const uint8_t* data,
+          size_t size,
+          uint32_t number,
+          const uint8_t*& field,
+          size_t& field_size)
+{
+    const uint8_t* end = data + size;
+
+    while (data < end) {
+        uint64_t key;
+        uint64_t value;
+
+        if (!ReadVarint(data, end, key)) {
+            return false;
+        }
+
+        switch (key & 7) {
+        case 0:
+            if (!ReadVarint(data, end, value)) {
+                return false;
+            }
+            break;
+        case 1:
+            if (end - data < 8) {
+                return false;
+            }
+            data += 8;
+            break;
+        case 2:
+            if (!ReadVarint(data, end, value) || value > static_cast<uint64_t>(end - data)) {
+                return false;
+            }
+            if (key >> 3 == number) {
+                field = data;
+                field_size = static_cast<size_t>(value);
+                return true;
+            }
+            data += value;
+            break;
+        case 5:
+            if (end - data < 4) {
+                return false;
+            }
+            data += 4;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// Whether a serialized DcvMessage is the response to request_id
+bool
+IsResponseTo(const uint8_t* message,
+             size_t size,
+             const char* request_id)
+{
+    const uint8_t* response;
+    size_t response_size;
+    const uint8_t* id = nullptr;
+    size_t id_size = 0;
+
+    if (!FindField(message, size, DCV_MESSAGE_RESPONSE_FIELD, response, response_size)) {
+        return false;
+    }
+
+    // An empty request_id is not on the wire at all
+    FindField(response, response_size, RESPONSE_REQUEST_ID_FIELD, id, id_size);
+
+    return id_size == strlen(request_id) && (id_size == 0 || memcmp(id, request_id, id_size) == 0);
+}
+
+} // namespace
+
+struct dcv_core
+{
+    explicit dcv_core(size_t max_message)
+        : reader(max_message)
+    {
+    }
+
+    CoreHandle input = INVALID_CORE_HANDLE;
+    CoreHandle output = INVALID_CORE_HANDLE;
+    ControlReader reader;
+    std::deque<std::vector<uint8_t>> deferred;
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> write_buffer;
+    uint64_t last_request_id = 0;
+    uint64_t messages_written = 0;
+    uint64_t bytes_written = 0;
+    uint64_t messages_deferred = 0;
+};
+
+struct dcv_channel
+{
+    dcv_channel()
+        : receive(DefaultBufferPool())
+    {
+    }
+
+    CoreHandle handle = INVALID_CORE_HANDLE;
+    ReceiveBuffer receive;
+};
+
+namespace {
+
+// The next message from DCV, reading only when none is left from the last read
+dcv_core_status
+NextMessage(dcv_core* core,
+            const uint8_t*& message,
+            size_t& size)
+{
+    for (;;) {
+        uint32_t message_size;
+        FrameStatus status = core->reader.Next(message, message_size);
+
+        if (status == FRAME_COMPLETE) {
+            size = message_size;
+            return DCV_CORE_OK;
+        }
+        if (status != FRAME_INCOMPLETE) {
+            return DCV_CORE_ERROR_TOO_LARGE;
+        }
+
+        size_t space;
+        size_t read_bytes = 0;
+        uint8_t* buffer = core->reader.Prepare(space);
+
+        dcv_core_status res = ReadSome(core->input, buffer, space, read_bytes);
+        if (res != DCV_CORE_OK) {
+            return res;
+        }
+
+        core->reader.Commit(read_bytes);
+    }
+}
+
+dcv_core_status
+TakeCurrent(dcv_core* core,
+            std::deque<std::vector<uint8_t>>::iterator deferred,
+            const uint8_t** message,
+            size_t* size)
+{
+    core->current.swap(*deferred);
+    core->deferred.erase(deferred);
+
+    *message = core->current.data();
+    *size = core->current.size();
+
+    return DCV_CORE_OK;
+}
+
+} // namespace
+
+uint32_t
+dcv_core_abi_version(void)
+{
+    return DCV_CORE_ABI_VERSION;
+}
+
+dcv_core*
+dcv_core_open(const dcv_core_options* options)
+{
+    size_t max_message = CONTROL_DEFAULT_MAX_MESSAGE;
+
+    if (options != nullptr && options->struct_size >= offsetof(dcv_core_options, max_message) + sizeof(size_t)
+        && options->max_message != 0) {
+        max_message = options->max_message;
+    }
+
+    // Nothing may throw across the C ABI
+    MemoryScope scope(MEMORY_CONTROL);
+    dcv_core* core;
+    try {
+        core = new dcv_core(max_message);
+    } catch (const std::bad_alloc&) {
+        log_f("Could not allocate the protocol core");
+        return nullptr;
+    }
+
+#ifdef _WIN32
+    core->input = GetStdHandle(STD_INPUT_HANDLE);
+    core->output = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    if (core->input == INVALID_HANDLE_VALUE || core->output == INVALID_HANDLE_VALUE) {
+        log_f("Error getting std handles: 0x%X", GetLastError());
+        delete core;
+        return nullptr;
+    }
+#else
+    core->input = STDIN_FILENO;
+    core->output = STDOUT_FILENO;
+#endif
+
+    return core;
+}
+
+void
+dcv_core_close(dcv_core* core)
+{
+    // The standard streams stay open
+    delete core;
+}
+
+dcv_core_status
+dcv_core_next_request_id(dcv_core* core,
+                         char* id,
+                         size_t size)
+{
+    int length = snprintf(id, size, "%llu", static_cast<unsigned long long>(++core->last_request_id));
+
+    return length > 0 && static_cast<size_t>(length) < size ? DCV_CORE_OK : DCV_CORE_ERROR_INVALID;
+}
+
+uint8_t*
+dcv_core_prepare_write(dcv_core* core,
+                       size_t size)
+{
+    uint32_t message_size = static_cast<uint32_t>(size);
+
+    if (size > UINT32_MAX) {
+        return nullptr;
+    }
+
+    MemoryScope scope(MEMORY_CONTROL);
+    try {
+        core->write_buffer.resize(sizeof message_size + size);
+    } catch (const std::bad_alloc&) {
+        log_f("Could not allocate %zu bytes to write a message", size);
+        return nullptr;
+    }
+
+    // Size and message go out with a single write
+    memcpy(core->write_buffer.data(), &message_size, sizeof message_size);
+
+    return core->write_buffer.data() + sizeof message_size;
+}
+
+dcv_core_status
+dcv_core_commit_write(dcv_core* core)
+{
+    dcv_core_status status = WriteAll(core->output, core->write_buffer.data(), core->write_buffer.size());
+
+    if (status == DCV_CORE_OK) {
+        core->messages_written++;
+        core->bytes_written += core->write_buffer.size();
+    }
+
+    return status;
+}
+
+dcv_core_status
+dcv_core_write(dcv_core* core,
+               const void* message,
+               size_t size)
+{
+    uint8_t* buffer = dcv_core_prepare_write(core, size);
+    if (buffer == nullptr) {
+        return DCV_CORE_ERROR_NO_MEMORY;
+    }
+
+    if (size > 0) {
+        memcpy(buffer, message, size);
+    }
+
+    return dcv_core_commit_write(core);
+}
+
+dcv_core_status
+dcv_core_read(dcv_core* core,
+              const uint8_t** message,
+              size_t* size)
+{
+    if (!core->deferred.empty()) {
+        return TakeCurrent(core, core->deferred.begin(), message, size);
+    }
+
+    return NextMessage(core, *message, *size);
+}
+
+dcv_core_status
+dcv_core_read_response(dcv_core* core,
+                       const char* request_id,
+                       const uint8_t** message,
+                       size_t* size)
+{
+    for (auto it = core->deferred.begin(); it != core->deferred.end(); ++it) {
+        if (IsResponseTo(it->data(), it->size(), request_id)) {
+            return TakeCurrent(core, it, message, size);
+        }
+    }
+
+    for (;;) {
+        dcv_core_status status = NextMessage(core, *message, *size);
+        if (status != DCV_CORE_OK || IsResponseTo(*message, *size, request_id)) {
+            return status;
+        }
+
+        // Kept for dcv_core_read(), the read buffer is reused by the next read
+        MemoryScope scope(MEMORY_CONTROL);
+        try {
+            core->deferred.emplace_back(*message, *message + *size);
+        } catch (const std::bad_alloc&) {
+            log_f("Could not set aside a message of %zu bytes", *size);
+            return DCV_CORE_ERROR_NO_MEMORY;
+        }
+        core->messages_deferred++;
+    }
+}
+
+void
+dcv_core_get_stats(const dcv_core* core,
+                   dcv_core_stats* stats)
+{
+    const ControlReaderStats& reader = core->reader.Stats();
+    dcv_core_stats current = {};
+
+    current.struct_size = sizeof current;
+    current.reads = reader.reads;
+    current.messages_read = reader.messages;
+    current.bytes_read = reader.bytes;
+    current.max_messages_per_read = reader.max_messages_per_read;
+    current.messages_written = core->messages_written;
+    current.bytes_written = core->bytes_written;
+    current.messages_deferred = core->messages_deferred;
+    current.messages_pending = core->deferred.size();
+
+    // Only as much as the caller knows about
+    size_t size = std::min(stats->struct_size, sizeof current);
+    memcpy(stats, &current, size);
+    stats->struct_size = size;
+}
+
+void
+dcv_core_log_stats(const dcv_core* core)
+{
+    core->reader.LogStats();
+
+    log_f("Control writer: %llu messages, %llu bytes, %llu messages set aside while waiting for a response",
+          static_cast<unsigned long long>(core->messages_written),
+          static_cast<unsigned long long>(core->bytes_written),
+          static_cast<unsigned long long>(core->messages_deferred));
+}
+
+dcv_core_status
+dcv_channel_connect(const char* relay_path,
+                    const void* token,
+                    size_t token_size,
+                    dcv_channel** channel)
+{
+    CoreHandle handle;
+
+#ifdef _WIN32
+    for (;;) {
+        handle = CreateFileA(relay_path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (handle != INVALID_HANDLE_VALUE) {
+            break;
+        }
+
+        DWORD error = GetLastError();
+        if (error != ERROR_PIPE_BUSY) {
+            log_f("Failed to open pipe with error: 0x%x", error);
+            return DCV_CORE_ERROR_IO;
+        }
+
+        if (!WaitNamedPipeA(relay_path, RELAY_BUSY_TIMEOUT_MS)) {
+            log_f("Failed to open pipe, timeout reached");
+            return DCV_CORE_ERROR_IO;
+        }
+    }
+#else
+    // On Linux the relay is a unix socket in the abstract namespace
+    sockaddr_un addr = {};
+    size_t path_length = strlen(relay_path);
+
+    if (path_length == 0 || path_length >= sizeof addr.sun_path - 1) {
+        log_f("Invalid relay path '%s'", relay_path);
+        return DCV_CORE_ERROR_INVALID;
+    }
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, relay_path, path_length);
+    socklen_t addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + path_length);
+
+    handle = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (handle < 0) {
+        log_f("Could not create relay socket: %i", errno);
+        return DCV_CORE_ERROR_IO;
+    }
+
+    if (connect(handle, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0) {
+        log_f("Could not connect to relay '%s': %i", relay_path, errno);
+        close(handle);
+        return DCV_CORE_ERROR_IO;
+    }
+#endif
+
+    MemoryScope scope(MEMORY_CHANNELS);
+    dcv_channel* created = new (std::nothrow) dcv_channel;
+    if (created == nullptr) {
+#ifdef _WIN32
+        CloseHandle(handle);
+#else
+        close(handle);
+#endif
+        return DCV_CORE_ERROR_NO_MEMORY;
+    }
+    created->handle = handle;
+
+    dcv_core_status status = WriteAll(handle, static_cast<const uint8_t*>(token), token_size);
+    if (status != DCV_CORE_OK) {
+        dcv_channel_close(created);
+        return status;
+    }
+
+#ifdef _WIN32
+    FlushFileBuffers(handle);
+#endif
+
+    *channel = created;
+    return DCV_CORE_OK;
+}
+
+dcv_core_status
+dcv_channel_write(dcv_channel* channel,
+                  const void* data,
+                  size_t size)
+{
+    return WriteAll(channel->handle, static_cast<const uint8_t*>(data), size);
+}
+
+dcv_core_status
+dcv_channel_receive(dcv_channel* channel,
+                    dcv_buffer* buffer)
+{
+    size_t space;
+    size_t read_bytes = 0;
+
+    *buffer = dcv_buffer{};
+
+    uint8_t* data = channel->receive.Prepare(space);
+    if (data == nullptr) {
+        return DCV_CORE_ERROR_NO_MEMORY;
+    }
+
+    dcv_core_status status = ReadSome(channel->handle, data, space, read_bytes);
+    if (status != DCV_CORE_OK) {
+        return status;
+    }
+
+    BufferSlice slice = channel->receive.Commit(read_bytes);
+    buffer->data = slice.Data();
+    buffer->size = slice.Size();
+    buffer->block = slice.Detach();
+
+    return DCV_CORE_OK;
+}
+
+void
+dcv_buffer_release(dcv_buffer* buffer)
+{
+    if (buffer->block != nullptr) {
+        BufferPool::Release(static_cast<BufferBlock*>(buffer->block));
+    }
+
+    *buffer = dcv_buffer{};
+}
+
+void
+dcv_channel_close(dcv_channel* channel)
+{
+    if (channel == nullptr) {
+        return;
+    }
+
+#ifdef _WIN32
+    CloseHandle(channel->handle);
+#else
+    close(channel->handle);
+#endif
+
+    delete channel;
+}
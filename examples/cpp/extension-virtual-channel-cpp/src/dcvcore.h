@@ -0,0 +1,196 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_CORE
+#define DCV_EXTENSION_CORE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Protocol runtime shared by the C and C++ extensions, with a C ABI so that
+ * it can be linked statically or loaded as a shared library by either:
+ *
+ * - messages with DCV on stdin and stdout, read ahead and framed in a single
+ *   write each (see controlreader.h)
+ * - request ids and matching responses to them, without parsing anything
+ *   but the request_id of the response
+ * - virtual channel relays, received into pooled buffers (see bufferpool.h)
+ *
+ * Messages go in and out serialized, so the runtime works the same with
+ * protobuf-c and protobuf C++; dcvcorecpp.h wraps it for the latter. All
+ * calls on one dcv_core or dcv_channel must come from one thread at a time.
+ * Structs passed in or out start with struct_size, set by the caller to
+ * sizeof the struct it was built with, so fields can be added later.
+ */
+
+#if defined(DCV_CORE_STATIC)
+#define DCV_CORE_API
+#elif defined(_WIN32)
+#ifdef DCV_CORE_BUILD
+#define DCV_CORE_API __declspec(dllexport)
+#else
+#define DCV_CORE_API __declspec(dllimport)
+#endif
+#else
+#define DCV_CORE_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DCV_CORE_ABI_VERSION 1
+
+typedef enum dcv_core_status
+{
+    DCV_CORE_OK = 0,
+    // The other end closed the stream
+    DCV_CORE_CLOSED = 1,
+    DCV_CORE_ERROR_IO = -1,
+    DCV_CORE_ERROR_TOO_LARGE = -2,
+    DCV_CORE_ERROR_INVALID = -3,
+    DCV_CORE_ERROR_NO_MEMORY = -4
+} dcv_core_status;
+
+typedef struct dcv_core dcv_core;
+typedef struct dcv_channel dcv_channel;
+
+typedef struct dcv_core_options
+{
+    size_t struct_size;
+    // Largest message accepted from DCV, 0 for 16 MB
+    size_t max_message;
+} dcv_core_options;
+
+typedef struct dcv_core_stats
+{
+    size_t struct_size;
+    uint64_t reads;
+    uint64_t messages_read;
+    uint64_t bytes_read;
+    uint64_t max_messages_per_read;
+    uint64_t messages_written;
+    uint64_t bytes_written;
+    // Messages set aside while waiting for a response, and still waiting
+    uint64_t messages_deferred;
+    uint64_t messages_pending;
+} dcv_core_stats;
+
+// Data received on a channel, held until released
+typedef struct dcv_buffer
+{
+    const uint8_t* data;
+    size_t size;
+    void* block;
+} dcv_buffer;
+
+DCV_CORE_API uint32_t
+dcv_core_abi_version(void);
+
+// Talk to DCV on stdin and stdout, options may be NULL. NULL on failure
+DCV_CORE_API dcv_core*
+dcv_core_open(const dcv_core_options* options);
+
+DCV_CORE_API void
+dcv_core_close(dcv_core* core);
+
+// Next request id as text, unique for this core
+DCV_CORE_API dcv_core_status
+dcv_core_next_request_id(dcv_core* core,
+                         char* id,
+                         size_t size);
+
+/*
+ * Space to serialize an ExtensionMessage of size bytes into, sent with its
+ * size by dcv_core_commit_write(). NULL if out of memory.
+ */
+DCV_CORE_API uint8_t*
+dcv_core_prepare_write(dcv_core* core,
+                       size_t size);
+
+DCV_CORE_API dcv_core_status
+dcv_core_commit_write(dcv_core* core);
+
+// Send a serialized ExtensionMessage
+DCV_CORE_API dcv_core_status
+dcv_core_write(dcv_core* core,
+               const void* message,
+               size_t size);
+
+/*
+ * Next serialized DcvMessage, messages set aside by dcv_core_read_response()
+ * first. The message stays valid until the next read on the core.
+ */
+DCV_CORE_API dcv_core_status
+dcv_core_read(dcv_core* core,
+              const uint8_t** message,
+              size_t* size);
+
+/*
+ * The response to request_id; messages read before it are set aside, in
+ * order, for dcv_core_read(). Valid until the next read on the core.
+ */
+DCV_CORE_API dcv_core_status
+dcv_core_read_response(dcv_core* core,
+                       const char* request_id,
+                       const uint8_t** message,
+                       size_t* size);
+
+DCV_CORE_API void
+dcv_core_get_stats(const dcv_core* core,
+                   dcv_core_stats* stats);
+
+// Log the statistics of the core
+DCV_CORE_API void
+dcv_core_log_stats(const dcv_core* core);
+
+/*
+ * Connect to the relay of a virtual channel, a named pipe on Windows and an
+ * abstract unix socket on Linux, and authenticate with the token.
+ */
+DCV_CORE_API dcv_core_status
+dcv_channel_connect(const char* relay_path,
+                    const void* token,
+                    size_t token_size,
+                    dcv_channel** channel);
+
+DCV_CORE_API dcv_core_status
+dcv_channel_write(dcv_channel* channel,
+                  const void* data,
+                  size_t size);
+
+/*
+ * Whatever is available on the channel, at least one byte, into a pooled
+ * buffer. Buffers can be kept and released in any order, from any thread.
+ */
+DCV_CORE_API dcv_core_status
+dcv_channel_receive(dcv_channel* channel,
+                    dcv_buffer* buffer);
+
+DCV_CORE_API void
+dcv_buffer_release(dcv_buffer* buffer);
+
+DCV_CORE_API void
+dcv_channel_close(dcv_channel* channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DCV_EXTENSION_CORE
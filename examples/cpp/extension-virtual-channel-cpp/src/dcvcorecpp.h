@@ -0,0 +1,310 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_CORE_CPP
+#define DCV_EXTENSION_CORE_CPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "dcvcore.h"
+
+namespace dcvext {
+
+/*
+ * Thin C++ side of the protocol core in dcvcore.h: ownership of the core,
+ * channels and buffers, and protobuf messages in place of bytes. Calls
+ * return false on failure and LastStatus() tells why, calls on a core or
+ * channel that is not open fail with DCV_CORE_ERROR_INVALID.
+ */
+
+// Data received on a channel, back to the pool with the object
+class CoreBuffer
+{
+public:
+    CoreBuffer() = default;
+
+    CoreBuffer(CoreBuffer&& other) noexcept
+        : m_buffer(other.m_buffer)
+    {
+        other.m_buffer = dcv_buffer{};
+    }
+
+    CoreBuffer&
+    operator=(CoreBuffer&& other) noexcept
+    {
+        std::swap(m_buffer, other.m_buffer);
+        return *this;
+    }
+
+    CoreBuffer(const CoreBuffer&) = delete;
+    CoreBuffer& operator=(const CoreBuffer&) = delete;
+
+    ~CoreBuffer()
+    {
+        dcv_buffer_release(&m_buffer);
+    }
+
+    const uint8_t*
+    Data() const
+    {
+        return m_buffer.data;
+    }
+
+    size_t
+    Size() const
+    {
+        return m_buffer.size;
+    }
+
+    bool
+    Empty() const
+    {
+        return m_buffer.size == 0;
+    }
+
+private:
+    friend class CoreChannel;
+
+    dcv_buffer m_buffer = {};
+};
+
+class CoreChannel
+{
+public:
+    CoreChannel() = default;
+
+    CoreChannel(const CoreChannel&) = delete;
+    CoreChannel& operator=(const CoreChannel&) = delete;
+
+    ~CoreChannel()
+    {
+        Close();
+    }
+
+    bool
+    Connect(const std::string& relay_path,
+            const std::string& token)
+    {
+        Close();
+        m_status = dcv_channel_connect(relay_path.c_str(), token.data(), token.size(), &m_channel);
+        return m_status == DCV_CORE_OK;
+    }
+
+    bool
+    Write(const void* data,
+          size_t size)
+    {
+        m_status = m_channel != nullptr ? dcv_channel_write(m_channel, data, size) : DCV_CORE_ERROR_INVALID;
+        return m_status == DCV_CORE_OK;
+    }
+
+    // Empty once the channel is closed or failed
+    CoreBuffer
+    Receive()
+    {
+        CoreBuffer buffer;
+        m_status = m_channel != nullptr ? dcv_channel_receive(m_channel, &buffer.m_buffer) : DCV_CORE_ERROR_INVALID;
+        return buffer;
+    }
+
+    void
+    Close()
+    {
+        dcv_channel_close(m_channel);
+        m_channel = nullptr;
+    }
+
+    dcv_core_status
+    LastStatus() const
+    {
+        return m_status;
+    }
+
+private:
+    dcv_channel* m_channel = nullptr;
+    dcv_core_status m_status = DCV_CORE_OK;
+};
+
+class ProtocolCore
+{
+public:
+    ProtocolCore() = default;
+
+    ProtocolCore(const ProtocolCore&) = delete;
+    ProtocolCore& operator=(const ProtocolCore&) = delete;
+
+    ~ProtocolCore()
+    {
+        dcv_core_close(m_core);
+    }
+
+    // Start talking to DCV on stdin and stdout
+    bool
+    Open(size_t max_message = 0)
+    {
+        dcv_core_options options = { sizeof options, max_message };
+
+        dcv_core_close(m_core);
+        m_core = dcv_core_open(&options);
+        m_status = m_core != nullptr ? DCV_CORE_OK : DCV_CORE_ERROR_IO;
+        return m_core != nullptr;
+    }
+
+    std::string
+    NextRequestId()
+    {
+        char id[32];
+
+        m_status = m_core != nullptr ? dcv_core_next_request_id(m_core, id, sizeof id) : DCV_CORE_ERROR_INVALID;
+        return m_status == DCV_CORE_OK ? std::string(id) : std::string();
+    }
+
+    // Serialize an ExtensionMessage into the core and send it
+    template <typename Message>
+    bool
+    Write(const Message& msg)
+    {
+        size_t size = msg.ByteSizeLong();
+        uint8_t* buffer = PrepareWrite(size);
+
+        if (buffer == nullptr) {
+            return false;
+        }
+        if (!msg.SerializeToArray(buffer, static_cast<int>(size))) {
+            m_status = DCV_CORE_ERROR_INVALID;
+            return false;
+        }
+
+        return CommitWrite();
+    }
+
+    // Space for a serialized message of size bytes, sent by CommitWrite()
+    uint8_t*
+    PrepareWrite(size_t size)
+    {
+        if (m_core == nullptr) {
+            m_status = DCV_CORE_ERROR_INVALID;
+            return nullptr;
+        }
+
+        uint8_t* buffer = dcv_core_prepare_write(m_core, size);
+
+        m_status = buffer != nullptr ? DCV_CORE_OK : DCV_CORE_ERROR_NO_MEMORY;
+        return buffer;
+    }
+
+    bool
+    CommitWrite()
+    {
+        m_status = m_core != nullptr ? dcv_core_commit_write(m_core) : DCV_CORE_ERROR_INVALID;
+        return m_status == DCV_CORE_OK;
+    }
+
+    // Next serialized DcvMessage, valid until the next read
+    bool
+    Read(const uint8_t*& data,
+         size_t& size)
+    {
+        m_status = m_core != nullptr ? dcv_core_read(m_core, &data, &size) : DCV_CORE_ERROR_INVALID;
+        return m_status == DCV_CORE_OK;
+    }
+
+    // The response to request_id, messages before it are kept for Read()
+    bool
+    ReadResponse(const std::string& request_id,
+                 const uint8_t*& data,
+                 size_t& size)
+    {
+        m_status = m_core != nullptr ? dcv_core_read_response(m_core, request_id.c_str(), &data, &size)
+                                     : DCV_CORE_ERROR_INVALID;
+        return m_status == DCV_CORE_OK;
+    }
+
+    template <typename Message>
+    bool
+    Read(Message& msg)
+    {
+        const uint8_t* data;
+        size_t size;
+
+        return Read(data, size) && Parse(data, size, msg);
+    }
+
+    template <typename Message>
+    bool
+    ReadResponse(const std::string& request_id,
+                 Message& msg)
+    {
+        const uint8_t* data;
+        size_t size;
+
+        return ReadResponse(request_id, data, size) && Parse(data, size, msg);
+    }
+
+    // All zero until opened
+    dcv_core_stats
+    Stats() const
+    {
+        dcv_core_stats stats = {};
+
+        stats.struct_size = sizeof stats;
+        if (m_core != nullptr) {
+            dcv_core_get_stats(m_core, &stats);
+        }
+        return stats;
+    }
+
+    void
+    LogStats() const
+    {
+        if (m_core != nullptr) {
+            dcv_core_log_stats(m_core);
+        }
+    }
+
+    dcv_core_status
+    LastStatus() const
+    {
+        return m_status;
+    }
+
+private:
+    template <typename Message>
+    bool
+    Parse(const uint8_t* data,
+          size_t size,
+          Message& msg)
+    {
+        if (!msg.ParseFromArray(data, static_cast<int>(size))) {
+            m_status = DCV_CORE_ERROR_INVALID;
+            return false;
+        }
+
+        return true;
+    }
+
+    dcv_core* m_core = nullptr;
+    dcv_core_status m_status = DCV_CORE_OK;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_CORE_CPP
@@ -0,0 +1,460 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "dedup.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include "simplelogger.h"
+
+namespace dcvext {
+
+namespace {
+
+struct GearTable
+{
+    uint64_t values[256];
+};
+
+// splitmix64, any fixed random table works as long as both ends use the same
+constexpr GearTable
+MakeGearTable()
+{
+    GearTable table = {};
+    uint64_t state = 0;
+
+    for (int i = 0; i < 256; ++i) {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        table.values[i] = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+constexpr GearTable GEAR = MakeGearTable();
+
+constexpr uint64_t
+HighBits(int bits)
+{
+    return ~0ull << (64 - bits);
+}
+
+/*
+ * Normalized chunking as in FastCDC: a cut needs more matching bits before
+ * the average size and fewer after it, which keeps chunk sizes close to the
+ * average. The high bits of the gear hash depend on the last 64 bytes.
+ */
+constexpr int AVG_CHUNK_BITS = 13;
+constexpr uint64_t MASK_BEFORE_AVG = HighBits(AVG_CHUNK_BITS + 2);
+constexpr uint64_t MASK_AFTER_AVG = HighBits(AVG_CHUNK_BITS - 2);
+
+static_assert(1 << AVG_CHUNK_BITS == DEDUP_AVG_CHUNK, "chunk masks do not match the average chunk size");
+
+inline uint64_t
+Load64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof value);
+    return value;
+}
+
+inline uint64_t
+Load32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof value);
+    return value;
+}
+
+// Fold of the 128 bit product
+inline uint64_t
+Mum(uint64_t a,
+    uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t a_low = a & 0xffffffff, a_high = a >> 32;
+    uint64_t b_low = b & 0xffffffff, b_high = b >> 32;
+    uint64_t low_low = a_low * b_low, low_high = a_low * b_high;
+    uint64_t high_low = a_high * b_low, high_high = a_high * b_high;
+    uint64_t middle = (low_low >> 32) + (low_high & 0xffffffff) + (high_low & 0xffffffff);
+    uint64_t low = (low_low & 0xffffffff) | (middle << 32);
+    uint64_t high = high_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+constexpr uint64_t HASH_P0 = 0xa0761d6478bd642full;
+constexpr uint64_t HASH_P1 = 0xe7037ed1a0b428dbull;
+constexpr uint64_t HASH_P2 = 0x8ebc6af09c88c6e3ull;
+constexpr uint64_t HASH_P3 = 0x589965cc75374cc3ull;
+
+void
+PutVarint(std::vector<uint8_t>& out,
+          uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool
+GetVarint(const uint8_t*& data,
+          const uint8_t* end,
+          uint64_t& value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+/*
+ * Multiply and fold in the style of wyhash, with two lanes for 128 bits. The
+ * state of a lane is added back after each product, so input that makes a
+ * product zero cannot wipe what came before it. The digest never leaves the
+ * sender, so it does not have to be the same across byte orders.
+ */
+ChunkDigest
+HashChunk(const void* data,
+          size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t lane0 = HASH_P0;
+    uint64_t lane1 = HASH_P3;
+    uint64_t a, b;
+    size_t length = size;
+
+    while (length > 16) {
+        a = Load64(p);
+        b = Load64(p + 8);
+        lane0 = Mum(a ^ lane0 ^ HASH_P1, b ^ HASH_P2) + lane0;
+        lane1 = Mum(a ^ lane1 ^ HASH_P2, b ^ HASH_P3) + lane1;
+        p += 16;
+        length -= 16;
+    }
+
+    if (length >= 8) {
+        a = Load64(p);
+        b = Load64(p + length - 8);
+    } else if (length >= 4) {
+        a = Load32(p);
+        b = Load32(p + length - 4);
+    } else if (length > 0) {
+        a = static_cast<uint64_t>(p[0]) << 16 | static_cast<uint64_t>(p[length >> 1]) << 8 | p[length - 1];
+        b = 0;
+    } else {
+        a = 0;
+        b = 0;
+    }
+
+    ChunkDigest digest;
+    digest.low = Mum(HASH_P1 ^ size, Mum(a ^ lane0 ^ HASH_P1, b ^ HASH_P2) + lane0);
+    digest.high = Mum(HASH_P2 ^ size, Mum(a ^ lane1 ^ HASH_P2, b ^ HASH_P3) + lane1);
+
+    return digest;
+}
+
+size_t
+NextChunkSize(const uint8_t* data,
+              size_t size)
+{
+    if (size <= DEDUP_MIN_CHUNK) {
+        return size;
+    }
+
+    size_t normal = size < DEDUP_AVG_CHUNK ? size : size_t(DEDUP_AVG_CHUNK);
+    size_t limit = size < DEDUP_MAX_CHUNK ? size : size_t(DEDUP_MAX_CHUNK);
+    uint64_t hash = 0;
+    size_t i = DEDUP_MIN_CHUNK;
+
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR.values[data[i]];
+        if ((hash & MASK_BEFORE_AVG) == 0) {
+            return i;
+        }
+    }
+
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + GEAR.values[data[i]];
+        if ((hash & MASK_AFTER_AVG) == 0) {
+            return i;
+        }
+    }
+
+    return limit;
+}
+
+void
+DedupEncoder::Reset(size_t cache_bytes)
+{
+    m_capacity = cache_bytes;
+    m_cached = 0;
+    m_next_id = 0;
+    m_reset_pending = true;
+    m_lru.clear();
+    m_index.clear();
+}
+
+size_t
+DedupEncoder::MaxEncodedSize(size_t size)
+{
+    // Every chunk but the last is at least DEDUP_MIN_CHUNK, each costs an op and a varint
+    const size_t op_size = 1 + 10;
+    size_t chunks = size / DEDUP_MIN_CHUNK + 1;
+
+    return 1 + op_size + size + chunks * op_size;
+}
+
+void
+DedupEncoder::Encode(uint8_t type,
+                     const void* data,
+                     size_t size,
+                     std::vector<uint8_t>& out)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    size_t start = out.size();
+
+    out.push_back(type);
+
+    if (m_reset_pending) {
+        out.push_back(DEDUP_OP_RESET);
+        PutVarint(out, m_capacity);
+        m_reset_pending = false;
+    }
+
+    while (size > 0) {
+        size_t length = NextChunkSize(p, size);
+
+        m_stats.chunks++;
+
+        // The last piece of a message can be short, not worth a cache entry
+        if (length < DEDUP_MIN_CHUNK || length > m_capacity) {
+            out.push_back(DEDUP_OP_RAW);
+            PutVarint(out, length);
+            out.insert(out.end(), p, p + length);
+        } else {
+            ChunkDigest digest = HashChunk(p, length);
+            auto found = m_index.find(digest);
+
+            if (found != m_index.end()) {
+                out.push_back(DEDUP_OP_REF);
+                PutVarint(out, found->second->id);
+                PutVarint(out, length);
+                m_lru.splice(m_lru.begin(), m_lru, found->second);
+                m_stats.chunk_hits++;
+                m_stats.bytes_hit += length;
+            } else {
+                out.push_back(DEDUP_OP_LITERAL);
+                PutVarint(out, length);
+                out.insert(out.end(), p, p + length);
+
+                m_lru.push_front(Entry{ digest, m_next_id++, length });
+                m_index[digest] = m_lru.begin();
+                m_cached += length;
+
+                // Same evictions as the peer, which inserts the same way
+                while (m_cached > m_capacity) {
+                    m_cached -= m_lru.back().size;
+                    m_index.erase(m_lru.back().digest);
+                    m_lru.pop_back();
+                    m_stats.evictions++;
+                }
+            }
+        }
+
+        p += length;
+        size -= length;
+    }
+
+    m_stats.messages++;
+    m_stats.bytes_in += static_cast<uint64_t>(p - static_cast<const uint8_t*>(data));
+    m_stats.bytes_out += out.size() - start;
+}
+
+void
+DedupDecoder::Insert(const uint8_t* data,
+                     size_t size)
+{
+    m_lru.push_front(Entry{ m_next_id++, std::vector<uint8_t>(data, data + size) });
+    m_index[m_lru.front().id] = m_lru.begin();
+    m_cached += size;
+
+    while (m_cached > m_capacity) {
+        m_cached -= m_lru.back().data.size();
+        m_index.erase(m_lru.back().id);
+        m_lru.pop_back();
+        m_stats.evictions++;
+    }
+}
+
+bool
+DedupDecoder::Decode(const uint8_t* data,
+                     size_t size,
+                     size_t max_size,
+                     uint8_t& type,
+                     std::vector<uint8_t>& out,
+                     char* error)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+
+    out.clear();
+
+    if (p == end) {
+        snprintf(error, 128, "empty message");
+        return false;
+    }
+    type = *p++;
+
+    while (p < end) {
+        uint8_t op = *p++;
+        uint64_t value;
+
+        if (!GetVarint(p, end, value)) {
+            snprintf(error, 128, "truncated op %u", op);
+            return false;
+        }
+
+        switch (op) {
+        case DEDUP_OP_RESET:
+            if (value > m_max_capacity) {
+                snprintf(error, 128, "peer asks for a cache of %llu bytes, the limit is %zu",
+                         static_cast<unsigned long long>(value), m_max_capacity);
+                return false;
+            }
+            m_capacity = static_cast<size_t>(value);
+            m_cached = 0;
+            m_next_id = 0;
+            m_reset = true;
+            m_lru.clear();
+            m_index.clear();
+            break;
+
+        case DEDUP_OP_LITERAL:
+        case DEDUP_OP_RAW:
+            if (value > static_cast<uint64_t>(end - p)) {
+                snprintf(error, 128, "chunk of %llu bytes past the end", static_cast<unsigned long long>(value));
+                return false;
+            }
+            if (out.size() + value > max_size) {
+                snprintf(error, 128, "message larger than %zu bytes", max_size);
+                return false;
+            }
+            if (op == DEDUP_OP_LITERAL) {
+                if (!m_reset) {
+                    snprintf(error, 128, "chunk before the cache was set up");
+                    return false;
+                }
+                Insert(p, static_cast<size_t>(value));
+            }
+            out.insert(out.end(), p, p + value);
+            p += value;
+            m_stats.chunks++;
+            break;
+
+        case DEDUP_OP_REF: {
+            uint64_t length;
+            if (!GetVarint(p, end, length)) {
+                snprintf(error, 128, "truncated op %u", op);
+                return false;
+            }
+
+            auto found = m_index.find(value);
+            if (found == m_index.end()) {
+                snprintf(error, 128, "reference to chunk %llu which is not cached, caches out of sync",
+                         static_cast<unsigned long long>(value));
+                return false;
+            }
+
+            const std::vector<uint8_t>& chunk = found->second->data;
+            if (chunk.size() != length) {
+                snprintf(error, 128, "chunk %llu holds %zu bytes, the reference is to %llu, caches out of sync",
+                         static_cast<unsigned long long>(value), chunk.size(), static_cast<unsigned long long>(length));
+                return false;
+            }
+            if (out.size() + chunk.size() > max_size) {
+                snprintf(error, 128, "message larger than %zu bytes", max_size);
+                return false;
+            }
+
+            out.insert(out.end(), chunk.begin(), chunk.end());
+            m_lru.splice(m_lru.begin(), m_lru, found->second);
+            m_stats.chunks++;
+            m_stats.chunk_hits++;
+            m_stats.bytes_hit += chunk.size();
+            break;
+        }
+
+        default:
+            snprintf(error, 128, "unknown op %u", op);
+            return false;
+        }
+    }
+
+    m_stats.messages++;
+    m_stats.bytes_in += out.size();
+    m_stats.bytes_out += size;
+
+    return true;
+}
+
+void
+LogDedupStats(const char* name,
+              const DedupStats& stats)
+{
+    log_f("%s: %llu messages, %llu bytes, %llu on the wire (%.1f%% saved), %llu chunks, %.1f%% hits, "
+          "%llu evictions",
+          name,
+          static_cast<unsigned long long>(stats.messages),
+          static_cast<unsigned long long>(stats.bytes_in),
+          static_cast<unsigned long long>(stats.bytes_out),
+          stats.bytes_in > stats.bytes_out
+              ? 100.0 * static_cast<double>(stats.bytes_in - stats.bytes_out) / static_cast<double>(stats.bytes_in)
+              : 0.0,
+          static_cast<unsigned long long>(stats.chunks),
+          stats.chunks != 0 ? 100.0 * static_cast<double>(stats.chunk_hits) / static_cast<double>(stats.chunks) : 0.0,
+          static_cast<unsigned long long>(stats.evictions));
+}
+
+} // namespace dcvext
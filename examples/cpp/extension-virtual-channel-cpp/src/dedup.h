@@ -0,0 +1,218 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_DEDUP
+#define DCV_EXTENSION_DEDUP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace dcvext {
+
+/*
+ * Deduplication of repeated payloads. Messages are cut into chunks where
+ * their content says so (a gear rolling hash, boundaries move with inserted
+ * or removed bytes instead of shifting every chunk after them), and chunks
+ * are identified by a 128 bit hash of their content.
+ *
+ * The receiver keeps the data of the last chunks it got in an LRU cache of a
+ * size picked by the sender. The sender keeps a mirror of that cache without
+ * the data: both apply the same insertions, touches and evictions in the
+ * same order, so the sender knows exactly which chunks the receiver holds
+ * and sends those as a reference to their insertion number.
+ *
+ * Encoded message:
+ *
+ *   frame type of the original message
+ *   ops until the end:
+ *     DEDUP_OP_RESET    varint cache size, the receiver starts over empty
+ *     DEDUP_OP_LITERAL  varint length, data, inserted into the cache
+ *     DEDUP_OP_REF      varint insertion number of a cached chunk, varint
+ *                       its length, which the receiver checks
+ *     DEDUP_OP_RAW      varint length, data, not cached
+ */
+enum
+{
+    DEDUP_OP_RESET = 0,
+    DEDUP_OP_LITERAL = 1,
+    DEDUP_OP_REF = 2,
+    DEDUP_OP_RAW = 3,
+    DEDUP_MIN_CHUNK = 2 * 1024,
+    DEDUP_AVG_CHUNK = 8 * 1024,
+    DEDUP_MAX_CHUNK = 64 * 1024
+};
+
+struct ChunkDigest
+{
+    uint64_t low;
+    uint64_t high;
+
+    bool
+    operator==(const ChunkDigest& other) const
+    {
+        return low == other.low && high == other.high;
+    }
+};
+
+ChunkDigest
+HashChunk(const void* data,
+          size_t size);
+
+// Length of the first chunk of data, DEDUP_MIN_CHUNK to DEDUP_MAX_CHUNK bytes or all of it
+size_t
+NextChunkSize(const uint8_t* data,
+              size_t size);
+
+struct DedupStats
+{
+    uint64_t messages = 0;
+    uint64_t bytes_in = 0;          // before encoding or after decoding
+    uint64_t bytes_out = 0;         // on the wire
+    uint64_t chunks = 0;
+    uint64_t chunk_hits = 0;        // chunks sent or received as references
+    uint64_t bytes_hit = 0;         // size of those chunks
+    uint64_t evictions = 0;
+};
+
+// The sending side: encodes messages against a mirror of the peer cache
+class DedupEncoder
+{
+public:
+    DedupEncoder() = default;
+
+    DedupEncoder(const DedupEncoder&) = delete;
+    DedupEncoder& operator=(const DedupEncoder&) = delete;
+
+    // Start over with a cache of cache_bytes, the next message tells the peer
+    void
+    Reset(size_t cache_bytes);
+
+    /*
+     * Largest encoding of a message of size bytes, whatever the cache holds.
+     * Checked before Encode(), which updates the mirror of the peer cache
+     * and cannot be taken back.
+     */
+    static size_t
+    MaxEncodedSize(size_t size);
+
+    // Append the encoded message to out
+    void
+    Encode(uint8_t type,
+           const void* data,
+           size_t size,
+           std::vector<uint8_t>& out);
+
+    const DedupStats&
+    Stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Entry
+    {
+        ChunkDigest digest;
+        uint64_t id;
+        size_t size;
+    };
+
+    struct DigestHash
+    {
+        size_t
+        operator()(const ChunkDigest& digest) const
+        {
+            return static_cast<size_t>(digest.low);
+        }
+    };
+
+    size_t m_capacity = 0;
+    size_t m_cached = 0;
+    uint64_t m_next_id = 0;
+    bool m_reset_pending = false;
+    std::list<Entry> m_lru;     // most recently used first
+    std::unordered_map<ChunkDigest, std::list<Entry>::iterator, DigestHash> m_index;
+    DedupStats m_stats;
+};
+
+// The receiving side: holds the chunk data the peer refers to
+class DedupDecoder
+{
+public:
+    DedupDecoder() = default;
+
+    DedupDecoder(const DedupDecoder&) = delete;
+    DedupDecoder& operator=(const DedupDecoder&) = delete;
+
+    // Largest cache a peer may ask for, a larger request fails decoding
+    void
+    SetMaxCacheBytes(size_t max_cache_bytes)
+    {
+        m_max_capacity = max_cache_bytes;
+    }
+
+    /*
+     * Decode a message into out, replacing its contents. Fails on malformed
+     * input, on a message larger than max_size and on a reference to a chunk
+     * that is not cached, which means the two ends are out of sync. The
+     * reason is described in error, which must hold at least 128 bytes.
+     */
+    bool
+    Decode(const uint8_t* data,
+           size_t size,
+           size_t max_size,
+           uint8_t& type,
+           std::vector<uint8_t>& out,
+           char* error);
+
+    const DedupStats&
+    Stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t id;
+        std::vector<uint8_t> data;
+    };
+
+    void
+    Insert(const uint8_t* data,
+           size_t size);
+
+    size_t m_max_capacity = 0;
+    size_t m_capacity = 0;
+    size_t m_cached = 0;
+    uint64_t m_next_id = 0;
+    bool m_reset = false;
+    std::list<Entry> m_lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    DedupStats m_stats;
+};
+
+void
+LogDedupStats(const char* name,
+              const DedupStats& stats);
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_DEDUP
@@ -0,0 +1,824 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "eventloop.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#include "simplelogger.h"
+
+namespace dcvext {
+
+namespace {
+
+enum
+{
+    MAX_EVENTS_PER_POLL = 64
+};
+
+bool
+TimerLater(const TimerNode* a,
+           const TimerNode* b)
+{
+    return a->deadline > b->deadline;
+}
+
+// Tell the core we are spinning, which frees resources for a sibling hyperthread
+inline void
+CpuRelax()
+{
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+#ifdef _WIN32
+
+/*
+ * Anonymous pipes (the standard streams DCV gives us) cannot be opened for
+ * overlapped IO, so reads on them are run by a helper thread which posts
+ * the result to the completion port as if it were a real completion.
+ */
+struct BlockingHelper
+{
+    HANDLE thread;
+    HANDLE wake_event;
+    HANDLE iocp;
+    IoOperation* volatile op;
+    volatile bool stop;
+};
+
+DWORD WINAPI
+BlockingHelperMain(LPVOID param)
+{
+    auto helper = static_cast<BlockingHelper*>(param);
+
+    while (true) {
+        WaitForSingleObject(helper->wake_event, INFINITE);
+        if (helper->stop) {
+            break;
+        }
+
+        IoOperation* op = helper->op;
+        DWORD bytes = 0;
+
+        if (!ReadFile(op->io->handle, op->buffer, static_cast<DWORD>(std::min<size_t>(op->length, MAXDWORD)),
+                      &bytes, nullptr)) {
+            op->error = GetLastError();
+        }
+
+        PostQueuedCompletionStatus(helper->iocp, bytes, 0, &op->overlapped);
+    }
+
+    return 0;
+}
+
+bool
+IsEndOfStream(DWORD error)
+{
+    return error == ERROR_BROKEN_PIPE || error == ERROR_HANDLE_EOF || error == ERROR_PIPE_NOT_CONNECTED;
+}
+
+// Returns true if the operation failed synchronously
+bool
+IssueOverlapped(IoOperation& op)
+{
+    memset(&op.overlapped, 0, sizeof op.overlapped);
+
+    DWORD remaining = static_cast<DWORD>(std::min<size_t>(op.length - op.transferred, MAXDWORD));
+    BOOL res = op.write
+        ? WriteFile(op.io->handle, op.buffer + op.transferred, remaining, nullptr, &op.overlapped)
+        : ReadFile(op.io->handle, op.buffer, remaining, nullptr, &op.overlapped);
+
+    if (res || GetLastError() == ERROR_IO_PENDING) {
+        // A completion packet is queued in both cases
+        return false;
+    }
+
+    op.error = GetLastError();
+    if (!op.write && IsEndOfStream(op.error)) {
+        op.error = 0;
+    }
+
+    return true;
+}
+
+bool
+WriteInline(IoOperation& op)
+{
+    while (op.transferred < op.length) {
+        DWORD written = 0;
+        DWORD remaining = static_cast<DWORD>(std::min<size_t>(op.length - op.transferred, MAXDWORD));
+
+        if (!WriteFile(op.io->handle, op.buffer + op.transferred, remaining, &written, nullptr)) {
+            op.error = GetLastError();
+            break;
+        }
+
+        op.transferred += written;
+    }
+
+    return true;
+}
+
+#else
+
+// Returns true once the operation is complete, false if it would block
+bool
+TryIo(IoOperation& op)
+{
+    int fd = op.io->handle;
+
+    while (!op.write || op.transferred < op.length) {
+        ssize_t res;
+
+        if (op.write) {
+            res = op.io->socket
+                ? send(fd, op.buffer + op.transferred, op.length - op.transferred, MSG_NOSIGNAL)
+                : write(fd, op.buffer + op.transferred, op.length - op.transferred);
+        } else {
+            res = op.io->socket ? recv(fd, op.buffer, op.length, 0) : read(fd, op.buffer, op.length);
+        }
+
+        if (res >= 0) {
+            op.transferred += static_cast<size_t>(res);
+            if (!op.write || res == 0) {
+                return true;
+            }
+            continue;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+
+        op.error = static_cast<uint32_t>(errno);
+        return true;
+    }
+
+    return true;
+}
+
+#endif
+
+} // namespace
+
+IoAwaiter::IoAwaiter(EventLoop& loop,
+                     IoObject& object,
+                     const void* data,
+                     size_t size,
+                     bool is_write)
+    : m_loop(loop)
+{
+    io = &object;
+    buffer = static_cast<uint8_t*>(const_cast<void*>(data));
+    length = size;
+    transferred = 0;
+    error = 0;
+    write = is_write;
+}
+
+bool
+IoAwaiter::await_ready()
+{
+    return m_loop.StartIo(*this);
+}
+
+void
+SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    waiter = handle;
+    m_loop.AddTimer(this);
+}
+
+void
+YieldAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_loop.Post(handle);
+}
+
+EventLoop::EventLoop()
+{
+    m_ready.reserve(MAX_EVENTS_PER_POLL);
+    m_running.reserve(MAX_EVENTS_PER_POLL);
+    m_timers.reserve(MAX_EVENTS_PER_POLL);
+
+#ifdef _WIN32
+    m_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (m_iocp == nullptr) {
+        log_f("Could not create completion port: 0x%X", GetLastError());
+    }
+#else
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0) {
+        log_f("Could not create epoll instance: %i", errno);
+        return;
+    }
+
+    /*
+     * Timers go through a timerfd rather than the epoll_wait() timeout, which
+     * only has millisecond resolution.
+     */
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd < 0) {
+        log_f("Could not create timer: %i", errno);
+        return;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_timer_fd, &ev) != 0) {
+        log_f("Could not register timer: %i", errno);
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0) {
+        log_f("Could not create wake up event: %i", errno);
+        return;
+    }
+
+    ev.data.ptr = &m_wake_fd;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake_fd, &ev) != 0) {
+        log_f("Could not register wake up event: %i", errno);
+    }
+#endif
+}
+
+EventLoop::~EventLoop()
+{
+#ifdef _WIN32
+    if (m_iocp != nullptr) {
+        CloseHandle(m_iocp);
+    }
+#else
+    if (m_wake_fd >= 0) {
+        close(m_wake_fd);
+    }
+    if (m_timer_fd >= 0) {
+        close(m_timer_fd);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+#endif
+}
+
+bool
+EventLoop::IsValid() const
+{
+#ifdef _WIN32
+    return m_iocp != nullptr;
+#else
+    return m_epoll >= 0 && m_timer_fd >= 0 && m_wake_fd >= 0;
+#endif
+}
+
+bool
+EventLoop::Register(IoObject& io)
+{
+#ifdef _WIN32
+    if (io.blocking) {
+        auto helper = new BlockingHelper();
+
+        helper->iocp = m_iocp;
+        helper->op = nullptr;
+        helper->stop = false;
+        helper->wake_event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+        helper->thread = CreateThread(nullptr, 0, BlockingHelperMain, helper, 0, nullptr);
+
+        if (helper->wake_event == nullptr || helper->thread == nullptr) {
+            log_f("Could not start IO helper thread: 0x%X", GetLastError());
+            if (helper->wake_event != nullptr) {
+                CloseHandle(helper->wake_event);
+            }
+            delete helper;
+            return false;
+        }
+
+        io.helper = helper;
+        return true;
+    }
+
+    if (CreateIoCompletionPort(io.handle, m_iocp, 0, 0) == nullptr) {
+        log_f("Could not associate handle with completion port: 0x%X", GetLastError());
+        return false;
+    }
+
+    return true;
+#else
+    if (io.blocking) {
+        return true;
+    }
+
+    int flags = fcntl(io.handle, F_GETFL);
+    fcntl(io.handle, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &io;
+
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, io.handle, &ev) != 0) {
+        if (errno == EPERM) {
+            // Regular files are always ready, just do blocking IO on them
+            fcntl(io.handle, F_SETFL, flags);
+            io.blocking = true;
+            return true;
+        }
+
+        log_f("Could not register handle with epoll: %i", errno);
+        return false;
+    }
+
+    m_objects.push_back(&io);
+
+    return true;
+#endif
+}
+
+void
+EventLoop::Unregister(IoObject& io)
+{
+#ifdef _WIN32
+    auto helper = static_cast<BlockingHelper*>(io.helper);
+
+    if (helper != nullptr) {
+        helper->stop = true;
+        CancelSynchronousIo(helper->thread);
+        SetEvent(helper->wake_event);
+        WaitForSingleObject(helper->thread, INFINITE);
+        CloseHandle(helper->thread);
+        CloseHandle(helper->wake_event);
+        delete helper;
+        io.helper = nullptr;
+    }
+#else
+    if (!io.blocking) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, io.handle, nullptr);
+        m_objects.erase(std::remove(m_objects.begin(), m_objects.end(), &io), m_objects.end());
+    }
+#endif
+
+    io.pending_read = nullptr;
+    io.pending_write = nullptr;
+}
+
+bool
+EventLoop::StartIo(IoOperation& op)
+{
+    IoObject& io = *op.io;
+
+#ifdef _WIN32
+    if (io.blocking) {
+        if (op.write) {
+            WriteInline(op);
+            op.completed = Clock::now();
+            return true;
+        }
+
+        auto helper = static_cast<BlockingHelper*>(io.helper);
+        memset(&op.overlapped, 0, sizeof op.overlapped);
+        io.pending_read = &op;
+        helper->op = &op;
+        SetEvent(helper->wake_event);
+        return false;
+    }
+
+    if (op.write && op.length == 0) {
+        op.completed = Clock::now();
+        return true;
+    }
+
+    if (IssueOverlapped(op)) {
+        op.completed = Clock::now();
+        return true;
+    }
+#else
+    if (TryIo(op)) {
+        op.completed = Clock::now();
+        return true;
+    }
+#endif
+
+    if (op.write) {
+        io.pending_write = &op;
+    } else {
+        io.pending_read = &op;
+    }
+
+    return false;
+}
+
+void
+EventLoop::AddTimer(TimerNode* timer)
+{
+    m_timers.push_back(timer);
+    std::push_heap(m_timers.begin(), m_timers.end(), TimerLater);
+}
+
+bool
+EventLoop::CancelTimer(TimerNode* timer)
+{
+    // Only a handful of timers are ever pending, a linear search is fine
+    auto it = std::find(m_timers.begin(), m_timers.end(), timer);
+    if (it == m_timers.end()) {
+        return false;
+    }
+
+    m_timers.erase(it);
+    std::make_heap(m_timers.begin(), m_timers.end(), TimerLater);
+
+    return true;
+}
+
+void
+EventLoop::Post(std::coroutine_handle<> handle)
+{
+    m_ready.push_back(handle);
+}
+
+void
+EventLoop::PostFromThread(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_remote_lock);
+        m_remote.push_back(handle);
+    }
+
+    // One wake up is enough for everything posted before the loop gets to it
+    if (m_remote_posted.exchange(true)) {
+        return;
+    }
+
+#ifdef _WIN32
+    PostQueuedCompletionStatus(m_iocp, 0, 0, nullptr);
+#else
+    uint64_t one = 1;
+    ssize_t res = write(m_wake_fd, &one, sizeof one);
+    (void)res;
+#endif
+}
+
+void
+EventLoop::TakeRemote()
+{
+    if (!m_remote_posted.load(std::memory_order_acquire)) {
+        return;
+    }
+
+#ifndef _WIN32
+    uint64_t count;
+    ssize_t res = read(m_wake_fd, &count, sizeof count);
+    (void)res;
+#endif
+
+    m_remote_posted.store(false);
+
+    std::lock_guard<std::mutex> lock(m_remote_lock);
+    m_ready.insert(m_ready.end(), m_remote.begin(), m_remote.end());
+    m_remote.clear();
+}
+
+void
+EventLoop::Stop()
+{
+    m_stop = true;
+}
+
+void
+EventLoop::Run()
+{
+    m_stop = false;
+
+    while (!m_stop) {
+        RunReady();
+        RunTimers();
+
+        if (m_stop) {
+            break;
+        }
+
+        if (!m_ready.empty()) {
+            Poll(false);
+        } else if (!m_busy_poll.enabled) {
+            Poll(true);
+        } else if (!Spin()) {
+            Clock::time_point parked = Clock::now();
+
+            Poll(true);
+            m_busy_stats.parks++;
+
+            // Spinning a little longer would have saved this wake up (timers are not run yet)
+            if (!m_ready.empty() && Clock::now() - parked <= m_busy_poll.max_spin) {
+                m_busy_stats.quick_wakes++;
+                m_busy_stats.spin_budget = std::min(m_busy_stats.spin_budget * 2, m_busy_poll.max_spin);
+            }
+        }
+
+        TakeRemote();
+    }
+}
+
+bool
+EventLoop::Spin()
+{
+    Clock::time_point start = Clock::now();
+    Clock::time_point now = start;
+    Clock::time_point deadline = start + m_busy_stats.spin_budget;
+    bool hit = false;
+
+    m_busy_stats.spins++;
+
+    while (!hit) {
+#ifdef _WIN32
+        Poll(false);
+        now = Clock::now();
+        hit = !m_ready.empty();
+#else
+        // Straight to the sockets, epoll_wait() costs more than the reads
+        for (IoObject* io : m_objects) {
+            if (io->pending_read != nullptr && TryIo(*io->pending_read)) {
+                io->pending_read->completed = Clock::now();
+                m_ready.push_back(io->pending_read->waiter);
+                io->pending_read = nullptr;
+                hit = true;
+            }
+            if (io->pending_write != nullptr && TryIo(*io->pending_write)) {
+                io->pending_write->completed = Clock::now();
+                m_ready.push_back(io->pending_write->waiter);
+                io->pending_write = nullptr;
+                hit = true;
+            }
+        }
+        now = Clock::now();
+#endif
+
+        if (m_remote_posted.load(std::memory_order_relaxed)
+            || (!m_timers.empty() && m_timers.front()->deadline <= now)) {
+            hit = true;
+        }
+
+        if (hit || now >= deadline) {
+            break;
+        }
+
+        CpuRelax();
+    }
+
+    m_busy_stats.spin_time += now - start;
+
+    if (hit) {
+        m_busy_stats.spin_hits++;
+    } else {
+        m_busy_stats.spin_budget = std::max(m_busy_stats.spin_budget / 2, m_busy_poll.min_spin);
+    }
+
+    return hit;
+}
+
+bool
+EventLoop::SetBusyPoll(const BusyPollOptions& options)
+{
+    m_busy_poll = options;
+    m_busy_stats.spin_budget = options.max_spin;
+
+    // Whoever would write the data cannot run while we spin
+    if (options.enabled && std::thread::hardware_concurrency() == 1) {
+        log_f("Busy polling disabled, there is a single CPU");
+        m_busy_poll.enabled = false;
+    }
+
+    if (options.cpu < 0) {
+        return true;
+    }
+
+#ifdef _WIN32
+    if (options.cpu >= 64 || SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << options.cpu) == 0) {
+        log_f("Could not pin the event loop to CPU %i: 0x%X", options.cpu, GetLastError());
+        return false;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(options.cpu, &set);
+
+    if (sched_setaffinity(0, sizeof set, &set) != 0) {
+        log_f("Could not pin the event loop to CPU %i: %i", options.cpu, errno);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void
+EventLoop::LogBusyPollStats() const
+{
+    const BusyPollStats& stats = m_busy_stats;
+
+    log_f("Busy poll: %llu spins, %.1f%% found work, %.3f ms spinning, %llu parks, %llu woken within the "
+          "spin limit, budget %lld us",
+          static_cast<unsigned long long>(stats.spins),
+          stats.spins != 0 ? 100.0 * static_cast<double>(stats.spin_hits) / static_cast<double>(stats.spins) : 0.0,
+          std::chrono::duration<double, std::milli>(stats.spin_time).count(),
+          static_cast<unsigned long long>(stats.parks),
+          static_cast<unsigned long long>(stats.quick_wakes),
+          static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(stats.spin_budget).count()));
+}
+
+void
+EventLoop::RunReady()
+{
+    m_running.swap(m_ready);
+
+    for (std::coroutine_handle<> handle : m_running) {
+        handle.resume();
+    }
+
+    m_running.clear();
+}
+
+void
+EventLoop::RunTimers()
+{
+    Clock::time_point now = Clock::now();
+
+    while (!m_timers.empty() && m_timers.front()->deadline <= now) {
+        TimerNode* timer = m_timers.front();
+
+        std::pop_heap(m_timers.begin(), m_timers.end(), TimerLater);
+        m_timers.pop_back();
+
+        if (timer->callback != nullptr) {
+            timer->callback(timer);
+        } else {
+            m_ready.push_back(timer->waiter);
+        }
+    }
+}
+
+#ifdef _WIN32
+
+void
+EventLoop::Poll(bool block)
+{
+    OVERLAPPED_ENTRY entries[MAX_EVENTS_PER_POLL];
+    ULONG count = 0;
+    DWORD timeout = block ? INFINITE : 0;
+
+    if (block && !m_timers.empty()) {
+        auto wait = std::chrono::ceil<std::chrono::milliseconds>(m_timers.front()->deadline - Clock::now());
+        timeout = static_cast<DWORD>(std::max<long long>(wait.count(), 0));
+    }
+
+    if (!GetQueuedCompletionStatusEx(m_iocp, entries, MAX_EVENTS_PER_POLL, &count, timeout, FALSE)) {
+        if (GetLastError() != WAIT_TIMEOUT) {
+            log_f("GetQueuedCompletionStatusEx failed with error 0x%X", GetLastError());
+        }
+        return;
+    }
+
+    for (ULONG i = 0; i < count; ++i) {
+        if (entries[i].lpOverlapped == nullptr) {
+            continue;
+        }
+
+        IoOperation& op = *CONTAINING_RECORD(entries[i].lpOverlapped, IoOperation, overlapped);
+        IoObject& io = *op.io;
+        DWORD bytes = entries[i].dwNumberOfBytesTransferred;
+
+        if (!io.blocking && !GetOverlappedResult(io.handle, &op.overlapped, &bytes, FALSE)) {
+            op.error = GetLastError();
+        }
+
+        op.transferred += bytes;
+
+        if (!op.write && IsEndOfStream(op.error)) {
+            op.error = 0;
+        }
+
+        if (op.write && op.error == 0 && op.transferred < op.length && !IssueOverlapped(op)) {
+            // Partial write, the rest is in flight
+            continue;
+        }
+
+        if (op.write) {
+            io.pending_write = nullptr;
+        } else {
+            io.pending_read = nullptr;
+        }
+
+        op.completed = Clock::now();
+        m_ready.push_back(op.waiter);
+    }
+}
+
+#else
+
+void
+EventLoop::Poll(bool block)
+{
+    epoll_event events[MAX_EVENTS_PER_POLL];
+
+    if (block && !m_timers.empty() && m_timers.front()->deadline != m_armed_deadline) {
+        auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m_timers.front()->deadline.time_since_epoch());
+        itimerspec spec = {};
+
+        spec.it_value.tv_sec = static_cast<time_t>(since_epoch.count() / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(since_epoch.count() % 1000000000);
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+
+        timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        m_armed_deadline = m_timers.front()->deadline;
+    }
+
+    int count = epoll_wait(m_epoll, events, MAX_EVENTS_PER_POLL, block ? -1 : 0);
+    if (count < 0) {
+        if (errno != EINTR) {
+            log_f("epoll_wait failed with error %i", errno);
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        auto io = static_cast<IoObject*>(events[i].data.ptr);
+        uint32_t ev = events[i].events;
+
+        if (events[i].data.ptr == &m_wake_fd) {
+            continue;
+        }
+
+        if (io == nullptr) {
+            uint64_t expirations;
+            ssize_t res = read(m_timer_fd, &expirations, sizeof expirations);
+            (void)res;
+            m_armed_deadline = Clock::time_point::max();
+            continue;
+        }
+
+        if (io->pending_read != nullptr && (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            IoOperation* op = io->pending_read;
+            if (TryIo(*op)) {
+                io->pending_read = nullptr;
+                op->completed = Clock::now();
+                m_ready.push_back(op->waiter);
+            }
+        }
+
+        if (io->pending_write != nullptr && (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+            IoOperation* op = io->pending_write;
+            if (TryIo(*op)) {
+                io->pending_write = nullptr;
+                op->completed = Clock::now();
+                m_ready.push_back(op->waiter);
+            }
+        }
+    }
+}
+
+#endif
+
+} // namespace dcvext
@@ -0,0 +1,365 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_EVENT_LOOP
+#define DCV_EXTENSION_EVENT_LOOP
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace dcvext {
+
+#ifdef _WIN32
+typedef HANDLE NativeHandle;
+#else
+typedef int NativeHandle;
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+struct IoOperation;
+
+/*
+ * A handle registered with an EventLoop. At most one read and one write can
+ * be outstanding on it at any time.
+ */
+struct IoObject
+{
+    NativeHandle handle;
+
+    // Set for handles that cannot be polled (stdin/stdout redirected to
+    // files, anonymous pipes on Windows): reads run on a helper thread on
+    // Windows and inline everywhere else, writes always run inline
+    bool blocking = false;
+
+    // Set for relay sockets, so that writes do not raise SIGPIPE
+    bool socket = false;
+
+    IoOperation* pending_read = nullptr;
+    IoOperation* pending_write = nullptr;
+    void* helper = nullptr;
+};
+
+struct IoResult
+{
+    size_t bytes;       // 0 on a read means end of stream
+    uint32_t error;     // errno or GetLastError(), 0 on success
+
+    bool
+    Ok() const
+    {
+        return error == 0;
+    }
+};
+
+/*
+ * A single read or write. Operations live inside the awaiter, and so inside
+ * the awaiting coroutine frame: starting one never allocates.
+ */
+struct IoOperation
+{
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+#endif
+    IoObject* io;
+    uint8_t* buffer;
+    size_t length;
+    size_t transferred;
+    uint32_t error;
+    bool write;
+    std::coroutine_handle<> waiter;
+
+    // When the loop saw the operation complete
+    Clock::time_point completed;
+};
+
+struct TimerNode
+{
+    Clock::time_point deadline;
+    std::coroutine_handle<> waiter;
+
+    // Called on expiry instead of resuming waiter when set
+    void (*callback)(TimerNode* timer) = nullptr;
+};
+
+/*
+ * Busy polling: rather than blocking in epoll or the completion port as soon
+ * as nothing is ready to run, the loop keeps retrying its pending reads and
+ * writes for a while, which saves the wake up of a blocked thread when data
+ * arrives soon after. The spin budget adapts between min_spin and max_spin:
+ * it halves when a spin runs out and doubles when work turned up during a
+ * spin or within max_spin of blocking. A spinning loop keeps its core busy,
+ * and on a single CPU machine it only delays the writer, so it never spins
+ * there.
+ */
+struct BusyPollOptions
+{
+    bool enabled = false;
+    // Pin the thread running the loop to this CPU, -1 to leave it alone
+    int cpu = -1;
+    Clock::duration min_spin = std::chrono::microseconds(5);
+    Clock::duration max_spin = std::chrono::microseconds(100);
+};
+
+struct BusyPollStats
+{
+    uint64_t spins = 0;             // times the loop spun before blocking
+    uint64_t spin_hits = 0;         // of those, ended by work to do
+    uint64_t parks = 0;             // times the loop blocked
+    uint64_t quick_wakes = 0;       // of those, woken within max_spin
+    Clock::duration spin_time{};    // total time spent spinning
+    Clock::duration spin_budget{};  // the current budget
+};
+
+class EventLoop;
+
+class IoAwaiter : public IoOperation
+{
+public:
+    IoAwaiter(EventLoop& loop,
+              IoObject& io,
+              const void* buffer,
+              size_t length,
+              bool is_write);
+
+    bool
+    await_ready();
+
+    void
+    await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+        waiter = handle;
+    }
+
+    IoResult
+    await_resume() const noexcept
+    {
+        return { transferred, error };
+    }
+
+private:
+    EventLoop& m_loop;
+};
+
+class SleepAwaiter : public TimerNode
+{
+public:
+    SleepAwaiter(EventLoop& loop,
+                 Clock::time_point when)
+        : m_loop(loop)
+    {
+        deadline = when;
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return deadline <= Clock::now();
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle);
+
+    void
+    await_resume() const noexcept
+    {
+    }
+
+private:
+    EventLoop& m_loop;
+};
+
+class YieldAwaiter
+{
+public:
+    explicit YieldAwaiter(EventLoop& loop)
+        : m_loop(loop)
+    {
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle);
+
+    void
+    await_resume() const noexcept
+    {
+    }
+
+private:
+    EventLoop& m_loop;
+};
+
+/*
+ * Single-threaded event loop driving coroutines: IOCP on Windows, epoll on
+ * Linux. All resumptions happen on the thread calling Run().
+ */
+class EventLoop
+{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool
+    IsValid() const;
+
+    bool
+    Register(IoObject& io);
+
+    void
+    Unregister(IoObject& io);
+
+    // Read up to length bytes, completes as soon as some data is available
+    IoAwaiter
+    Read(IoObject& io,
+         void* buffer,
+         size_t length)
+    {
+        return IoAwaiter(*this, io, buffer, length, false);
+    }
+
+    // Write all of the buffer, completes when everything is written or on error
+    IoAwaiter
+    Write(IoObject& io,
+          const void* buffer,
+          size_t length)
+    {
+        return IoAwaiter(*this, io, buffer, length, true);
+    }
+
+    SleepAwaiter
+    Sleep(Clock::duration duration)
+    {
+        return SleepAwaiter(*this, Clock::now() + duration);
+    }
+
+    SleepAwaiter
+    SleepUntil(Clock::time_point deadline)
+    {
+        return SleepAwaiter(*this, deadline);
+    }
+
+    // Let other ready coroutines run before continuing
+    YieldAwaiter
+    Reschedule()
+    {
+        return YieldAwaiter(*this);
+    }
+
+    // Queue a coroutine to be resumed on the next loop iteration
+    void
+    Post(std::coroutine_handle<> handle);
+
+    // Same as Post() from any thread, wakes the loop up if it is waiting
+    void
+    PostFromThread(std::coroutine_handle<> handle);
+
+    // Run until Stop() is called
+    void
+    Run();
+
+    void
+    Stop();
+
+    // Start an operation, returns true if it completed synchronously
+    bool
+    StartIo(IoOperation& op);
+
+    void
+    AddTimer(TimerNode* timer);
+
+    // Returns false if the timer already fired or was never added
+    bool
+    CancelTimer(TimerNode* timer);
+
+    // Call on the thread that runs the loop, false if it could not be pinned
+    bool
+    SetBusyPoll(const BusyPollOptions& options);
+
+    const BusyPollStats&
+    GetBusyPollStats() const
+    {
+        return m_busy_stats;
+    }
+
+    void
+    LogBusyPollStats() const;
+
+private:
+    void
+    RunReady();
+
+    void
+    RunTimers();
+
+    void
+    Poll(bool block);
+
+    void
+    TakeRemote();
+
+    // Spin for up to the budget, true if something is ready to run
+    bool
+    Spin();
+
+    std::vector<std::coroutine_handle<>> m_ready;
+    std::vector<std::coroutine_handle<>> m_running;
+    std::vector<TimerNode*> m_timers;
+    bool m_stop = false;
+
+    std::mutex m_remote_lock;
+    std::vector<std::coroutine_handle<>> m_remote;
+    std::atomic<bool> m_remote_posted{ false };
+
+    BusyPollOptions m_busy_poll;
+    BusyPollStats m_busy_stats;
+
+#ifdef _WIN32
+    HANDLE m_iocp = nullptr;
+#else
+    int m_epoll = -1;
+    int m_timer_fd = -1;
+    int m_wake_fd = -1;
+    Clock::time_point m_armed_deadline = Clock::time_point::max();
+    std::vector<IoObject*> m_objects;   // polled, for spinning on
+#endif
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_EVENT_LOOP
@@ -0,0 +1,396 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "handlerpool.h"
+
+#include "simplelogger.h"
+
+namespace dcvext {
+
+class HandlerStream
+{
+public:
+    std::mutex lock;
+    std::deque<HandlerPool::Job> jobs;
+    bool scheduled = false;
+};
+
+bool
+SubmitAwaiter::await_ready()
+{
+    m_queued = m_pool.TrySubmit(m_stream, m_handler, m_context, std::move(m_message));
+
+    return m_queued;
+}
+
+bool
+SubmitAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_waiter = handle;
+    m_pool.m_saturated++;
+
+    return m_pool.ParkWaiter(this);
+}
+
+void
+SubmitAwaiter::await_resume()
+{
+    if (m_queued) {
+        return;
+    }
+
+    // There is room again, the message goes in even if another submitter got there first
+    m_pool.m_pending++;
+    m_pool.m_submitted++;
+    m_pool.Enqueue(m_stream, HandlerPool::Job{ m_handler, m_context, std::move(m_message) });
+    m_queued = true;
+}
+
+HandlerPool::HandlerPool(unsigned workers,
+                         size_t max_pending)
+    : m_max_pending(max_pending > 1 ? max_pending : 2),
+      m_started(Clock::now())
+{
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+    }
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    for (unsigned i = 0; i < workers; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->thread = std::thread(&HandlerPool::WorkerMain, this, i);
+    }
+}
+
+HandlerPool::~HandlerPool()
+{
+    Drain();
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_work.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+    }
+}
+
+HandlerStream*
+HandlerPool::OpenStream()
+{
+    std::lock_guard<std::mutex> lock(m_streams_lock);
+
+    m_streams.push_back(std::make_unique<HandlerStream>());
+
+    return m_streams.back().get();
+}
+
+bool
+HandlerPool::TrySubmit(HandlerStream* stream,
+                       MessageHandler handler,
+                       void* context,
+                       BufferSlice&& message)
+{
+    if (m_pending.load() >= m_max_pending) {
+        return false;
+    }
+
+    m_pending++;
+    m_submitted++;
+    Enqueue(stream, Job{ handler, context, std::move(message) });
+
+    return true;
+}
+
+void
+HandlerPool::Submit(HandlerStream* stream,
+                    MessageHandler handler,
+                    void* context,
+                    BufferSlice&& message)
+{
+    if (TrySubmit(stream, handler, context, std::move(message))) {
+        return;
+    }
+
+    m_saturated++;
+
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        // Completed() clears the flag when it wakes us, set it again before every look at m_pending
+        // in case other submitters filled the pool up before we got to run
+        for (;;) {
+            m_has_waiters = true;
+            if (m_pending.load() <= m_max_pending / 2) {
+                break;
+            }
+            m_room.wait(lock);
+        }
+    }
+
+    m_pending++;
+    m_submitted++;
+    Enqueue(stream, Job{ handler, context, std::move(message) });
+}
+
+bool
+HandlerPool::ParkWaiter(SubmitAwaiter* awaiter)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // Set before looking at m_pending, Completed() does it the other way round
+    m_has_waiters = true;
+    if (m_pending.load() <= m_max_pending / 2) {
+        return false;
+    }
+
+    awaiter->m_next = m_waiters;
+    m_waiters = awaiter;
+
+    return true;
+}
+
+void
+HandlerPool::Drain()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    m_drainers++;
+    m_drained.wait(lock, [this]() { return m_pending.load() == 0; });
+    m_drainers--;
+}
+
+void
+HandlerPool::Enqueue(HandlerStream* stream,
+                     Job&& job)
+{
+    size_t worker = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+    if (stream == nullptr) {
+        Push(worker, WorkItem{ nullptr, std::move(job) });
+        return;
+    }
+
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(stream->lock);
+        stream->jobs.push_back(std::move(job));
+        schedule = !stream->scheduled;
+        stream->scheduled = true;
+    }
+
+    // Otherwise the worker running the stream requeues it when done
+    if (schedule) {
+        Push(worker, WorkItem{ stream, Job{} });
+    }
+}
+
+void
+HandlerPool::Push(size_t worker,
+                  WorkItem&& item)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_workers[worker]->lock);
+        m_workers[worker]->queue.push_back(std::move(item));
+    }
+
+    m_queued++;
+    if (m_sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_work.notify_one();
+    }
+}
+
+bool
+HandlerPool::Pop(size_t worker,
+                 WorkItem& item)
+{
+    Worker& self = *m_workers[worker];
+
+    {
+        std::lock_guard<std::mutex> lock(self.lock);
+        if (!self.queue.empty()) {
+            item = std::move(self.queue.front());
+            self.queue.pop_front();
+            m_queued--;
+            return true;
+        }
+    }
+
+    // Steal from the other end, where the owner is not working
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker& victim = *m_workers[(worker + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.lock);
+
+        if (!victim.queue.empty()) {
+            item = std::move(victim.queue.back());
+            victim.queue.pop_back();
+            m_queued--;
+            self.steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+HandlerPool::Run(size_t worker,
+                 WorkItem& item)
+{
+    Worker& self = *m_workers[worker];
+    auto start = Clock::now();
+    HandlerStream* stream = item.stream;
+
+    if (stream != nullptr) {
+        std::lock_guard<std::mutex> lock(stream->lock);
+        item.job = std::move(stream->jobs.front());
+        stream->jobs.pop_front();
+    }
+
+    item.job.handler(item.job.context, item.job.message);
+    item.job.message.Reset();
+
+    if (stream != nullptr) {
+        bool more;
+        {
+            std::lock_guard<std::mutex> lock(stream->lock);
+            more = !stream->jobs.empty();
+            stream->scheduled = more;
+        }
+
+        // One message per turn, other streams on this worker get to run in between
+        if (more) {
+            Push(worker, WorkItem{ stream, Job{} });
+        }
+    }
+
+    self.busy_ns.fetch_add(static_cast<uint64_t>(
+                               std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()),
+                           std::memory_order_relaxed);
+    self.handled.fetch_add(1, std::memory_order_relaxed);
+
+    Completed();
+}
+
+void
+HandlerPool::Completed()
+{
+    size_t left = m_pending.fetch_sub(1) - 1;
+
+    if (left <= m_max_pending / 2 && m_has_waiters.load()) {
+        SubmitAwaiter* waiters;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            waiters = m_waiters;
+            m_waiters = nullptr;
+            m_has_waiters = false;
+        }
+        m_room.notify_all();
+
+        while (waiters != nullptr) {
+            // The awaiter is gone as soon as its coroutine resumes
+            SubmitAwaiter* next = waiters->m_next;
+            waiters->m_loop.PostFromThread(waiters->m_waiter);
+            waiters = next;
+        }
+    }
+
+    if (left == 0 && m_drainers.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_drained.notify_all();
+    }
+}
+
+void
+HandlerPool::WorkerMain(size_t worker)
+{
+    for (;;) {
+        WorkItem item;
+
+        if (Pop(worker, item)) {
+            Run(worker, item);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        // Push() looks at m_sleepers after queueing, so one of us sees the other
+        m_sleepers++;
+        while (!m_stop && m_queued.load() == 0) {
+            m_work.wait(lock);
+        }
+        m_sleepers--;
+
+        if (m_stop && m_queued.load() == 0) {
+            return;
+        }
+    }
+}
+
+HandlerPoolStats
+HandlerPool::Stats()
+{
+    HandlerPoolStats stats;
+    double elapsed_ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_started).count());
+
+    stats.submitted = m_submitted.load();
+    stats.saturated = m_saturated.load();
+    stats.pending = m_pending.load();
+
+    for (auto& worker : m_workers) {
+        HandlerWorkerStats worker_stats;
+
+        worker_stats.handled = worker->handled.load(std::memory_order_relaxed);
+        worker_stats.steals = worker->steals.load(std::memory_order_relaxed);
+        worker_stats.utilization =
+            elapsed_ns > 0 ? static_cast<double>(worker->busy_ns.load(std::memory_order_relaxed)) / elapsed_ns : 0;
+        stats.workers.push_back(worker_stats);
+    }
+
+    return stats;
+}
+
+void
+HandlerPool::LogStats()
+{
+    HandlerPoolStats stats = Stats();
+
+    log_f("Handler pool: %llu messages submitted, %llu waited for room, %zu pending",
+          static_cast<unsigned long long>(stats.submitted),
+          static_cast<unsigned long long>(stats.saturated),
+          stats.pending);
+
+    for (size_t i = 0; i < stats.workers.size(); ++i) {
+        log_f("  worker %zu: %llu handled, %llu stolen, %.1f%% busy",
+              i,
+              static_cast<unsigned long long>(stats.workers[i].handled),
+              static_cast<unsigned long long>(stats.workers[i].steals),
+              100.0 * stats.workers[i].utilization);
+    }
+}
+
+} // namespace dcvext
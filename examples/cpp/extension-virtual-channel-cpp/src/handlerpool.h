@@ -0,0 +1,246 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_HANDLER_POOL
+#define DCV_EXTENSION_HANDLER_POOL
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bufferpool.h"
+#include "eventloop.h"
+
+namespace dcvext {
+
+typedef void (*MessageHandler)(void* context, BufferSlice& message);
+
+struct HandlerWorkerStats
+{
+    uint64_t handled = 0;       // messages handled by this worker
+    uint64_t steals = 0;        // work items taken from another worker
+    double utilization = 0;     // share of time spent in handlers since the pool started
+};
+
+struct HandlerPoolStats
+{
+    uint64_t submitted = 0;
+    uint64_t saturated = 0;     // submissions that had to wait for room
+    size_t pending = 0;
+    std::vector<HandlerWorkerStats> workers;
+};
+
+class HandlerPool;
+class HandlerStream;
+
+/*
+ * Awaitable submission for event loop coroutines: suspends the reader while
+ * the pool is saturated, so a slow handler slows reading down instead of
+ * queueing without bound.
+ */
+class SubmitAwaiter
+{
+public:
+    SubmitAwaiter(HandlerPool& pool,
+                  EventLoop& loop,
+                  HandlerStream* stream,
+                  MessageHandler handler,
+                  void* context,
+                  BufferSlice&& message)
+        : m_pool(pool),
+          m_loop(loop),
+          m_stream(stream),
+          m_handler(handler),
+          m_context(context),
+          m_message(std::move(message))
+    {
+    }
+
+    bool
+    await_ready();
+
+    bool
+    await_suspend(std::coroutine_handle<> handle);
+
+    void
+    await_resume();
+
+private:
+    friend class HandlerPool;
+
+    HandlerPool& m_pool;
+    EventLoop& m_loop;
+    HandlerStream* m_stream;
+    MessageHandler m_handler;
+    void* m_context;
+    BufferSlice m_message;
+    bool m_queued = false;
+    std::coroutine_handle<> m_waiter;
+    SubmitAwaiter* m_next = nullptr;
+};
+
+/*
+ * Thread pool running message handlers off the IO thread. Every worker has
+ * its own queue and takes work from the others when it runs dry.
+ *
+ * Messages submitted on a stream run one at a time, in submission order:
+ * a stream is queued on at most one worker at any time and runs a single
+ * message per turn, so streams make progress side by side. Messages
+ * submitted without a stream run in any order.
+ *
+ * At most max_pending messages are queued or running, beyond that the
+ * submitting side waits until the backlog has halved.
+ */
+class HandlerPool
+{
+public:
+    explicit HandlerPool(unsigned workers = 0,
+                         size_t max_pending = 1024);
+
+    // Runs everything already submitted, then stops the workers
+    ~HandlerPool();
+
+    HandlerPool(const HandlerPool&) = delete;
+    HandlerPool& operator=(const HandlerPool&) = delete;
+
+    // Streams live as long as the pool
+    HandlerStream*
+    OpenStream();
+
+    // Returns false without submitting if the pool is saturated
+    bool
+    TrySubmit(HandlerStream* stream,
+              MessageHandler handler,
+              void* context,
+              BufferSlice&& message);
+
+    // Blocks the calling thread while the pool is saturated
+    void
+    Submit(HandlerStream* stream,
+           MessageHandler handler,
+           void* context,
+           BufferSlice&& message);
+
+    // co_await from a coroutine on loop
+    SubmitAwaiter
+    SubmitAsync(EventLoop& loop,
+                HandlerStream* stream,
+                MessageHandler handler,
+                void* context,
+                BufferSlice&& message)
+    {
+        return SubmitAwaiter(*this, loop, stream, handler, context, std::move(message));
+    }
+
+    // Block until every message submitted so far has been handled
+    void
+    Drain();
+
+    HandlerPoolStats
+    Stats();
+
+    void
+    LogStats();
+
+private:
+    friend class SubmitAwaiter;
+    friend class HandlerStream;
+
+    struct Job
+    {
+        MessageHandler handler;
+        void* context;
+        BufferSlice message;
+    };
+
+    // A queued stream, or a single job when stream is nullptr
+    struct WorkItem
+    {
+        HandlerStream* stream;
+        Job job;
+    };
+
+    struct alignas(64) Worker
+    {
+        std::mutex lock;
+        std::deque<WorkItem> queue;
+        std::thread thread;
+        std::atomic<uint64_t> handled{ 0 };
+        std::atomic<uint64_t> steals{ 0 };
+        std::atomic<uint64_t> busy_ns{ 0 };
+    };
+
+    void
+    Enqueue(HandlerStream* stream,
+            Job&& job);
+
+    void
+    Push(size_t worker,
+         WorkItem&& item);
+
+    bool
+    Pop(size_t worker,
+        WorkItem& item);
+
+    void
+    Run(size_t worker,
+        WorkItem& item);
+
+    void
+    WorkerMain(size_t worker);
+
+    void
+    Completed();
+
+    bool
+    ParkWaiter(SubmitAwaiter* awaiter);
+
+    size_t m_max_pending;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::unique_ptr<HandlerStream>> m_streams;
+    std::mutex m_streams_lock;
+    std::atomic<size_t> m_next_worker{ 0 };
+    std::atomic<size_t> m_queued{ 0 };
+    std::atomic<size_t> m_pending{ 0 };
+    std::atomic<uint64_t> m_submitted{ 0 };
+    std::atomic<uint64_t> m_saturated{ 0 };
+    Clock::time_point m_started;
+
+    // Sleeping workers, blocked submitters and Drain()
+    std::mutex m_lock;
+    std::condition_variable m_work;
+    std::condition_variable m_room;
+    std::condition_variable m_drained;
+    std::atomic<unsigned> m_sleepers{ 0 };
+    std::atomic<unsigned> m_drainers{ 0 };
+    bool m_stop = false;
+    std::atomic<bool> m_has_waiters{ false };
+    SubmitAwaiter* m_waiters = nullptr;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_HANDLER_POOL
@@ -17,107 +17,151 @@
 //  */
 
 #define _CRT_SECURE_NO_WARNINGS
-#include "../generated/extensions.pb.h"
+#include "extensions.pb.h"
 
 #include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "asyncecho.h"
+#include "bufferpool.h"
+#include "dcvcorecpp.h"
+#include "memstats.h"
 #include "simplelogger.h"
+#include "soak.h"
+#include "trafficlog.h"
 
+#ifdef _WIN32
 #define LOG_FILE "C:\\Temp\\DcvExtensionVirtualChannelsCPP"
-
-enum
-{
-    READ_BUFFER_SIZE = 4096
-};
+#else
+#define LOG_FILE "/tmp/DcvExtensionVirtualChannelsCPP"
+#endif
 
 using namespace dcv::extensions;
 
-int last_request_id = 1;
+#ifndef _WIN32
 
-char log_file[sizeof LOG_FILE + 20];
-const std::string CHANNEL_NAME = "echo";
+/*
+ * The few Win32 calls left below, so that the flow reads the same on both
+ * platforms. Stdin, stdout and the relay go through the protocol core.
+ */
+typedef uint32_t DWORD;
 
-void
-WriteMessage(ExtensionMessage& msg);
+#define sprintf_s(buffer, ...) snprintf(buffer, sizeof buffer, __VA_ARGS__)
 
-BOOL
-ReadFromHandle(HANDLE handle,
-               uint8_t* buffer,
-               DWORD size)
+DWORD
+GetCurrentProcessId()
 {
-    DWORD bytes_read = 0;
+    return static_cast<DWORD>(getpid());
+}
 
-    while (bytes_read < size) {
-        DWORD curr_read;
-        uint8_t* offset_buf = buffer + bytes_read;
-        DWORD remaining_bytes = size - bytes_read;
+void
+Sleep(DWORD milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
 
-        if (!ReadFile(handle, offset_buf, remaining_bytes, &curr_read, nullptr)) {
-            log_f("Could not read from handle: 0x%X", GetLastError());
-            return FALSE;
-        }
+#endif // _WIN32
 
-        if (curr_read == 0) {
-            log_f("Read 0 bytes, stopping read");
-            return FALSE;
-        }
+char log_file[sizeof LOG_FILE + 20];
+const char CHANNEL_NAME[] = "echo";
 
-        bytes_read += curr_read;
+DcvMessage*
+ParseMessage(const uint8_t* buf,
+             size_t msg_sz)
+{
+    DcvMessage* msg;
+    {
+        dcvext::MemoryScope scope(dcvext::MEMORY_MESSAGES);
+
+        msg = new DcvMessage();
+        if (!msg->ParseFromArray(buf, static_cast<int>(msg_sz))) {
+            log_f("Could not unpack message from std input");
+            delete msg;
+            return nullptr;
+        }
     }
 
-    return TRUE;
+    dcvext::CaptureDcvMessage(*msg, buf, msg_sz);
+
+    return msg;
 }
 
 DcvMessage*
-ReadNextMessage()
+ReadNextMessage(dcvext::ProtocolCore& core)
 {
-    uint32_t msg_sz = 0;
-
-    HANDLE input_handle = GetStdHandle(STD_INPUT_HANDLE);
+    const uint8_t* buf;
+    size_t msg_sz;
 
-    if (input_handle == INVALID_HANDLE_VALUE) {
-        log_f("Error getting stdin handle: 0x%X", GetLastError());
+    if (!core.Read(buf, msg_sz)) {
+        log_f("Could not read a message from stdin: %i", core.LastStatus());
         return nullptr;
     }
 
-    /*
-     * Read size of message, 32 bits
-     */
-    if (!ReadFromHandle(input_handle, (uint8_t*)&msg_sz, sizeof msg_sz)) {
+    return ParseMessage(buf, msg_sz);
+}
+
+// Messages that come before the response are kept for ReadNextMessage()
+DcvMessage*
+ReadResponse(dcvext::ProtocolCore& core,
+             const std::string& request_id)
+{
+    const uint8_t* buf;
+    size_t msg_sz;
+
+    if (!core.ReadResponse(request_id, buf, msg_sz)) {
+        log_f("Could not read the response to request %s: %i", request_id.c_str(), core.LastStatus());
         return nullptr;
     }
 
-    uint8_t* buf = static_cast<uint8_t*>(malloc(msg_sz));
+    return ParseMessage(buf, msg_sz);
+}
+
+bool
+WriteMessage(dcvext::ProtocolCore& core,
+             const ExtensionMessage& msg)
+{
+    size_t msg_sz = msg.ByteSizeLong();
 
     /*
-     * Read message and unpack it
+     * Serialized straight into the buffer the core writes with its size
      */
-    if (!ReadFromHandle(input_handle, buf, msg_sz)) {
-        return nullptr;
+    uint8_t* buf = core.PrepareWrite(msg_sz);
+    if (buf == nullptr || !msg.SerializeToArray(buf, static_cast<int>(msg_sz))) {
+        log_f("Could not serialize message");
+        return false;
     }
 
-    DcvMessage* msg = new DcvMessage();
-    if (!msg->ParseFromArray(buf, msg_sz)) {
-        log_f("Could not unpack message from std input");
-        delete msg;
-        return nullptr;
+    dcvext::CaptureRecord(dcvext::TRAFFIC_CONTROL_OUT, 0, buf, msg_sz);
+
+    if (!core.CommitWrite()) {
+        log_f("Could not write message: %i", core.LastStatus());
+        return false;
     }
 
-    return msg;
+    return true;
 }
 
-void
-WriteRequest(Request* request)
+std::string
+WriteRequest(dcvext::ProtocolCore& core,
+             Request* request)
 {
     ExtensionMessage extension_msg;
+    std::string request_id = core.NextRequestId();
 
+    request->set_request_id(request_id);
     extension_msg.set_allocated_request(request);
 
-    WriteMessage(extension_msg);
+    WriteMessage(core, extension_msg);
+
+    return request_id;
 }
 
-void
-RequestVirtualChannel()
+std::string
+RequestVirtualChannel(dcvext::ProtocolCore& core)
 {
     auto request = new Request();
     auto msg = new SetupVirtualChannelRequest();
@@ -126,13 +170,12 @@ RequestVirtualChannel()
     msg->set_relay_client_process_id(GetCurrentProcessId());
 
     request->set_allocated_setup_virtual_channel_request(msg);
-    request->set_request_id(std::to_string(last_request_id++));
 
-    WriteRequest(request);
+    return WriteRequest(core, request);
 }
 
-void
-CloseVirtualChannel()
+std::string
+CloseVirtualChannel(dcvext::ProtocolCore& core)
 {
     // TODO: actually call local closure
 
@@ -142,183 +185,237 @@ CloseVirtualChannel()
     msg->set_virtual_channel_name(CHANNEL_NAME);
 
     request->set_allocated_close_virtual_channel_request(msg);
-    request->set_request_id(std::to_string(last_request_id++));
 
-    WriteRequest(request);
+    return WriteRequest(core, request);
 }
 
-BOOL
-WriteToHandle(HANDLE handle,
-              uint8_t* buffer,
-              DWORD size)
+// Set up the channel with DCV and connect to it, true once it is ready
+bool
+SetupChannel(dcvext::ProtocolCore& core,
+             dcvext::CoreChannel& channel,
+             uint32_t& channel_index)
 {
-    DWORD bytes_written = 0;
-
-    while (bytes_written < size) {
-        DWORD curr_written;
-        uint8_t* offset_buf = buffer + bytes_written;
-        DWORD remaining_bytes = size - bytes_written;
+    log_f("RequestVirtualChannel");
 
-        if (!WriteFile(handle, offset_buf, remaining_bytes, &curr_written, nullptr)) {
-            log_f("Could not write to handle: 0x%X", GetLastError());
-            return FALSE;
-        }
+    std::string request_id = RequestVirtualChannel(core);
 
-        bytes_written += curr_written;
+    DcvMessage* msg = ReadResponse(core, request_id);
+    if (msg == nullptr) {
+        log_f("Could not get messages from stdin");
+        return false;
     }
 
-    return TRUE;
-}
+    log_f("Expecting a response");
 
-void
-WriteMessage(ExtensionMessage& msg)
-{
-    int msg_sz;
-    HANDLE output_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+    // Expecting a response
+    if (!msg->has_response()) {
+        log_f("Unexpected message case %u", msg->msg_case());
+        delete msg;
+        return false;
+    }
 
-    if (output_handle == INVALID_HANDLE_VALUE) {
-        log_f("Error getting stdout handle: 0x%X", GetLastError());
-        return;
+    if (msg->response().status() != Response_Status_SUCCESS) {
+        log_f("Error in response for setup request %u", msg->response().status());
+        delete msg;
+        return false;
     }
 
-    msg_sz = static_cast<int>(msg.ByteSizeLong());
-    uint8_t* buf = static_cast<uint8_t*>(malloc(msg_sz));
-    msg.SerializeToArray(buf, msg_sz);
+    log_f("Connect to named pipe and write auth token");
 
-    /*
-     * Write size of message, 32 bits
-     */
-    if (!WriteToHandle(output_handle, reinterpret_cast<uint8_t*>(&msg_sz), sizeof msg_sz)) {
-        free(buf);
-        return;
+    // Connect to named pipe, the auth token goes first
+    if (!channel.Connect(msg->response().setup_virtual_channel_response().relay_path(),
+                         msg->response().setup_virtual_channel_response().virtual_channel_auth_token())) {
+        log_f("Failed to connect to named pipe: %i", channel.LastStatus());
+        delete msg;
+        return false;
     }
 
-    /*
-     * Write message
-     */
-    WriteToHandle(output_handle, buf, msg_sz);
-    FlushFileBuffers(output_handle);
-
-    free(buf);
-}
+    channel_index = dcvext::CaptureChannelOpen(CHANNEL_NAME);
 
-HANDLE
-SetupAndConnectNamedPipe(const std::string& relay_path)
-{
-    HANDLE named_pipe_handle;
-
-    while (TRUE) {
-        named_pipe_handle = CreateFileA(
-            relay_path.c_str(),
-            GENERIC_READ | GENERIC_WRITE,
-            0,
-            nullptr,
-            OPEN_EXISTING,
-            0,
-            nullptr);
-
-        if (named_pipe_handle != INVALID_HANDLE_VALUE) {
-            break;
-        }
+    delete msg;
 
-        BOOL res = GetLastError();
-        if (res != ERROR_PIPE_BUSY) {
-            log_f("Failed to open pipe with error: 0x%x", res);
+    log_f("Wait for the event");
 
-            break;
-        }
+    // Wait for the event
+    msg = ReadNextMessage(core);
+    if (msg == nullptr) {
+        log_f("Could not get messages from stdin");
+        return false;
+    }
 
-        if (!WaitNamedPipeA(relay_path.c_str(), 10000)) {
-            log_f("Failed to open pipe, timeout reached");
+    // Expecting an event
+    if (!msg->has_event()) {
+        log_f("Unexpected message case %u", msg->msg_case());
+        delete msg;
+        return false;
+    }
 
-            break;
-        }
+    // Expecting a setup event
+    if (msg->event().event_case() != Event::kVirtualChannelReadyEvent) {
+        log_f("Unexpected event case %u", msg->event().event_case());
+        delete msg;
+        return false;
     }
 
-    return named_pipe_handle;
+    delete msg;
+
+    return true;
 }
 
-int
-main()
+// Ask DCV to close the channel, once done with it locally
+bool
+TeardownChannel(dcvext::ProtocolCore& core)
 {
-    DWORD written_bytes;
-
-    sprintf_s(log_file, "%s_%i.log", LOG_FILE, GetCurrentProcessId());
-    log_init(log_file);
-
-    log_f("RequestVirtualChannel");
-
-    RequestVirtualChannel();
+    std::string request_id = CloseVirtualChannel(core);
 
-    DcvMessage* msg = ReadNextMessage();
+    // Wait for response
+    DcvMessage* msg = ReadResponse(core, request_id);
     if (msg == nullptr) {
         log_f("Could not get messages from stdin");
-        return -1;
+        return false;
     }
 
-    log_f("Expecting a response");
-
-    // Expecting a response
+    // Expecting close response
     if (!msg->has_response()) {
         log_f("Unexpected message case %u", msg->msg_case());
         delete msg;
-        return -1;
+        return false;
     }
 
     if (msg->response().status() != Response_Status_SUCCESS) {
-        log_f("Error in response for setup request %u", msg->response().status());
+        log_f("Error in response for close request %u", msg->response().status());
         delete msg;
-        return -1;
+        return false;
     }
 
-    log_f("Connect to named pipe");
+    delete msg;
 
-    // Connect to named pipe
-    HANDLE named_pipe_handle = SetupAndConnectNamedPipe(msg->response().setup_virtual_channel_response().relay_path());
-    if (named_pipe_handle == INVALID_HANDLE_VALUE) {
-        log_f("Failed to create and setup named pipe");
-        delete msg;
-        return -1;
-    }
+    return true;
+}
 
-    log_f("Writing auth token on named pipe");
+struct SoakContext
+{
+    dcvext::ProtocolCore& core;
+    dcvext::CoreChannel& channel;
+};
 
-    BOOL res = WriteFile(named_pipe_handle,
-                         msg->response().setup_virtual_channel_response().virtual_channel_auth_token().c_str(),
-                         msg->
-                         response().setup_virtual_channel_response().virtual_channel_auth_token().
-                         length(),
-                         &written_bytes,
-                         nullptr);
+bool
+SoakRequest(void* context)
+{
+    dcvext::ProtocolCore& core = static_cast<SoakContext*>(context)->core;
+    auto request = new Request();
+    request->mutable_get_dcv_info_request();
+
+    DcvMessage* msg = ReadResponse(core, WriteRequest(core, request));
+    bool ok = msg != nullptr && msg->has_response() && msg->response().status() == Response_Status_SUCCESS;
 
     delete msg;
 
-    if (!res) {
-        log_f("WriteFile failed with error 0x%x", GetLastError());
+    return ok;
+}
 
-        return -1;
+// The relay is a byte stream, the echo may come back in pieces
+bool
+SoakEcho(void* context,
+         const uint8_t* data,
+         size_t size,
+         uint8_t* reply)
+{
+    dcvext::CoreChannel& channel = static_cast<SoakContext*>(context)->channel;
+
+    if (!channel.Write(data, size)) {
+        log_f("Write failed: %i", channel.LastStatus());
+        return false;
     }
 
-    log_f("Wait for the event");
+    for (size_t received = 0; received < size;) {
+        dcvext::CoreBuffer buffer = channel.Receive();
+        if (buffer.Empty() || buffer.Size() > size - received) {
+            log_f("Read failed: %i", channel.LastStatus());
+            return false;
+        }
 
-    // Wait for the event
-    msg = ReadNextMessage();
-    if (msg == nullptr) {
-        log_f("Could not get messages from stdin");
+        memcpy(reply + received, buffer.Data(), buffer.Size());
+        received += buffer.Size();
+    }
+
+    return true;
+}
+
+// The soak of soak.cpp, through the same calls as the flow in main()
+int
+SoakBlocking(dcvext::ProtocolCore& core,
+             const SoakOptions& options)
+{
+    dcvext::CoreChannel channel;
+    uint32_t channel_index;
+    if (!SetupChannel(core, channel, channel_index)) {
         return -1;
     }
 
-    // Expecting an event
-    if (!msg->has_event()) {
-        log_f("Unexpected message case %u", msg->msg_case());
-        delete msg;
+    SoakContext context = { core, channel };
+    BlockingSoakFlow flow = { SoakRequest, SoakEcho, &context };
+    int res = RunBlockingSoak(options, flow);
+
+    channel.Close();
+    if (!TeardownChannel(core)) {
+        res = -1;
+    }
+
+    core.LogStats();
+
+    return res;
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+    sprintf_s(log_file, "%s_%i.log", LOG_FILE, GetCurrentProcessId());
+    log_init(log_file);
+    dcvext::StartCaptureFromEnvironment();
+
+    if (argc > 1 && strcmp(argv[1], "--async") == 0) {
+        EchoOptions options;
+        if (!ParseEchoOptions(argc - 2, argv + 2, options)) {
+            return -1;
+        }
+
+        log_f("Running the coroutine based flow%s", options.busy_poll ? " with busy polling" : "");
+
+        return RunAsyncEcho(options);
+    }
+
+    SoakOptions soak_options;
+    bool soak = argc > 1 && strcmp(argv[1], "--soak") == 0;
+
+    if (soak) {
+        if (!ParseSoakOptions(argc - 2, argv + 2, soak_options)) {
+            return -1;
+        }
+
+        log_f("Running the soak of the %s flow", soak_options.blocking ? "blocking" : "coroutine based");
+
+        if (!soak_options.blocking) {
+            return RunSoak(soak_options);
+        }
+    }
+
+    // Closed when main() returns, before the statics it uses are destroyed
+    dcvext::ProtocolCore core;
+
+    if (!core.Open()) {
+        log_f("Could not open stdin and stdout");
         return -1;
     }
 
-    // Expecting a setup event
-    if (msg->event().event_case() != Event::kVirtualChannelReadyEvent) {
-        log_f("Unexpected event case %u", msg->event().event_case());
-        delete msg;
+    if (soak) {
+        return SoakBlocking(core, soak_options);
+    }
+
+    dcvext::CoreChannel channel;
+    uint32_t channel_index;
+    if (!SetupChannel(core, channel, channel_index)) {
         return -1;
     }
 
@@ -326,59 +423,45 @@ main()
 
     // Write to / Read from named pipe
     for (int msg_number = 0; msg_number < 100; ++msg_number) {
-        DWORD read_bytes;
-        char read_buffer[READ_BUFFER_SIZE];
         std::string message = "C++ Test " + std::to_string(msg_number);
 
-        log_f("Write: '%s'", message);
+        log_f("Write: '%s'", message.c_str());
 
-        if (!WriteFile(named_pipe_handle, message.c_str(), message.length() + 1, &written_bytes,
-                       nullptr)) {
-            log_f("WriteFile failed with error 0x%x", GetLastError());
+        if (!channel.Write(message.c_str(), message.length() + 1)) {
+            log_f("Write failed: %i", channel.LastStatus());
+            dcvext::CaptureRecord(dcvext::TRAFFIC_CHANNEL_CLOSED, channel_index, nullptr, 0);
 
             break;
         }
 
-        if (!ReadFile(named_pipe_handle, read_buffer, READ_BUFFER_SIZE - 1, &read_bytes, nullptr)) {
-            log_f("ReadFile failed with error 0x%x", GetLastError());
+        dcvext::CaptureRecord(dcvext::TRAFFIC_CHANNEL_OUT, channel_index, message.c_str(), message.length() + 1);
+
+        // Received into a pooled buffer, back to the pool at the end of the iteration
+        dcvext::CoreBuffer reply = channel.Receive();
+        if (reply.Empty()) {
+            log_f("Read failed: %i", channel.LastStatus());
+            dcvext::CaptureRecord(dcvext::TRAFFIC_CHANNEL_CLOSED, channel_index, nullptr, 0);
 
             break;
         }
 
-        read_buffer[read_bytes] = '\0';
-        log_f("Read: %s", read_buffer);
-        memset(read_buffer, 0, READ_BUFFER_SIZE);
-
-        Sleep(1000);
-    }
-
-    CloseHandle(named_pipe_handle);
+        dcvext::CaptureRecord(dcvext::TRAFFIC_CHANNEL_IN, channel_index, reply.Data(), reply.Size());
 
-    delete msg;
+        const char* text = reinterpret_cast<const char*>(reply.Data());
+        log_f("Read: %.*s", static_cast<int>(strnlen(text, reply.Size())), text);
 
-    CloseVirtualChannel();
-
-    // Wait for response
-    msg = ReadNextMessage();
-    if (msg == nullptr) {
-        log_f("Could not get messages from stdin");
-        return -1;
+        Sleep(1000);
     }
 
-    // Expecting close response
-    if (!msg->has_response()) {
-        log_f("Unexpected message case %u", msg->msg_case());
-        delete msg;
-        return -1;
-    }
+    channel.Close();
+    dcvext::DefaultBufferPool().LogStats("Receive");
 
-    if (msg->response().status() != Response_Status_SUCCESS) {
-        log_f("Error in response for close request %u", msg->response().status());
-        delete msg;
+    if (!TeardownChannel(core)) {
         return -1;
     }
 
-    delete msg;
+    core.LogStats();
+    dcvext::LogMemoryUsage("Exit");
 
     // We closed!
     return 0;
@@ -0,0 +1,317 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "memstats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+#include "simplelogger.h"
+
+namespace dcvext {
+
+namespace {
+
+// Updated from every thread, each subsystem on its own cache line
+struct alignas(64) MemoryCounters
+{
+    std::atomic<uint64_t> live_bytes{ 0 };
+    std::atomic<uint64_t> live_allocations{ 0 };
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> peak_bytes{ 0 };
+};
+
+MemoryCounters counters[MEMORY_SUBSYSTEMS];
+
+thread_local MemorySubsystem current_subsystem = MEMORY_OTHER;
+
+} // namespace
+
+MemoryScope::MemoryScope(MemorySubsystem subsystem)
+    : m_previous(current_subsystem)
+{
+    current_subsystem = subsystem;
+}
+
+MemoryScope::~MemoryScope()
+{
+    current_subsystem = m_previous;
+}
+
+bool
+MemoryAccountingEnabled()
+{
+#ifdef DCVEXT_MEMORY_ACCOUNTING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+MemoryAllocated(MemorySubsystem subsystem,
+                size_t size)
+{
+    MemoryCounters& counter = counters[subsystem];
+    uint64_t live = counter.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+
+    counter.live_allocations.fetch_add(1, std::memory_order_relaxed);
+    counter.allocations.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t peak = counter.peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !counter.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void
+MemoryFreed(MemorySubsystem subsystem,
+            size_t size)
+{
+    MemoryCounters& counter = counters[subsystem];
+
+    counter.live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    counter.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+}
+
+MemoryUsage
+GetMemoryUsage(MemorySubsystem subsystem)
+{
+    const MemoryCounters& counter = counters[subsystem];
+    MemoryUsage usage;
+
+    usage.live_bytes = counter.live_bytes.load(std::memory_order_relaxed);
+    usage.live_allocations = counter.live_allocations.load(std::memory_order_relaxed);
+    usage.allocations = counter.allocations.load(std::memory_order_relaxed);
+    usage.peak_bytes = counter.peak_bytes.load(std::memory_order_relaxed);
+
+    return usage;
+}
+
+const char*
+MemorySubsystemName(MemorySubsystem subsystem)
+{
+    switch (subsystem) {
+    case MEMORY_CONTROL:
+        return "control";
+    case MEMORY_MESSAGES:
+        return "messages";
+    case MEMORY_CHANNELS:
+        return "channels";
+    default:
+        return "other";
+    }
+}
+
+size_t
+ProcessResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memory;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof memory)) {
+        return 0;
+    }
+
+    return memory.WorkingSetSize;
+#else
+    // Read without stdio, which would allocate while we measure
+    char text[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    ssize_t length = read(fd, text, sizeof text - 1);
+    close(fd);
+    if (length <= 0) {
+        return 0;
+    }
+    text[length] = '\0';
+
+    // Total size, then resident pages
+    char* resident = strchr(text, ' ');
+    if (resident == nullptr) {
+        return 0;
+    }
+
+    return static_cast<size_t>(strtoull(resident + 1, nullptr, 10)) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t
+HeapInUseBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+void
+LogMemoryUsage(const char* label)
+{
+    log_f("%s memory: %zu kB resident, %zu kB heap%s",
+          label,
+          ProcessResidentBytes() / 1024,
+          HeapInUseBytes() / 1024,
+          MemoryAccountingEnabled() ? "" : ", operator new not counted");
+
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+        MemorySubsystem subsystem = static_cast<MemorySubsystem>(i);
+        MemoryUsage usage = GetMemoryUsage(subsystem);
+
+        log_f("  %-8s %llu bytes in %llu allocations, peak %llu bytes, %llu allocations in total",
+              MemorySubsystemName(subsystem),
+              static_cast<unsigned long long>(usage.live_bytes),
+              static_cast<unsigned long long>(usage.live_allocations),
+              static_cast<unsigned long long>(usage.peak_bytes),
+              static_cast<unsigned long long>(usage.allocations));
+    }
+}
+
+} // namespace dcvext
+
+#ifdef DCVEXT_MEMORY_ACCOUNTING
+
+namespace {
+
+// In front of every block, keeps the alignment operator new guarantees
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) AllocationHeader
+{
+    size_t size;
+    dcvext::MemorySubsystem subsystem;
+};
+
+void*
+AccountedAllocate(size_t size) noexcept
+{
+    void* memory = malloc(sizeof(AllocationHeader) + size);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    AllocationHeader* header = static_cast<AllocationHeader*>(memory);
+    header->size = size;
+    header->subsystem = dcvext::current_subsystem;
+    dcvext::MemoryAllocated(header->subsystem, size);
+
+    return header + 1;
+}
+
+void
+AccountedFree(void* memory) noexcept
+{
+    if (memory == nullptr) {
+        return;
+    }
+
+    AllocationHeader* header = static_cast<AllocationHeader*>(memory) - 1;
+    dcvext::MemoryFreed(header->subsystem, header->size);
+    free(header);
+}
+
+} // namespace
+
+void*
+operator new(size_t size)
+{
+    void* memory = AccountedAllocate(size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void*
+operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void*
+operator new(size_t size,
+             const std::nothrow_t&) noexcept
+{
+    return AccountedAllocate(size);
+}
+
+void*
+operator new[](size_t size,
+               const std::nothrow_t&) noexcept
+{
+    return AccountedAllocate(size);
+}
+
+void
+operator delete(void* memory) noexcept
+{
+    AccountedFree(memory);
+}
+
+void
+operator delete[](void* memory) noexcept
+{
+    AccountedFree(memory);
+}
+
+void
+operator delete(void* memory,
+                size_t) noexcept
+{
+    AccountedFree(memory);
+}
+
+void
+operator delete[](void* memory,
+                  size_t) noexcept
+{
+    AccountedFree(memory);
+}
+
+void
+operator delete(void* memory,
+                const std::nothrow_t&) noexcept
+{
+    AccountedFree(memory);
+}
+
+void
+operator delete[](void* memory,
+                  const std::nothrow_t&) noexcept
+{
+    AccountedFree(memory);
+}
+
+#endif // DCVEXT_MEMORY_ACCOUNTING
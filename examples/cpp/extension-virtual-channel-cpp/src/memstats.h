@@ -0,0 +1,101 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_MEMORY_STATS
+#define DCV_EXTENSION_MEMORY_STATS
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dcvext {
+
+/*
+ * Allocation accounting by subsystem. Built with DCVEXT_MEMORY_ACCOUNTING,
+ * operator new and delete are replaced to count every C++ allocation against
+ * the subsystem of the innermost MemoryScope on the allocating thread, and
+ * to give it back to the same subsystem when freed wherever that happens.
+ * Only the plain and nothrow forms are replaced. The buffer pool gets its
+ * cache line aligned slabs from the std::align_val_t forms, which go to the
+ * default allocator uncounted, so it reports them through MemoryAllocated()
+ * and MemoryFreed() itself either way and nothing is counted twice.
+ */
+enum MemorySubsystem
+{
+    MEMORY_OTHER,
+    // Reading and writing the messages on stdin and stdout
+    MEMORY_CONTROL,
+    // Protobuf messages from DCV, for as long as they are alive
+    MEMORY_MESSAGES,
+    // Channel buffers, frames and dedup caches
+    MEMORY_CHANNELS,
+    MEMORY_SUBSYSTEMS
+};
+
+struct MemoryUsage
+{
+    uint64_t live_bytes = 0;
+    uint64_t live_allocations = 0;
+    uint64_t allocations = 0;
+    uint64_t peak_bytes = 0;
+};
+
+class MemoryScope
+{
+public:
+    explicit MemoryScope(MemorySubsystem subsystem);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+    MemorySubsystem m_previous;
+};
+
+// Whether operator new and delete are counted
+bool
+MemoryAccountingEnabled();
+
+void
+MemoryAllocated(MemorySubsystem subsystem,
+                size_t size);
+
+void
+MemoryFreed(MemorySubsystem subsystem,
+            size_t size);
+
+MemoryUsage
+GetMemoryUsage(MemorySubsystem subsystem);
+
+const char*
+MemorySubsystemName(MemorySubsystem subsystem);
+
+// Resident set size of the process, 0 if it cannot be told
+size_t
+ProcessResidentBytes();
+
+// Bytes in use on the C heap, which also sees libc and the logger, 0 if unknown
+size_t
+HeapInUseBytes();
+
+void
+LogMemoryUsage(const char* label);
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_MEMORY_STATS
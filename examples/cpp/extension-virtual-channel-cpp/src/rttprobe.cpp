@@ -0,0 +1,232 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "rttprobe.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "simplelogger.h"
+
+namespace dcvext {
+
+namespace {
+
+inline void
+Store64(uint8_t* data,
+        uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        data[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint64_t
+Load64(const uint8_t* data)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    }
+
+    return value;
+}
+
+inline double
+Microseconds(Clock::duration duration)
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+void
+EncodePing(uint64_t sequence,
+           Clock::time_point sent,
+           uint8_t* out)
+{
+    Store64(out, sequence);
+    Store64(out + 8, static_cast<uint64_t>(std::chrono::nanoseconds(sent.time_since_epoch()).count()));
+}
+
+bool
+EncodePong(const uint8_t* ping,
+           size_t size,
+           Clock::duration hold,
+           uint8_t* out)
+{
+    if (size != RTT_PING_SIZE) {
+        return false;
+    }
+
+    memcpy(out, ping, RTT_PING_SIZE);
+    Store64(out + RTT_PING_SIZE, static_cast<uint64_t>(std::chrono::nanoseconds(hold).count()));
+
+    return true;
+}
+
+bool
+DecodePong(const uint8_t* pong,
+           size_t size,
+           uint64_t& sequence,
+           Clock::time_point& sent,
+           Clock::duration& hold)
+{
+    if (size != RTT_PONG_SIZE) {
+        return false;
+    }
+
+    sequence = Load64(pong);
+    sent = Clock::time_point(
+        std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(Load64(pong + 8))));
+    hold = std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(Load64(pong + 16)));
+
+    return true;
+}
+
+RttWindow::RttWindow(size_t capacity)
+{
+    Reset(capacity);
+}
+
+void
+RttWindow::Reset(size_t capacity)
+{
+    m_samples.assign(std::max<size_t>(capacity, 1), Sample{});
+    m_next = 0;
+    m_count = 0;
+    m_total = 0;
+    m_last = Clock::duration::zero();
+    m_smoothed = Clock::duration::zero();
+    m_jitter = Clock::duration::zero();
+    std::fill(std::begin(m_histogram), std::end(m_histogram), 0);
+}
+
+int
+RttWindow::Bucket(Clock::duration rtt)
+{
+    uint64_t us = static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(rtt).count(), 0));
+    int bucket = 0;
+
+    while (bucket < RTT_HISTOGRAM_BUCKETS - 1 && (us >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+void
+RttWindow::Add(Clock::duration rtt,
+               Clock::duration peer_hold)
+{
+    if (rtt < Clock::duration::zero()) {
+        rtt = Clock::duration::zero();
+    }
+
+    if (m_total == 0) {
+        m_smoothed = rtt;
+    } else {
+        Clock::duration delta = rtt > m_last ? rtt - m_last : m_last - rtt;
+        m_smoothed += (rtt - m_smoothed) / 8;
+        m_jitter += (delta - m_jitter) / 16;
+    }
+    m_last = rtt;
+    m_total++;
+
+    if (m_count == m_samples.size()) {
+        m_histogram[Bucket(m_samples[m_next].rtt)]--;
+    } else {
+        m_count++;
+    }
+
+    m_samples[m_next] = Sample{ rtt, peer_hold };
+    m_histogram[Bucket(rtt)]++;
+    m_next = (m_next + 1) % m_samples.size();
+}
+
+void
+RttWindow::Stats(RttStats& stats) const
+{
+    stats.samples = m_total;
+    stats.window = m_count;
+    stats.last = m_last;
+    stats.smoothed = m_smoothed;
+    stats.jitter = m_jitter;
+    std::copy(std::begin(m_histogram), std::end(m_histogram), std::begin(stats.histogram));
+
+    if (m_count == 0) {
+        return;
+    }
+
+    std::vector<Clock::duration> sorted;
+    Clock::duration rtt_sum{};
+    Clock::duration hold_sum{};
+
+    sorted.reserve(m_count);
+    for (size_t i = 0; i < m_count; ++i) {
+        sorted.push_back(m_samples[i].rtt);
+        rtt_sum += m_samples[i].rtt;
+        hold_sum += m_samples[i].peer_hold;
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest rank
+    auto percentile = [&](size_t percent) {
+        size_t rank = (percent * m_count + 99) / 100;
+        return sorted[rank > 0 ? rank - 1 : 0];
+    };
+
+    stats.min = sorted.front();
+    stats.max = sorted.back();
+    stats.mean = rtt_sum / static_cast<Clock::rep>(m_count);
+    stats.p50 = percentile(50);
+    stats.p90 = percentile(90);
+    stats.p99 = percentile(99);
+    stats.peer_hold_mean = hold_sum / static_cast<Clock::rep>(m_count);
+}
+
+void
+LogRttStats(const char* name,
+            const RttStats& stats)
+{
+    log_f("%s round trip over %zu samples: min %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us, "
+          "smoothed %.1f us, jitter %.1f us, peer hold %.1f us (%llu pings, %llu pongs, %llu dropped)",
+          name,
+          stats.window,
+          Microseconds(stats.min),
+          Microseconds(stats.p50),
+          Microseconds(stats.p90),
+          Microseconds(stats.p99),
+          Microseconds(stats.max),
+          Microseconds(stats.smoothed),
+          Microseconds(stats.jitter),
+          Microseconds(stats.peer_hold_mean),
+          static_cast<unsigned long long>(stats.pings_sent),
+          static_cast<unsigned long long>(stats.pongs_received),
+          static_cast<unsigned long long>(stats.pongs_dropped));
+
+    for (int i = 0; i < RTT_HISTOGRAM_BUCKETS; ++i) {
+        if (stats.histogram[i] != 0) {
+            log_f("  %llu-%llu us: %u", i == 0 ? 0ull : 1ull << i, (2ull << i) - 1, stats.histogram[i]);
+        }
+    }
+}
+
+} // namespace dcvext
@@ -0,0 +1,149 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_RTT_PROBE
+#define DCV_EXTENSION_RTT_PROBE
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "eventloop.h"
+
+namespace dcvext {
+
+/*
+ * In-band round trip probing. A PING frame carries a sequence number and the
+ * sender's monotonic send time, the peer answers with a PONG carrying both
+ * back plus how long the ping waited on its side before the answer could be
+ * written. Only the sender reads its own timestamps, so the clocks of the two
+ * ends never have to agree.
+ *
+ *   PING  0 sequence, 8 send time in ns, both 64 bit little endian
+ *   PONG  the ping payload, then 16 hold time in ns
+ */
+enum
+{
+    RTT_PING_SIZE = 16,
+    RTT_PONG_SIZE = 24,
+    RTT_DEFAULT_WINDOW = 256,
+    RTT_HISTOGRAM_BUCKETS = 24
+};
+
+void
+EncodePing(uint64_t sequence,
+           Clock::time_point sent,
+           uint8_t* out);
+
+// Build the answer to a ping payload, false if it is not one
+bool
+EncodePong(const uint8_t* ping,
+           size_t size,
+           Clock::duration hold,
+           uint8_t* out);
+
+bool
+DecodePong(const uint8_t* pong,
+           size_t size,
+           uint64_t& sequence,
+           Clock::time_point& sent,
+           Clock::duration& hold);
+
+/*
+ * Round trip figures over the last window samples. The round trip excludes
+ * the time the ping was held by the peer, which is reported apart: a large
+ * peer_hold means the other end is slow to read, a large rtt the relay or
+ * the network is slow.
+ */
+struct RttStats
+{
+    uint64_t pings_sent = 0;
+    uint64_t pongs_received = 0;
+    uint64_t pongs_dropped = 0;     // not for the ping in flight, stale or repeated
+    uint64_t samples = 0;           // all samples taken
+    size_t window = 0;              // samples the figures below are about
+
+    Clock::duration last{};
+    Clock::duration min{};
+    Clock::duration max{};
+    Clock::duration mean{};
+    Clock::duration p50{};
+    Clock::duration p90{};
+    Clock::duration p99{};
+
+    // Smoothed round trip and mean deviation between consecutive samples,
+    // with the gains of RFC 6298 and RFC 3550
+    Clock::duration smoothed{};
+    Clock::duration jitter{};
+
+    Clock::duration peer_hold_mean{};
+
+    // Bucket i counts samples in the window of [2^i, 2^(i+1)) us, bucket 0
+    // also those below 1 us
+    uint32_t histogram[RTT_HISTOGRAM_BUCKETS] = {};
+};
+
+/*
+ * Sliding window of round trip samples with a histogram kept up to date as
+ * samples enter and leave it.
+ */
+class RttWindow
+{
+public:
+    explicit RttWindow(size_t capacity = RTT_DEFAULT_WINDOW);
+
+    void
+    Add(Clock::duration rtt,
+        Clock::duration peer_hold);
+
+    // Start over with a window of capacity samples
+    void
+    Reset(size_t capacity);
+
+    // Fills everything but the ping and pong counts
+    void
+    Stats(RttStats& stats) const;
+
+private:
+    struct Sample
+    {
+        Clock::duration rtt;
+        Clock::duration peer_hold;
+    };
+
+    static int
+    Bucket(Clock::duration rtt);
+
+    std::vector<Sample> m_samples;
+    size_t m_next = 0;
+    size_t m_count = 0;
+    uint64_t m_total = 0;
+    Clock::duration m_last{};
+    Clock::duration m_smoothed{};
+    Clock::duration m_jitter{};
+    uint32_t m_histogram[RTT_HISTOGRAM_BUCKETS] = {};
+};
+
+// One line summary and the non-empty histogram buckets
+void
+LogRttStats(const char* name,
+            const RttStats& stats);
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_RTT_PROBE
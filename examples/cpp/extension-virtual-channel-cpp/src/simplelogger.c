@@ -25,7 +25,7 @@ static const char* log_file = NULL;
 void
 log_init(const char* logFile)
 {
-    logFile = logFile;
+    log_file = logFile;
 
     FILE* file = fopen(logFile, "w");
     fprintf(file, "Created\n");
@@ -38,10 +38,16 @@ log_f(const char* format,
 {
     va_list args;
 
-    FILE* file = fopen(log_file, "a");
+    /*
+     * Tools share this code without a log file, stderr is safe for them
+     * (stdout is where an extension talks to DCV)
+     */
+    FILE* file = log_file != NULL ? fopen(log_file, "a") : stderr;
     va_start(args, format);
     vfprintf(file, format, args);
     fprintf(file, "\n");
     va_end(args);
-    fclose(file);
+    if (file != stderr) {
+        fclose(file);
+    }
 }
@@ -19,13 +19,19 @@
 #ifndef DCV_EXTENSION_SIMPLE_LOGGER
 #define DCV_EXTENSION_SIMPLE_LOGGER
 
+#ifdef __cplusplus
 extern "C" {
+#endif
+
 void
 log_init(const char* logFile);
 
 void
 log_f(const char* format,
     ...);
+
+#ifdef __cplusplus
 }
+#endif
 
 #endif // DCV_EXTENSION_SIMPLE_LOGGER
@@ -0,0 +1,403 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "soak.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "asyncecho.h"
+#include "asyncextension.h"
+#include "memstats.h"
+#include "simplelogger.h"
+
+using namespace dcvext;
+
+namespace {
+
+const char CHANNEL_NAME[] = "soak";
+
+// Frames start at different offsets of the pattern so a misplaced echo shows
+const size_t PATTERN_OFFSETS = 251;
+
+struct SoakSample
+{
+    size_t resident = 0;
+    size_t heap = 0;
+    MemoryUsage usage[MEMORY_SUBSYSTEMS];
+
+    uint64_t
+    LiveAllocations() const
+    {
+        uint64_t live = 0;
+
+        for (const MemoryUsage& subsystem : usage) {
+            live += subsystem.live_allocations;
+        }
+
+        return live;
+    }
+};
+
+SoakSample
+TakeSample()
+{
+    SoakSample sample;
+
+    sample.resident = ProcessResidentBytes();
+    sample.heap = HeapInUseBytes();
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+        sample.usage[i] = GetMemoryUsage(static_cast<MemorySubsystem>(i));
+    }
+
+    return sample;
+}
+
+long long
+Growth(uint64_t baseline,
+       uint64_t current)
+{
+    return static_cast<long long>(current) - static_cast<long long>(baseline);
+}
+
+// Compare against the baseline, true while within the configured growth
+bool
+CheckSample(const SoakOptions& options,
+            const SoakSample& baseline,
+            const SoakSample& sample,
+            int round)
+{
+    long long resident = Growth(baseline.resident, sample.resident) / 1024;
+    long long heap = Growth(baseline.heap, sample.heap) / 1024;
+    long long allocations = Growth(baseline.LiveAllocations(), sample.LiveAllocations());
+
+    log_f("Soak round %i: %zu kB resident (%+lld kB), %zu kB heap (%+lld kB), %llu live allocations (%+lld)",
+          round,
+          sample.resident / 1024,
+          resident,
+          sample.heap / 1024,
+          heap,
+          static_cast<unsigned long long>(sample.LiveAllocations()),
+          allocations);
+
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+        if (sample.usage[i].live_allocations != baseline.usage[i].live_allocations
+            || sample.usage[i].live_bytes != baseline.usage[i].live_bytes) {
+            log_f("  %-8s %+lld bytes in %+lld allocations",
+                  MemorySubsystemName(static_cast<MemorySubsystem>(i)),
+                  Growth(baseline.usage[i].live_bytes, sample.usage[i].live_bytes),
+                  Growth(baseline.usage[i].live_allocations, sample.usage[i].live_allocations));
+        }
+    }
+
+    bool ok = true;
+
+    if (resident > static_cast<long long>(options.max_rss_growth_kb)
+        || heap > static_cast<long long>(options.max_rss_growth_kb)) {
+        log_f("Memory grew by more than %zu kB since round %i", options.max_rss_growth_kb, options.warmup);
+        ok = false;
+    }
+    if (allocations > static_cast<long long>(options.max_allocation_growth)) {
+        log_f("Live allocations grew by more than %llu since round %i",
+              static_cast<unsigned long long>(options.max_allocation_growth),
+              options.warmup);
+        ok = false;
+    }
+
+    return ok;
+}
+
+// Largest frame plus room to start at every offset
+std::vector<uint8_t>
+MakePattern(const SoakOptions& options)
+{
+    size_t max_size = 0;
+    for (size_t size : options.sizes) {
+        max_size = size > max_size ? size : max_size;
+    }
+
+    std::vector<uint8_t> pattern(max_size + PATTERN_OFFSETS);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = static_cast<uint8_t>(i * 7 + i / 256);
+    }
+
+    return pattern;
+}
+
+size_t
+FrameSize(const SoakOptions& options,
+          int frame)
+{
+    return options.sizes[static_cast<size_t>(frame) % options.sizes.size()];
+}
+
+const uint8_t*
+FramePayload(const std::vector<uint8_t>& pattern,
+             int frame)
+{
+    return pattern.data() + static_cast<size_t>(frame) % PATTERN_OFFSETS;
+}
+
+// Baseline at the end of the warmup, then checks spread over the rest
+bool
+EndRound(const SoakOptions& options,
+         int round,
+         SoakSample& baseline)
+{
+    int report_every = options.rounds >= 10 ? options.rounds / 10 : 1;
+
+    if (round == options.warmup) {
+        baseline = TakeSample();
+        LogMemoryUsage("Soak baseline");
+        if (!MemoryAccountingEnabled()) {
+            log_f("Built without DCVEXT_MEMORY_ACCOUNTING, only the resident set and the heap are checked");
+        }
+    } else if (round > options.warmup && (round % report_every == 0 || round == options.rounds)) {
+        return CheckSample(options, baseline, TakeSample(), round);
+    }
+
+    return true;
+}
+
+void
+LogResult(const SoakOptions& options,
+          bool ok,
+          int rounds,
+          std::chrono::steady_clock::time_point start)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    log_f("Soak %s after %i rounds: %llu control messages and %llu frames in %.1f s",
+          ok ? "passed" : "failed",
+          rounds,
+          2ull * static_cast<unsigned long long>(options.requests) * static_cast<unsigned long long>(rounds),
+          static_cast<unsigned long long>(options.frames) * static_cast<unsigned long long>(rounds),
+          seconds);
+}
+
+Task<bool>
+ControlRound(AsyncExtension& extension,
+             const SoakOptions& options)
+{
+    for (int i = 0; i < options.requests; ++i) {
+        dcv::extensions::Request request;
+        request.mutable_get_dcv_info_request();
+
+        auto msg = co_await extension.Request(request);
+        if (msg == nullptr || !msg->has_response()
+            || msg->response().status() != dcv::extensions::Response_Status_SUCCESS) {
+            log_f("Request %i of the round failed", i);
+            co_return false;
+        }
+    }
+
+    co_return true;
+}
+
+Task<bool>
+FrameRound(AsyncVirtualChannel& channel,
+           const SoakOptions& options,
+           const std::vector<uint8_t>& pattern)
+{
+    for (int i = 0; i < options.frames; ++i) {
+        size_t size = FrameSize(options, i);
+        const uint8_t* payload = FramePayload(pattern, i);
+
+        if (!co_await channel.WriteFrame(payload, size)) {
+            log_f("Could not write frame %i of the round", i);
+            co_return false;
+        }
+
+        Frame frame;
+        if (!co_await channel.ReadFrame(frame)) {
+            log_f("Could not read frame %i of the round", i);
+            co_return false;
+        }
+
+        if (frame.size != size || memcmp(frame.data, payload, size) != 0) {
+            log_f("Echo of frame %i of the round does not match what was sent", i);
+            co_return false;
+        }
+    }
+
+    co_return true;
+}
+
+Task<void>
+Soak(AsyncExtension& extension,
+     const SoakOptions& options,
+     bool& ok)
+{
+    std::unique_ptr<AsyncVirtualChannel> channel = co_await extension.SetupChannel(CHANNEL_NAME);
+    if (channel == nullptr) {
+        log_f("Failed to set up virtual channel '%s'", CHANNEL_NAME);
+        ok = false;
+        extension.Loop().Stop();
+        co_return;
+    }
+
+    std::vector<uint8_t> pattern = MakePattern(options);
+    SoakSample baseline;
+    auto start = std::chrono::steady_clock::now();
+
+    int rounds = 0;
+
+    while (ok && rounds < options.rounds) {
+        ok = co_await ControlRound(extension, options) && co_await FrameRound(*channel, options, pattern);
+        ok = ok && EndRound(options, ++rounds, baseline);
+    }
+
+    LogResult(options, ok, rounds, start);
+
+    if (!co_await channel->Close()) {
+        ok = false;
+    }
+    channel.reset();
+
+    extension.LogControlStats();
+    DefaultBufferPool().LogStats("Receive");
+    LogMemoryUsage("Soak end");
+
+    extension.Loop().Stop();
+}
+
+} // namespace
+
+bool
+ParseSoakOptions(int argc,
+                 char* argv[],
+                 SoakOptions& options)
+{
+    for (int arg = 0; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--blocking") == 0) {
+            options.blocking = true;
+            continue;
+        }
+
+        if (arg + 1 >= argc) {
+            log_f("Missing value for %s", argv[arg]);
+            return false;
+        }
+
+        const char* value = argv[++arg];
+        const char* option = argv[arg - 1];
+
+        if (strcmp(option, "--rounds") == 0) {
+            options.rounds = atoi(value);
+        } else if (strcmp(option, "--requests") == 0) {
+            options.requests = atoi(value);
+        } else if (strcmp(option, "--frames") == 0) {
+            options.frames = atoi(value);
+        } else if (strcmp(option, "--size") == 0) {
+            if (!ParseSizes(value, options.sizes)) {
+                log_f("Invalid frame sizes '%s'", value);
+                return false;
+            }
+        } else if (strcmp(option, "--warmup") == 0) {
+            options.warmup = atoi(value);
+        } else if (strcmp(option, "--max-rss-growth") == 0) {
+            options.max_rss_growth_kb = static_cast<size_t>(strtoull(value, nullptr, 10));
+        } else if (strcmp(option, "--max-allocation-growth") == 0) {
+            options.max_allocation_growth = strtoull(value, nullptr, 10);
+        } else {
+            log_f("Unknown option %s", option);
+            return false;
+        }
+    }
+
+    for (size_t size : options.sizes) {
+        if (size > SOAK_MAX_FRAME) {
+            log_f("Frames of the soak are limited to %u bytes", static_cast<unsigned>(SOAK_MAX_FRAME));
+            return false;
+        }
+    }
+
+    if (options.rounds <= 0 || options.requests < 0 || options.frames < 0 || options.warmup <= 0
+        || options.warmup >= options.rounds) {
+        log_f("Invalid soak options, the warmup must leave rounds to check");
+        return false;
+    }
+
+    return true;
+}
+
+int
+RunSoak(const SoakOptions& options)
+{
+    EventLoop loop;
+    if (!loop.IsValid()) {
+        return -1;
+    }
+
+    AsyncExtension extension(loop);
+    if (!extension.Start()) {
+        return -1;
+    }
+
+    bool ok = true;
+
+    Spawn(Soak(extension, options, ok));
+    loop.Run();
+
+    return ok ? 0 : -1;
+}
+
+int
+RunBlockingSoak(const SoakOptions& options,
+                const BlockingSoakFlow& flow)
+{
+    std::vector<uint8_t> pattern = MakePattern(options);
+    std::vector<uint8_t> reply(pattern.size());
+    SoakSample baseline;
+    auto start = std::chrono::steady_clock::now();
+
+    bool ok = true;
+    int rounds = 0;
+
+    while (ok && rounds < options.rounds) {
+        for (int i = 0; ok && i < options.requests; ++i) {
+            ok = flow.request(flow.context);
+            if (!ok) {
+                log_f("Request %i of the round failed", i);
+            }
+        }
+
+        for (int i = 0; ok && i < options.frames; ++i) {
+            size_t size = FrameSize(options, i);
+            const uint8_t* payload = FramePayload(pattern, i);
+
+            if (!flow.echo(flow.context, payload, size, reply.data())) {
+                log_f("Could not echo message %i of the round", i);
+                ok = false;
+            } else if (memcmp(reply.data(), payload, size) != 0) {
+                log_f("Echo of message %i of the round does not match what was sent", i);
+                ok = false;
+            }
+        }
+
+        ok = ok && EndRound(options, ++rounds, baseline);
+    }
+
+    LogResult(options, ok, rounds, start);
+    DefaultBufferPool().LogStats("Receive");
+    LogMemoryUsage("Soak end");
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,80 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_SOAK
+#define DCV_EXTENSION_SOAK
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum
+{
+    // Written and echoed one at a time, larger frames could fill both relay directions
+    SOAK_MAX_FRAME = 256 * 1024
+};
+
+struct SoakOptions
+{
+    int rounds = 100;
+    // Requests answered by DCV per round, two control messages each
+    int requests = 1000;
+    // Frames echoed on the channel per round
+    int frames = 1000;
+    // Frame sizes used in turn, up to SOAK_MAX_FRAME
+    std::vector<size_t> sizes = { 64, 1024, 16384, 131072 };
+    // Rounds before the baseline is taken, pools and buffers grow meanwhile
+    int warmup = 10;
+    // Growth over the baseline that fails the soak
+    size_t max_rss_growth_kb = 2048;
+    uint64_t max_allocation_growth = 64;
+    // Soak the blocking flow of main.cpp instead of the coroutine based one
+    bool blocking = false;
+};
+
+/*
+ * The blocking flow, with its channel set up. request sends a request to
+ * DCV and waits for its response; echo writes size bytes on the channel and
+ * reads as many back into reply. Both return false on failure.
+ */
+struct BlockingSoakFlow
+{
+    bool (*request)(void* context);
+    bool (*echo)(void* context, const uint8_t* data, size_t size, uint8_t* reply);
+    void* context;
+};
+
+bool
+ParseSoakOptions(int argc,
+                 char* argv[],
+                 SoakOptions& options);
+
+/*
+ * Exchange control messages and channel frames with DCV, or tools/soak, for
+ * a number of rounds and fail if the resident set, the C heap or the live
+ * allocations keep growing once warmed up.
+ */
+int
+RunSoak(const SoakOptions& options);
+
+// The same rounds and checks through the blocking flow
+int
+RunBlockingSoak(const SoakOptions& options,
+                const BlockingSoakFlow& flow);
+
+#endif // DCV_EXTENSION_SOAK
@@ -16,36 +16,67 @@
 //  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //  */
 
-#include "simplelogger.h"
-#define _CRT_SECURE_NO_WARNINGS
-#include <stdio.h>
-#include <stdarg.h>
+#include "task.h"
 
-static const char* _log_file = NULL;
+#include <new>
 
-void
-log_init(const char* logFile)
+namespace dcvext {
+
+namespace {
+
+enum
+{
+    FRAME_GRANULARITY = 64,
+    FRAME_CLASSES = 32
+};
+
+struct FrameLink
+{
+    FrameLink* next;
+};
+
+thread_local FrameLink* free_frames[FRAME_CLASSES];
+
+size_t
+FrameClass(std::size_t size)
 {
-    FILE* file;
+    return (size + FRAME_GRANULARITY - 1) / FRAME_GRANULARITY;
+}
+
+} // namespace
+
+void*
+AllocateFrame(std::size_t size)
+{
+    size_t frame_class = FrameClass(size);
 
-    _log_file = logFile;
+    if (frame_class >= FRAME_CLASSES) {
+        return ::operator new(size);
+    }
 
-    file = fopen(_log_file, "w");
-    fprintf(file, "Created\n");
-    fclose(file);
+    FrameLink* frame = free_frames[frame_class];
+    if (frame != nullptr) {
+        free_frames[frame_class] = frame->next;
+        return frame;
+    }
+
+    return ::operator new(frame_class * FRAME_GRANULARITY);
 }
 
 void
-log_f(const char* format,
-    ...)
+FreeFrame(void* frame,
+          std::size_t size)
 {
-    va_list args;
-    FILE* file;
-
-    file = fopen(_log_file, "a");
-    va_start(args, format);
-    vfprintf(file, format, args);
-    fprintf(file, "\n");
-    va_end(args);
-    fclose(file);
+    size_t frame_class = FrameClass(size);
+
+    if (frame_class >= FRAME_CLASSES) {
+        ::operator delete(frame);
+        return;
+    }
+
+    auto link = static_cast<FrameLink*>(frame);
+    link->next = free_frames[frame_class];
+    free_frames[frame_class] = link;
 }
+
+} // namespace dcvext
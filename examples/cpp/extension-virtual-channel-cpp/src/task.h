@@ -0,0 +1,298 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_TASK
+#define DCV_EXTENSION_TASK
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace dcvext {
+
+/*
+ * Coroutine frames are recycled through per-thread free lists bucketed by
+ * size, so once a given kind of task has run a few times spawning it again
+ * does not touch the heap.
+ */
+void*
+AllocateFrame(std::size_t size);
+
+void
+FreeFrame(void* frame,
+          std::size_t size);
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+struct PromiseBase
+{
+    struct FinalAwaiter
+    {
+        bool
+        await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void
+        await_resume() noexcept
+        {
+        }
+    };
+
+    std::coroutine_handle<> continuation;
+
+    static void*
+    operator new(std::size_t size)
+    {
+        return AllocateFrame(size);
+    }
+
+    static void
+    operator delete(void* frame,
+                    std::size_t size)
+    {
+        FreeFrame(frame, size);
+    }
+
+    std::suspend_always
+    initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter
+    final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void
+    unhandled_exception() noexcept
+    {
+        /*
+         * The samples do not use exceptions to report errors, anything
+         * escaping a coroutine is a bug.
+         */
+        std::terminate();
+    }
+};
+
+template <typename T>
+struct Promise : PromiseBase
+{
+    std::optional<T> value;
+
+    Task<T>
+    get_return_object() noexcept;
+
+    template <typename U>
+    void
+    return_value(U&& result)
+    {
+        value.emplace(std::forward<U>(result));
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    Task<void>
+    get_return_object() noexcept;
+
+    void
+    return_void() noexcept
+    {
+    }
+};
+
+} // namespace detail
+
+/*
+ * Lazily started coroutine: the body does not run until the task is
+ * awaited, and completion resumes the awaiting coroutine directly
+ * (symmetric transfer) without going through the event loop.
+ */
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = detail::Promise<T>;
+
+    Task() = default;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+        : m_handle(handle)
+    {
+    }
+
+    Task(Task&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    Task&
+    operator=(Task&& other) noexcept
+    {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return !m_handle || m_handle.done();
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+
+    T
+    await_resume()
+    {
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*m_handle.promise().value);
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T>
+Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void>
+Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/*
+ * Eagerly started coroutine that frees itself on completion, used to run a
+ * Task without anybody awaiting it.
+ */
+struct DetachedTask
+{
+    struct promise_type
+    {
+        static void*
+        operator new(std::size_t size)
+        {
+            return AllocateFrame(size);
+        }
+
+        static void
+        operator delete(void* frame,
+                        std::size_t size)
+        {
+            FreeFrame(frame, size);
+        }
+
+        DetachedTask
+        get_return_object() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never
+        initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never
+        final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void
+        return_void() noexcept
+        {
+        }
+
+        void
+        unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+inline DetachedTask
+RunDetached(Task<void> task)
+{
+    co_await task;
+}
+
+} // namespace detail
+
+/*
+ * Start a task without awaiting it. It runs inline up to its first
+ * suspension point and its frame is released when it completes.
+ */
+inline void
+Spawn(Task<void> task)
+{
+    detail::RunDetached(std::move(task));
+}
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_TASK
@@ -0,0 +1,377 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#define _CRT_SECURE_NO_WARNINGS
+#include "trafficlog.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "simplelogger.h"
+
+using namespace dcv::extensions;
+
+namespace dcvext {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char CAPTURE_MAGIC[8] = { 'D', 'C', 'V', 'T', 'R', 'A', 'F', '2' };
+const char CAPTURE_MAGIC_V1[8] = { 'D', 'C', 'V', 'T', 'R', 'A', 'F', '1' };
+
+enum
+{
+    CAPTURE_BUFFER_SIZE = 64 * 1024,
+    MAX_VARINT_SIZE = 10
+};
+
+FILE* capture_file = nullptr;
+Clock::time_point capture_last;
+Clock::time_point capture_last_flush;
+uint32_t capture_channels = 0;
+
+size_t
+PutVarint(uint8_t* out,
+          uint64_t value)
+{
+    size_t size = 0;
+
+    while (value >= 0x80) {
+        out[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<uint8_t>(value);
+
+    return size;
+}
+
+bool
+GetVarint(const uint8_t* data,
+          size_t size,
+          size_t& offset,
+          uint64_t& value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+        uint8_t byte = data[offset++];
+
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+bool capture_enabled = false;
+
+bool
+StartCaptureFromEnvironment()
+{
+    const char* prefix = getenv("DCV_EXTENSION_CAPTURE");
+    char path[1024];
+
+    if (prefix == nullptr || *prefix == '\0') {
+        return false;
+    }
+
+#ifdef _WIN32
+    snprintf(path, sizeof path, "%s_%lu.dcvcap", prefix, GetCurrentProcessId());
+#else
+    snprintf(path, sizeof path, "%s_%i.dcvcap", prefix, static_cast<int>(getpid()));
+#endif
+
+    return StartCapture(path);
+}
+
+bool
+StartCapture(const char* path)
+{
+    StopCapture();
+
+    capture_file = fopen(path, "wb");
+    if (capture_file == nullptr) {
+        log_f("Could not open capture file %s", path);
+        return false;
+    }
+
+    setvbuf(capture_file, nullptr, _IOFBF, CAPTURE_BUFFER_SIZE);
+    fwrite(CAPTURE_MAGIC, 1, sizeof CAPTURE_MAGIC, capture_file);
+
+    capture_last = Clock::now();
+    capture_last_flush = capture_last;
+    capture_channels = 0;
+    capture_enabled = true;
+
+    log_f("Capturing traffic to %s", path);
+
+    return true;
+}
+
+void
+StopCapture()
+{
+    if (capture_file != nullptr) {
+        fclose(capture_file);
+        capture_file = nullptr;
+    }
+
+    capture_enabled = false;
+}
+
+void
+CaptureRecord(TrafficKind kind,
+              uint32_t channel,
+              const void* data,
+              size_t length)
+{
+    uint8_t header[1 + 3 * MAX_VARINT_SIZE];
+    size_t header_size = 0;
+
+    if (!capture_enabled) {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    auto delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - capture_last).count();
+    capture_last = now;
+
+    header[header_size++] = kind;
+    header_size += PutVarint(header + header_size, channel);
+    header_size += PutVarint(header + header_size, static_cast<uint64_t>(delta));
+    header_size += PutVarint(header + header_size, length);
+
+    fwrite(header, 1, header_size, capture_file);
+    if (length > 0) {
+        fwrite(data, 1, length, capture_file);
+    }
+
+    /*
+     * Buffered, but never more than a second behind, so that a capture from
+     * an extension killed by DCV still holds the interesting part
+     */
+    if (now - capture_last_flush > std::chrono::seconds(1)) {
+        fflush(capture_file);
+        capture_last_flush = now;
+    }
+}
+
+void
+CaptureDcvMessage(const DcvMessage& msg,
+                  const void* data,
+                  size_t length)
+{
+    if (!capture_enabled) {
+        return;
+    }
+
+    if (msg.has_response() && msg.response().has_setup_virtual_channel_response()) {
+        DcvMessage redacted(msg);
+        redacted.mutable_response()->mutable_setup_virtual_channel_response()->clear_virtual_channel_auth_token();
+
+        std::string serialized = redacted.SerializeAsString();
+        CaptureRecord(TRAFFIC_CONTROL_IN, 0, serialized.data(), serialized.size());
+        return;
+    }
+
+    CaptureRecord(TRAFFIC_CONTROL_IN, 0, data, length);
+}
+
+uint32_t
+CaptureChannelOpen(const std::string& name)
+{
+    if (!capture_enabled) {
+        return 0;
+    }
+
+    uint32_t index = ++capture_channels;
+    CaptureRecord(TRAFFIC_CHANNEL_OPEN, index, name.data(), name.size());
+
+    return index;
+}
+
+TrafficLogReader::~TrafficLogReader()
+{
+    Close();
+}
+
+bool
+TrafficLogReader::Open(const char* path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_f("Could not open capture %s: 0x%X", path, GetLastError());
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof CAPTURE_MAGIC)) {
+        log_f("Capture %s is empty", path);
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        log_f("Could not map capture %s: 0x%X", path, GetLastError());
+        CloseHandle(file);
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        log_f("Could not map capture %s: 0x%X", path, GetLastError());
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_f("Could not open capture %s: %i", path, errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof CAPTURE_MAGIC)) {
+        log_f("Capture %s is empty", path);
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_f("Could not map capture %s: %i", path, errno);
+        return false;
+    }
+
+    // Records are consumed front to back exactly once
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(st.st_size);
+#endif
+
+    m_short_channel = memcmp(m_data, CAPTURE_MAGIC_V1, sizeof CAPTURE_MAGIC_V1) == 0;
+    if (!m_short_channel && memcmp(m_data, CAPTURE_MAGIC, sizeof CAPTURE_MAGIC) != 0) {
+        log_f("%s is not a capture file", path);
+        Close();
+        return false;
+    }
+
+    Rewind();
+
+    return true;
+}
+
+void
+TrafficLogReader::Close()
+{
+    if (m_data == nullptr) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void
+TrafficLogReader::Rewind()
+{
+    m_offset = sizeof CAPTURE_MAGIC;
+    m_timestamp_ns = 0;
+}
+
+bool
+TrafficLogReader::Next(TrafficRecord& record)
+{
+    size_t offset = m_offset;
+    uint64_t channel;
+    uint64_t delta;
+    uint64_t length;
+
+    if (m_data == nullptr || m_size - offset < 2) {
+        return false;
+    }
+
+    record.kind = static_cast<TrafficKind>(m_data[offset++]);
+    if (m_short_channel) {
+        channel = m_data[offset++];
+    } else if (!GetVarint(m_data, m_size, offset, channel) || channel > UINT32_MAX) {
+        return false;
+    }
+    record.channel = static_cast<uint32_t>(channel);
+
+    if (!GetVarint(m_data, m_size, offset, delta) || !GetVarint(m_data, m_size, offset, length)) {
+        return false;
+    }
+
+    if (length > m_size - offset) {
+        return false;
+    }
+
+    m_timestamp_ns += delta;
+
+    record.timestamp_ns = m_timestamp_ns;
+    record.data = m_data + offset;
+    record.length = static_cast<size_t>(length);
+
+    m_offset = offset + record.length;
+
+    return true;
+}
+
+} // namespace dcvext
@@ -0,0 +1,137 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_TRAFFIC_LOG
+#define DCV_EXTENSION_TRAFFIC_LOG
+
+#include "extensions.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Capture of the traffic between the extension and DCV, for replaying a
+ * field incident offline (see tools/replay.cpp).
+ *
+ * A capture file is the 8 byte magic "DCVTRAF2" followed by one record per
+ * control message or channel frame:
+ *
+ *   kind      1 byte, TrafficKind
+ *   channel   varint, index given by the TRAFFIC_CHANNEL_OPEN record, 0 for control messages
+ *   delta     varint, nanoseconds since the previous record (monotonic clock)
+ *   length    varint
+ *   payload   length bytes: the message without its 32 bit size prefix, the
+ *             frame as read or written, or the channel name
+ *
+ * The file is only ever appended to, a capture cut short by a crash is
+ * still readable up to the last complete record. Virtual channel auth
+ * tokens are never written. Captures with the magic "DCVTRAF1" hold the
+ * channel index in 1 byte and are still read.
+ */
+
+namespace dcvext {
+
+enum TrafficKind : uint8_t
+{
+    TRAFFIC_CONTROL_IN = 1,     // DcvMessage read from stdin
+    TRAFFIC_CONTROL_OUT = 2,    // ExtensionMessage written to stdout
+    TRAFFIC_CHANNEL_OPEN = 3,   // relay connected, payload is the channel name
+    TRAFFIC_CHANNEL_IN = 4,     // data read from a relay
+    TRAFFIC_CHANNEL_OUT = 5,    // data written to a relay
+    TRAFFIC_CHANNEL_CLOSED = 6  // relay reached end of stream or failed, no payload
+};
+
+extern bool capture_enabled;
+
+// Capture to "<DCV_EXTENSION_CAPTURE>_<pid>.dcvcap" if the variable is set
+bool
+StartCaptureFromEnvironment();
+
+bool
+StartCapture(const char* path);
+
+void
+StopCapture();
+
+void
+CaptureRecord(TrafficKind kind,
+              uint32_t channel,
+              const void* data,
+              size_t length);
+
+// Record a message read from DCV, removing any virtual channel auth token
+void
+CaptureDcvMessage(const dcv::extensions::DcvMessage& msg,
+                  const void* data,
+                  size_t length);
+
+// Record a relay connection, returns the index for its channel records
+uint32_t
+CaptureChannelOpen(const std::string& name);
+
+struct TrafficRecord
+{
+    TrafficKind kind;
+    uint32_t channel;
+    uint64_t timestamp_ns;      // since the start of the capture
+    const uint8_t* data;
+    size_t length;
+};
+
+/*
+ * Sequential reader over a memory mapped capture file.
+ */
+class TrafficLogReader
+{
+public:
+    TrafficLogReader() = default;
+    ~TrafficLogReader();
+
+    TrafficLogReader(const TrafficLogReader&) = delete;
+    TrafficLogReader& operator=(const TrafficLogReader&) = delete;
+
+    bool
+    Open(const char* path);
+
+    // Returns false at the end of the capture or on a truncated record
+    bool
+    Next(TrafficRecord& record);
+
+    void
+    Rewind();
+
+private:
+    void
+    Close();
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+    uint64_t m_timestamp_ns = 0;
+    // DCVTRAF1 captures, with a 1 byte channel index
+    bool m_short_channel = false;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_TRAFFIC_LOG
@@ -0,0 +1,292 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Compares the control message path of the extensions before and after the
+ * protocol core (see src/dcvcore.h):
+ *
+ *   corebench [-n messages] [-b burst] [-s size]
+ *
+ * A child process takes the place of the extension, with pipes for stdin and
+ * stdout, and echoes every message it reads. The legacy child reads the size
+ * and the message with two reads into a fresh allocation and writes them back
+ * with two writes, as the extensions did; the core child uses dcv_core_read()
+ * and dcv_core_prepare_write(). The parent writes bursts of messages with a
+ * single write, as DCV does when several events are queued, then reads the
+ * echoes back. Reported are the throughput and the CPU time of the child.
+ * Linux only.
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../src/dcvcore.h"
+
+namespace {
+
+struct Options
+{
+    int messages = 200000;
+    int burst = 16;
+    int size = 64;
+};
+
+struct Result
+{
+    double wall_seconds = 0;
+    double child_cpu_seconds = 0;
+};
+
+bool
+ReadAll(int fd,
+        void* buffer,
+        size_t size)
+{
+    uint8_t* data = static_cast<uint8_t*>(buffer);
+
+    while (size > 0) {
+        ssize_t res = read(fd, data, size);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+        data += res;
+        size -= static_cast<size_t>(res);
+    }
+
+    return true;
+}
+
+bool
+WriteAll(int fd,
+         const void* buffer,
+         size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(buffer);
+
+    while (size > 0) {
+        ssize_t res = write(fd, data, size);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+        data += res;
+        size -= static_cast<size_t>(res);
+    }
+
+    return true;
+}
+
+// What ReadNextMessage() and WriteMessage() did before the core
+int
+LegacyEcho()
+{
+    for (;;) {
+        uint32_t size;
+        if (!ReadAll(STDIN_FILENO, &size, sizeof size)) {
+            return 0;
+        }
+
+        uint8_t* message = static_cast<uint8_t*>(malloc(size));
+        if (message == nullptr || !ReadAll(STDIN_FILENO, message, size)) {
+            free(message);
+            return 1;
+        }
+
+        bool written = WriteAll(STDOUT_FILENO, &size, sizeof size) && WriteAll(STDOUT_FILENO, message, size);
+        free(message);
+        if (!written) {
+            return 1;
+        }
+    }
+}
+
+int
+CoreEcho()
+{
+    dcv_core* core = dcv_core_open(nullptr);
+    if (core == nullptr) {
+        return 1;
+    }
+
+    dcv_core_status status;
+    for (;;) {
+        const uint8_t* message;
+        size_t size;
+
+        status = dcv_core_read(core, &message, &size);
+        if (status != DCV_CORE_OK) {
+            break;
+        }
+
+        uint8_t* buffer = dcv_core_prepare_write(core, size);
+        if (buffer == nullptr) {
+            status = DCV_CORE_ERROR_NO_MEMORY;
+            break;
+        }
+
+        memcpy(buffer, message, size);
+
+        status = dcv_core_commit_write(core);
+        if (status != DCV_CORE_OK) {
+            break;
+        }
+    }
+
+    dcv_core_close(core);
+
+    return status == DCV_CORE_CLOSED ? 0 : 1;
+}
+
+bool
+RunCase(bool use_core,
+        const Options& options,
+        Result& result)
+{
+    int to_child[2];
+    int from_child[2];
+    if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+        fprintf(stderr, "pipe failed: %i\n", errno);
+        return false;
+    }
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork failed: %i\n", errno);
+        return false;
+    }
+
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+
+        _exit(use_core ? CoreEcho() : LegacyEcho());
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+
+    // One burst of messages, each its size followed by a payload
+    size_t framed = sizeof(uint32_t) + static_cast<size_t>(options.size);
+    std::vector<uint8_t> burst(framed * static_cast<size_t>(options.burst));
+    std::vector<uint8_t> echo(burst.size());
+
+    for (int i = 0; i < options.burst; ++i) {
+        uint8_t* frame = burst.data() + framed * static_cast<size_t>(i);
+        uint32_t size = static_cast<uint32_t>(options.size);
+
+        memcpy(frame, &size, sizeof size);
+        memset(frame + sizeof size, 'a' + i % 26, options.size);
+    }
+
+    bool ok = true;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int sent = 0; sent < options.messages && ok; sent += options.burst) {
+        ok = WriteAll(to_child[1], burst.data(), burst.size()) && ReadAll(from_child[0], echo.data(), echo.size())
+            && memcmp(burst.data(), echo.data(), burst.size()) == 0;
+    }
+
+    result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    close(to_child[1]);
+
+    int status = 0;
+    rusage usage = {};
+    wait4(pid, &status, 0, &usage);
+    close(from_child[0]);
+
+    result.child_cpu_seconds = static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "The %s child failed, exit status %i\n", use_core ? "core" : "legacy", status);
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    Options options;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+            options.messages = atoi(argv[++arg]);
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-b") == 0) {
+            options.burst = atoi(argv[++arg]);
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-s") == 0) {
+            options.size = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "usage: %s [-n messages] [-b burst] [-s size]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (options.messages <= 0 || options.burst <= 0 || options.size <= 0) {
+        fprintf(stderr, "Messages, burst and size must be positive\n");
+        return 2;
+    }
+
+    // Rounded up to whole bursts
+    options.messages = (options.messages + options.burst - 1) / options.burst * options.burst;
+
+    printf("%i messages of %i bytes in bursts of %i, core ABI %u\n",
+           options.messages,
+           options.size,
+           options.burst,
+           dcv_core_abi_version());
+
+    for (bool use_core : { false, true }) {
+        Result result;
+        if (!RunCase(use_core, options, result)) {
+            return 1;
+        }
+
+        printf("  %-7s %10.0f messages/s   child CPU %6.3f s, %5.2f us per message\n",
+               use_core ? "core" : "legacy",
+               options.messages / result.wall_seconds,
+               result.child_cpu_seconds,
+               1e6 * result.child_cpu_seconds / options.messages);
+    }
+
+    return 0;
+}
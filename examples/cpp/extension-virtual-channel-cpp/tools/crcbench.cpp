@@ -0,0 +1,451 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Benchmarks the CRC32C kernels and the cost of CRCs on channel framing:
+ *
+ *   crcbench [seconds per case]
+ *
+ * Every kernel available on the CPU is first checked against the portable
+ * one, and a corrupted frame is checked to be rejected, so a run that
+ * prints numbers also vouches for the results.
+ *
+ * The framing table encodes and decodes in memory, which isolates the CRC
+ * cost against a baseline of copies within the cache. The end to end table
+ * is what a channel sees: AsyncVirtualChannel::WriteFrame() on one thread,
+ * a unix socket pair, and ReadFrame() on another thread, each with its own
+ * event loop. Linux only.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/asyncextension.h"
+#include "../src/channelframing.h"
+#include "../src/crc32c.h"
+#include "../src/eventloop.h"
+#include "../src/task.h"
+
+using namespace dcvext;
+
+namespace {
+
+const Crc32cKernel kernels[] = { CRC32C_PORTABLE, CRC32C_SSE42, CRC32C_SSE42_PCLMUL, CRC32C_AVX512_VPCLMUL, CRC32C_ARMV8 };
+const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024 };
+// Small frames are bound by the system calls, not by the CRC
+const size_t end_to_end_sizes[] = { 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024 };
+
+struct FramingCase
+{
+    const char* name;
+    bool crc32c;
+    uint8_t chunk_shift;
+};
+
+const FramingCase framing_cases[] = { { "no crc", false, 0 }, { "crc per frame", true, 0 }, { "crc per 64KB", true, 16 } };
+
+double seconds_per_case = 0.5;
+volatile uint32_t sink;
+
+bool
+VerifyKernels(const std::vector<uint8_t>& data)
+{
+    std::mt19937 rng(7);
+    bool ok = true;
+
+    for (Crc32cKernel kernel : kernels) {
+        if (!Crc32cKernelAvailable(kernel)) {
+            continue;
+        }
+
+        if (Crc32cWith(kernel, 0, "123456789", 9) != 0xE3069283) {
+            fprintf(stderr, "%s: wrong check value\n", Crc32cKernelName(kernel));
+            ok = false;
+            continue;
+        }
+
+        for (int i = 0; i < 1000; ++i) {
+            size_t offset = rng() % 64;
+            size_t size = rng() % (data.size() - 64);
+            size_t split = size > 0 ? rng() % size : 0;
+
+            uint32_t expected = Crc32cWith(CRC32C_PORTABLE, 0, data.data() + offset, size);
+            uint32_t actual = Crc32cWith(kernel, 0, data.data() + offset, split);
+            actual = Crc32cWith(kernel, actual, data.data() + offset + split, size - split);
+
+            if (actual != expected) {
+                fprintf(stderr,
+                        "%s: mismatch at offset %zu size %zu split %zu\n",
+                        Crc32cKernelName(kernel),
+                        offset,
+                        size,
+                        split);
+                ok = false;
+                break;
+            }
+        }
+
+        // Every size around the block boundaries of the folding kernels, copied and in place
+        std::vector<uint8_t> copy(4096 + 64);
+        for (size_t size = 0; size <= 2048 && ok; ++size) {
+            size_t offset = rng() % 64;
+            uint32_t expected = Crc32cWith(CRC32C_PORTABLE, 0, data.data() + offset, size);
+            uint32_t actual = Crc32cWith(kernel, 0, data.data() + offset, size);
+            uint32_t copied = Crc32cCopyWith(kernel, 0, copy.data() + (offset ^ 5), data.data() + offset, size);
+
+            // Moving towards the start of an overlapping buffer, as decoding chunked frames does
+            size_t distance = 1 + rng() % 512;
+            memcpy(copy.data() + 2048 - size + distance, data.data() + offset, size);
+            uint32_t moved = Crc32cCopyWith(kernel, 0, copy.data() + 2048 - size, copy.data() + 2048 - size + distance, size);
+
+            if (actual != expected || copied != expected || moved != expected
+                || memcmp(copy.data() + 2048 - size, data.data() + offset, size) != 0) {
+                fprintf(stderr, "%s: mismatch or bad copy at size %zu\n", Crc32cKernelName(kernel), size);
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+// Flip one bit anywhere in an encoded frame, it must never decode
+bool
+VerifyCorruptionDetected(const std::vector<uint8_t>& data)
+{
+    std::mt19937 rng(11);
+    FrameOptions options[2];
+    options[0].crc32c = true;
+    options[1].crc32c = true;
+    options[1].chunk_shift = 12;
+
+    for (const FrameOptions& option : options) {
+        std::vector<uint8_t> frame;
+        EncodeFrame(FRAME_TYPE_DATA, data.data(), 20000, option, frame);
+
+        for (int i = 0; i < 1000; ++i) {
+            std::vector<uint8_t> copy = frame;
+            size_t bit = rng() % (copy.size() * 8);
+            copy[bit / 8] ^= static_cast<uint8_t>(1u << (bit % 8));
+
+            Frame decoded;
+            size_t wire_size = 0;
+            char error[128];
+            FrameStatus status = DecodeFrame(copy.data(), copy.size(), option, decoded, wire_size, error);
+
+            // A damaged length may also leave the frame waiting for more data
+            if (status == FRAME_COMPLETE) {
+                fprintf(stderr, "Flipped bit %zu was not detected\n", bit);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+template<typename Function>
+double
+MeasureBytesPerSecond(size_t bytes_per_call,
+                      Function function)
+{
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration<double>(seconds_per_case);
+    uint64_t calls = 0;
+    Clock::time_point now;
+
+    do {
+        // Check the clock once per ~1MB so it does not show up in small sizes
+        size_t batch = 1 + (1024 * 1024) / bytes_per_call;
+        for (size_t i = 0; i < batch; ++i) {
+            function();
+        }
+        calls += batch;
+        now = Clock::now();
+    } while (now < deadline);
+
+    return static_cast<double>(calls * bytes_per_call) / std::chrono::duration<double>(now - start).count();
+}
+
+void
+BenchKernels(const std::vector<uint8_t>& data)
+{
+    printf("%-16s", "kernel GB/s");
+    for (size_t size : sizes) {
+        printf(" %10zu", size);
+    }
+    printf("\n");
+
+    for (Crc32cKernel kernel : kernels) {
+        if (!Crc32cKernelAvailable(kernel)) {
+            continue;
+        }
+
+        printf("%-16s", Crc32cKernelName(kernel));
+        for (size_t size : sizes) {
+            double rate = MeasureBytesPerSecond(size, [&]() { sink = Crc32cWith(kernel, 0, data.data(), size); });
+            printf(" %10.2f", rate / 1e9);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Encode and decode through a buffer the way a channel does, the baseline
+ * without CRCs is bound by the copies.
+ */
+void
+BenchFraming(const std::vector<uint8_t>& data)
+{
+    printf("\nframing GB/s (%s)", Crc32cKernelName(Crc32cSelectedKernel()));
+    for (size_t size : sizes) {
+        printf(" %10zu", size);
+    }
+    printf("\n");
+
+    double baseline[sizeof sizes / sizeof sizes[0]] = {};
+    std::vector<uint8_t> wire;
+
+    for (const FramingCase& c : framing_cases) {
+        FrameOptions options;
+        options.crc32c = c.crc32c;
+        options.chunk_shift = c.chunk_shift;
+
+        printf("%-16s", c.name);
+        for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+            size_t size = sizes[i];
+            double rate = MeasureBytesPerSecond(size, [&]() {
+                wire.clear();
+                EncodeFrame(FRAME_TYPE_DATA, data.data(), size, options, wire);
+
+                Frame frame;
+                size_t wire_size = 0;
+                char error[128];
+                if (DecodeFrame(wire.data(), wire.size(), options, frame, wire_size, error) != FRAME_COMPLETE) {
+                    fprintf(stderr, "Decoding failed: %s\n", error);
+                    exit(1);
+                }
+                sink = frame.data[frame.size - 1];
+            });
+
+            if (!c.crc32c) {
+                baseline[i] = rate;
+                printf(" %10.2f", rate / 1e9);
+            } else {
+                printf(" %6.2f%+3.0f%%", rate / 1e9, 100.0 * (rate - baseline[i]) / baseline[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+// One end of the socket pair as a framed channel on a loop of its own
+struct FramedEnd
+{
+    EventLoop loop;
+    AsyncExtension extension{ loop };
+    std::unique_ptr<AsyncVirtualChannel> channel;
+    bool ok = false;
+
+    bool
+    Attach(int fd,
+           const FrameOptions& options)
+    {
+        if (!loop.IsValid()) {
+            return false;
+        }
+
+        channel = extension.AttachChannel("crcbench", fd);
+        if (channel == nullptr) {
+            return false;
+        }
+
+        channel->SetFrameOptions(options);
+
+        return true;
+    }
+};
+
+Task<void>
+WriteFrames(FramedEnd& end,
+            const uint8_t* payload,
+            size_t size,
+            uint64_t frames)
+{
+    end.ok = true;
+    for (uint64_t i = 0; i < frames && end.ok; ++i) {
+        end.ok = co_await end.channel->WriteFrame(payload, size);
+    }
+
+    end.loop.Stop();
+}
+
+Task<void>
+ReadFrames(FramedEnd& end,
+           size_t size,
+           uint64_t frames)
+{
+    end.ok = true;
+    for (uint64_t i = 0; i < frames && end.ok; ++i) {
+        Frame frame;
+        end.ok = co_await end.channel->ReadFrame(frame) && frame.size == size;
+        if (end.ok) {
+            sink = frame.data[size - 1];
+        }
+    }
+
+    end.loop.Stop();
+}
+
+// Bytes per second through the channel, 0 on failure
+double
+MeasureEndToEnd(const std::vector<uint8_t>& data,
+                size_t size,
+                const FrameOptions& options)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        fprintf(stderr, "socketpair failed: %i\n", errno);
+        return 0;
+    }
+
+    // Sized from a short run, so each case takes about seconds_per_case
+    uint64_t frames = 1 + (64 * 1024 * 1024) / size;
+    double seconds = 0;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        FramedEnd writer;
+        FramedEnd reader;
+        bool attached[2] = { writer.Attach(fds[0], options), reader.Attach(fds[1], options) };
+
+        if (!attached[0] || !attached[1]) {
+            for (int i = 0; i < 2; ++i) {
+                if (!attached[i]) {
+                    close(fds[i]);
+                }
+            }
+            fprintf(stderr, "Could not attach the socket pair\n");
+            return 0;
+        }
+
+        auto start = Clock::now();
+        std::thread write_thread([&]() {
+            Spawn(WriteFrames(writer, data.data(), size, frames));
+            writer.loop.Run();
+        });
+        Spawn(ReadFrames(reader, size, frames));
+        reader.loop.Run();
+        write_thread.join();
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (!writer.ok || !reader.ok) {
+            fprintf(stderr, "The channel failed with frames of %zu bytes\n", size);
+            return 0;
+        }
+
+        if (pass == 0) {
+            // The channels close the sockets, the measured pass gets a new pair
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+                fprintf(stderr, "socketpair failed: %i\n", errno);
+                return 0;
+            }
+            frames = std::max<uint64_t>(16, static_cast<uint64_t>(frames * seconds_per_case / seconds));
+        }
+    }
+
+    return static_cast<double>(frames * size) / seconds;
+}
+
+bool
+BenchEndToEnd(const std::vector<uint8_t>& data)
+{
+    printf("\nend to end GB/s  ");
+    for (size_t size : end_to_end_sizes) {
+        printf(" %10zu", size);
+    }
+    printf("\n");
+
+    double baseline[sizeof end_to_end_sizes / sizeof end_to_end_sizes[0]] = {};
+
+    for (const FramingCase& c : framing_cases) {
+        FrameOptions options;
+        options.crc32c = c.crc32c;
+        options.chunk_shift = c.chunk_shift;
+
+        printf("%-16s", c.name);
+        for (size_t i = 0; i < sizeof end_to_end_sizes / sizeof end_to_end_sizes[0]; ++i) {
+            double rate = MeasureEndToEnd(data, end_to_end_sizes[i], options);
+            if (rate == 0) {
+                return false;
+            }
+
+            if (!c.crc32c) {
+                baseline[i] = rate;
+                printf(" %10.2f", rate / 1e9);
+            } else {
+                printf(" %6.2f%+3.0f%%", rate / 1e9, 100.0 * (rate - baseline[i]) / baseline[i]);
+            }
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    printf("(%u CPUs, the writer and the reader share them)\n", std::thread::hardware_concurrency());
+
+    return true;
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    if (argc > 1) {
+        seconds_per_case = atof(argv[1]);
+        if (seconds_per_case <= 0) {
+            fprintf(stderr, "usage: crcbench [seconds per case]\n");
+            return 2;
+        }
+    }
+
+    std::vector<uint8_t> data(sizes[sizeof sizes / sizeof sizes[0] - 1] + 64);
+    std::mt19937 rng(1);
+    for (uint8_t& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    if (!VerifyKernels(data) || !VerifyCorruptionDetected(data)) {
+        return 1;
+    }
+
+    BenchKernels(data);
+    BenchFraming(data);
+
+    return BenchEndToEnd(data) ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#include "dcvstandin.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace dcv::extensions;
+
+namespace dcvext {
+
+bool
+SpawnExtension(char* const argv[],
+               ExtensionProcess& process)
+{
+    int to_extension[2];
+    int from_extension[2];
+
+    if (pipe2(to_extension, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return false;
+    }
+
+    if (pipe2(from_extension, O_CLOEXEC) != 0) {
+        perror("pipe");
+        close(to_extension[0]);
+        close(to_extension[1]);
+        return false;
+    }
+
+    // A dead extension must show up as a failed write, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+
+    if (pid == 0) {
+        dup2(to_extension[0], STDIN_FILENO);
+        dup2(from_extension[1], STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(to_extension[0]);
+    close(from_extension[1]);
+
+    process.pid = pid;
+    process.input = to_extension[1];
+    process.output = from_extension[0];
+
+    return true;
+}
+
+int
+StopExtension(ExtensionProcess& process,
+              int timeout_ms,
+              rusage* usage)
+{
+    int status = 0;
+
+    if (process.pid < 0) {
+        return -1;
+    }
+
+    close(process.input);
+    process.input = -1;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (wait4(process.pid, &status, WNOHANG, usage) == 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            kill(process.pid, SIGKILL);
+            wait4(process.pid, &status, 0, usage);
+            status = -1;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    close(process.output);
+    process.output = -1;
+    process.pid = -1;
+
+    if (status < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+
+    return WEXITSTATUS(status);
+}
+
+bool
+ReadExact(int fd,
+          void* buffer,
+          size_t size)
+{
+    size_t received = 0;
+
+    while (received < size) {
+        ssize_t res = read(fd, static_cast<uint8_t*>(buffer) + received, size - received);
+
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+
+        received += static_cast<size_t>(res);
+    }
+
+    return true;
+}
+
+bool
+WriteExact(int fd,
+           const void* buffer,
+           size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t res = write(fd, static_cast<const uint8_t*>(buffer) + written, size - written);
+
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+
+        written += static_cast<size_t>(res);
+    }
+
+    return true;
+}
+
+bool
+WriteFrame(int fd,
+           const void* data,
+           size_t size)
+{
+    uint32_t msg_sz = static_cast<uint32_t>(size);
+
+    return WriteExact(fd, &msg_sz, sizeof msg_sz) && WriteExact(fd, data, size);
+}
+
+bool
+WriteDcvMessage(int fd,
+                const DcvMessage& msg,
+                std::string& scratch)
+{
+    uint32_t msg_sz = static_cast<uint32_t>(msg.ByteSizeLong());
+
+    scratch.resize(sizeof msg_sz);
+    memcpy(&scratch[0], &msg_sz, sizeof msg_sz);
+    if (!msg.AppendToString(&scratch)) {
+        return false;
+    }
+
+    return WriteExact(fd, scratch.data(), scratch.size());
+}
+
+bool
+ReadExtensionMessage(int fd,
+                     ExtensionMessage& msg,
+                     std::string& scratch)
+{
+    uint32_t msg_sz;
+
+    if (!ReadExact(fd, &msg_sz, sizeof msg_sz)) {
+        return false;
+    }
+
+    scratch.resize(msg_sz);
+    if (!ReadExact(fd, &scratch[0], msg_sz)) {
+        return false;
+    }
+
+    return msg.ParseFromString(scratch);
+}
+
+RelayListener::~RelayListener()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool
+RelayListener::Listen(const std::string& name)
+{
+    sockaddr_un addr = {};
+    socklen_t addr_len;
+
+    if (name.size() >= sizeof addr.sun_path - 1) {
+        fprintf(stderr, "Relay name %s is too long\n", name.c_str());
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name.data(), name.size());
+    addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    if (bind(m_fd, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0 || listen(m_fd, 16) != 0) {
+        perror("bind");
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    m_path = name;
+
+    return true;
+}
+
+int
+RelayListener::Accept(int timeout_ms)
+{
+    pollfd pfd = { m_fd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return -1;
+    }
+
+    return accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+}
+
+} // namespace dcvext
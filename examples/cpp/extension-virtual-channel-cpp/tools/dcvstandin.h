@@ -0,0 +1,117 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+#ifndef DCV_EXTENSION_STAND_IN
+#define DCV_EXTENSION_STAND_IN
+
+#include "extensions.pb.h"
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+struct rusage;
+
+/*
+ * Pieces of a local DCV stand-in used by the tools: launching an extension
+ * with its standard streams connected to us, exchanging length prefixed
+ * messages with it and serving virtual channel relays. Linux only.
+ */
+
+namespace dcvext {
+
+struct ExtensionProcess
+{
+    pid_t pid = -1;
+    int input = -1;     // the extension stdin, we write DcvMessages here
+    int output = -1;    // the extension stdout, we read ExtensionMessages here
+};
+
+bool
+SpawnExtension(char* const argv[],
+               ExtensionProcess& process);
+
+// Close the extension stdin, wait for it to exit and kill it after timeout_ms.
+// Returns the exit status, or -1 if it had to be killed. The resources the
+// extension used are stored in usage if given
+int
+StopExtension(ExtensionProcess& process,
+              int timeout_ms,
+              rusage* usage = nullptr);
+
+bool
+ReadExact(int fd,
+          void* buffer,
+          size_t size);
+
+bool
+WriteExact(int fd,
+           const void* buffer,
+           size_t size);
+
+// Write a message with its 32 bit size prefix
+bool
+WriteFrame(int fd,
+           const void* data,
+           size_t size);
+
+bool
+WriteDcvMessage(int fd,
+                const dcv::extensions::DcvMessage& msg,
+                std::string& scratch);
+
+bool
+ReadExtensionMessage(int fd,
+                     dcv::extensions::ExtensionMessage& msg,
+                     std::string& scratch);
+
+/*
+ * Server side of a virtual channel relay, an abstract unix socket as DCV
+ * creates them.
+ */
+class RelayListener
+{
+public:
+    RelayListener() = default;
+    ~RelayListener();
+
+    RelayListener(const RelayListener&) = delete;
+    RelayListener& operator=(const RelayListener&) = delete;
+
+    bool
+    Listen(const std::string& name);
+
+    // Returns the connected socket, -1 on error or after timeout_ms
+    int
+    Accept(int timeout_ms);
+
+    const std::string&
+    Path() const
+    {
+        return m_path;
+    }
+
+private:
+    int m_fd = -1;
+    std::string m_path;
+};
+
+} // namespace dcvext
+
+#endif // DCV_EXTENSION_STAND_IN
@@ -0,0 +1,417 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Checks that deduplicated messages come back as they were sent:
+ *
+ *   dedupcheck
+ *
+ * The encoder and the decoder of dedup.h are run against each other on
+ * random blobs sent again as they are, with bytes inserted or removed and
+ * with bits flipped, with a cache that holds them all and with one small
+ * enough to evict all the time, and across a reset in the middle of the
+ * stream. A decoder that missed a message must refuse the references to
+ * the chunks it did not get, and decode again once the encoder resets.
+ * Finally frames are written with SetDedupOptions() and read back with
+ * ReadFrame() over a socket pair. Linux only.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../src/asyncextension.h"
+#include "../src/dedup.h"
+#include "../src/eventloop.h"
+#include "../src/task.h"
+
+using namespace dcvext;
+
+namespace {
+
+enum
+{
+    BLOBS = 16,
+    MESSAGES = 1000,
+    MAX_MESSAGE = 1024 * 1024,
+    LARGE_CACHE = 64 * 1024 * 1024,
+    SMALL_CACHE = 256 * 1024,
+    CHANNEL_FRAMES = 300
+};
+
+const uint8_t MESSAGE_TYPE = 7;
+
+// Repeated payloads, random ones, and repeated ones shifted or damaged here and there
+class Workload
+{
+public:
+    explicit Workload(uint64_t seed)
+        : m_rng(seed),
+          m_blobs(BLOBS)
+    {
+        for (std::vector<uint8_t>& blob : m_blobs) {
+            blob.resize(16 * 1024 + m_rng() % (256 * 1024));
+            Fill(blob);
+        }
+    }
+
+    // True when the message repeats a blob with at most small changes
+    bool
+    Next(std::vector<uint8_t>& message)
+    {
+        switch (m_rng() % 8) {
+        case 0:
+            message.resize(1 + m_rng() % (128 * 1024));
+            Fill(message);
+            return false;
+        case 1:
+        case 2: {
+            message = m_blobs[m_rng() % BLOBS];
+            std::vector<uint8_t> inserted(1 + m_rng() % 100);
+            Fill(inserted);
+            message.insert(message.begin() + static_cast<long>(m_rng() % message.size()), inserted.begin(), inserted.end());
+            return true;
+        }
+        case 3: {
+            message = m_blobs[m_rng() % BLOBS];
+            size_t at = m_rng() % (message.size() - 200);
+            message.erase(message.begin() + static_cast<long>(at), message.begin() + static_cast<long>(at + 1 + m_rng() % 200));
+            return true;
+        }
+        case 4:
+            message = m_blobs[m_rng() % BLOBS];
+            message[m_rng() % message.size()] ^= static_cast<uint8_t>(1 << (m_rng() % 8));
+            return true;
+        default:
+            message = m_blobs[m_rng() % BLOBS];
+            return true;
+        }
+    }
+
+    const std::vector<uint8_t>&
+    Blob(size_t index) const
+    {
+        return m_blobs[index];
+    }
+
+private:
+    void
+    Fill(std::vector<uint8_t>& data)
+    {
+        for (uint8_t& byte : data) {
+            byte = static_cast<uint8_t>(m_rng());
+        }
+    }
+
+    std::mt19937_64 m_rng;
+    std::vector<std::vector<uint8_t>> m_blobs;
+};
+
+struct Codec
+{
+    DedupEncoder encoder;
+    DedupDecoder decoder;
+    std::vector<uint8_t> wire;
+    std::vector<uint8_t> decoded;
+    char error[128] = {};
+
+    explicit Codec(size_t cache_bytes)
+    {
+        encoder.Reset(cache_bytes);
+        decoder.SetMaxCacheBytes(LARGE_CACHE);
+    }
+
+    void
+    Encode(const std::vector<uint8_t>& message)
+    {
+        wire.clear();
+        encoder.Encode(MESSAGE_TYPE, message.data(), message.size(), wire);
+    }
+
+    bool
+    Decode()
+    {
+        uint8_t type;
+        error[0] = '\0';
+        return decoder.Decode(wire.data(), wire.size(), MAX_MESSAGE, type, decoded, error) && type == MESSAGE_TYPE;
+    }
+
+    // Encoded within the bound the channel checks, and decoded unchanged
+    bool
+    RoundTrip(const std::vector<uint8_t>& message)
+    {
+        Encode(message);
+        if (wire.size() > DedupEncoder::MaxEncodedSize(message.size())) {
+            snprintf(error, sizeof error, "%zu bytes encoded to %zu", message.size(), wire.size());
+            return false;
+        }
+
+        return Decode() && decoded == message;
+    }
+};
+
+bool
+Report(const char* name,
+       bool ok,
+       const DedupStats& stats)
+{
+    printf("%-28s %8llu %8llu %10.1f%% %8llu  %s\n",
+           name,
+           static_cast<unsigned long long>(stats.chunks),
+           static_cast<unsigned long long>(stats.chunk_hits),
+           stats.bytes_in > 0 ? 100.0 * static_cast<double>(stats.bytes_out) / static_cast<double>(stats.bytes_in) : 0.0,
+           static_cast<unsigned long long>(stats.evictions),
+           ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// The decoder sees what the encoder saw, whether the chunks stay cached or not
+bool
+CheckRoundTrips(const char* name,
+                size_t cache_bytes)
+{
+    Workload workload(1);
+    Codec codec(cache_bytes);
+    std::vector<uint8_t> message;
+    uint64_t shifted_hits = 0;
+    bool ok = true;
+
+    for (int i = 0; i < MESSAGES && ok; ++i) {
+        bool repeated = workload.Next(message);
+        uint64_t hits = codec.encoder.Stats().chunk_hits;
+
+        if (!codec.RoundTrip(message)) {
+            fprintf(stderr, "%s: message %d of %zu bytes did not come back: %s\n", name, i, message.size(), codec.error);
+            ok = false;
+        }
+        if (repeated) {
+            shifted_hits += codec.encoder.Stats().chunk_hits - hits;
+        }
+    }
+
+    const DedupStats& sent = codec.encoder.Stats();
+    const DedupStats& received = codec.decoder.Stats();
+
+    if (ok && (sent.chunk_hits != received.chunk_hits || sent.evictions != received.evictions)) {
+        fprintf(stderr, "%s: the caches went apart without failing\n", name);
+        ok = false;
+    }
+    if (ok && shifted_hits == 0) {
+        fprintf(stderr, "%s: nothing of the repeated payloads was found again\n", name);
+        ok = false;
+    }
+    if (ok && cache_bytes < LARGE_CACHE && sent.evictions == 0) {
+        fprintf(stderr, "%s: the small cache never evicted\n", name);
+        ok = false;
+    }
+
+    return Report(name, ok, sent);
+}
+
+// After a reset nothing sent before may be referred to, afterwards everything round trips again
+bool
+CheckReset()
+{
+    const char* name = "reset mid-stream";
+    Workload workload(2);
+    Codec codec(LARGE_CACHE);
+    std::vector<uint8_t> message;
+    bool ok = true;
+
+    for (int i = 0; i < MESSAGES && ok; ++i) {
+        if (i == MESSAGES / 2) {
+            codec.encoder.Reset(SMALL_CACHE);
+
+            uint64_t hits = codec.encoder.Stats().chunk_hits;
+            ok = codec.RoundTrip(workload.Blob(0)) && codec.encoder.Stats().chunk_hits == hits;
+            if (!ok) {
+                fprintf(stderr, "%s: the first message after the reset did not come back whole and unreferenced: %s\n",
+                        name, codec.error);
+                break;
+            }
+        }
+
+        workload.Next(message);
+        if (!codec.RoundTrip(message)) {
+            fprintf(stderr, "%s: message %d did not come back: %s\n", name, i, codec.error);
+            ok = false;
+        }
+    }
+
+    return Report(name, ok, codec.encoder.Stats());
+}
+
+// A decoder out of sync refuses the message with an error instead of returning wrong data
+bool
+CheckStaleReference()
+{
+    const char* name = "missed message";
+    Workload workload(3);
+    Codec codec(LARGE_CACHE);
+    bool ok = codec.RoundTrip(workload.Blob(0));
+
+    // Never delivered, the encoder believes its chunks are cached on the other end
+    codec.Encode(workload.Blob(1));
+    codec.Encode(workload.Blob(1));
+
+    if (ok && codec.Decode()) {
+        fprintf(stderr, "%s: references to chunks never received were decoded\n", name);
+        ok = false;
+    } else if (ok && codec.error[0] == '\0') {
+        fprintf(stderr, "%s: decoding failed without saying why\n", name);
+        ok = false;
+    } else if (ok) {
+        printf("%-28s refused: %s\n", "", codec.error);
+    }
+
+    // What the extension does on a decoding failure is up to it, a reset brings the two ends together again
+    codec.encoder.Reset(LARGE_CACHE);
+    if (ok && (!codec.RoundTrip(workload.Blob(1)) || !codec.RoundTrip(workload.Blob(1)))) {
+        fprintf(stderr, "%s: no recovery after a reset: %s\n", name, codec.error);
+        ok = false;
+    }
+
+    return Report(name, ok, codec.encoder.Stats());
+}
+
+struct ChannelRun
+{
+    EventLoop& loop;
+    std::vector<std::vector<uint8_t>> sent;
+    int running = 2;
+    bool ok = true;
+};
+
+void
+Finish(ChannelRun& run)
+{
+    if (--run.running == 0) {
+        run.loop.Stop();
+    }
+}
+
+Task<void>
+WriteFrames(AsyncVirtualChannel& channel,
+            ChannelRun& run)
+{
+    for (const std::vector<uint8_t>& message : run.sent) {
+        if (!co_await channel.WriteFrame(message.data(), message.size())) {
+            fprintf(stderr, "channel: could not write a frame of %zu bytes\n", message.size());
+            run.ok = false;
+            break;
+        }
+    }
+
+    Finish(run);
+}
+
+Task<void>
+ReadFrames(AsyncVirtualChannel& channel,
+           ChannelRun& run)
+{
+    for (size_t i = 0; i < run.sent.size() && run.ok; ++i) {
+        Frame frame;
+        if (!co_await channel.ReadFrame(frame)) {
+            fprintf(stderr, "channel: could not read frame %zu\n", i);
+            run.ok = false;
+        } else if (frame.size != run.sent[i].size() || memcmp(frame.data, run.sent[i].data(), frame.size) != 0) {
+            fprintf(stderr, "channel: frame %zu does not match what was written\n", i);
+            run.ok = false;
+        }
+    }
+
+    Finish(run);
+}
+
+// Both ends on one loop, the writer deduplicates with a small cache, the reader decodes regardless
+bool
+CheckChannel()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        fprintf(stderr, "socketpair failed: %i\n", errno);
+        return false;
+    }
+
+    EventLoop loop;
+    AsyncExtension extension(loop);
+    std::unique_ptr<AsyncVirtualChannel> writer = loop.IsValid() ? extension.AttachChannel("writer", fds[0]) : nullptr;
+    std::unique_ptr<AsyncVirtualChannel> reader = loop.IsValid() ? extension.AttachChannel("reader", fds[1]) : nullptr;
+    if (writer == nullptr || reader == nullptr) {
+        fprintf(stderr, "Could not attach the socket pair\n");
+        return false;
+    }
+
+    FrameOptions frame_options;
+    frame_options.crc32c = true;
+    writer->SetFrameOptions(frame_options);
+    reader->SetFrameOptions(frame_options);
+
+    DedupOptions dedup;
+    dedup.enabled = true;
+    dedup.cache_bytes = 1024 * 1024;
+    writer->SetDedupOptions(dedup);
+
+    ChannelRun run{ loop, {}, 2, true };
+    Workload workload(4);
+    run.sent.resize(CHANNEL_FRAMES);
+    for (std::vector<uint8_t>& message : run.sent) {
+        workload.Next(message);
+    }
+
+    Spawn(ReadFrames(*reader, run));
+    Spawn(WriteFrames(*writer, run));
+    loop.Run();
+
+    const DedupStats& sent = writer->GetSentDedupStats();
+    const DedupStats& received = reader->GetReceivedDedupStats();
+
+    if (run.ok && (sent.messages != received.messages || sent.chunk_hits != received.chunk_hits)) {
+        fprintf(stderr, "channel: %llu frames deduplicated, %llu decoded\n",
+                static_cast<unsigned long long>(sent.messages), static_cast<unsigned long long>(received.messages));
+        run.ok = false;
+    }
+    if (run.ok && sent.chunk_hits == 0) {
+        fprintf(stderr, "channel: no chunk was sent as a reference\n");
+        run.ok = false;
+    }
+
+    return Report("SetDedupOptions() channel", run.ok, sent);
+}
+
+} // namespace
+
+int
+main()
+{
+    printf("%-28s %8s %8s %11s %8s\n", "", "chunks", "refs", "on wire", "evicted");
+
+    bool ok = CheckRoundTrips("random and shifted", LARGE_CACHE);
+    ok = CheckRoundTrips("small cache", SMALL_CACHE) && ok;
+    ok = CheckReset() && ok;
+    ok = CheckStaleReference() && ok;
+    ok = CheckChannel() && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,455 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Finds how many extension instances a host takes:
+ *
+ *   loadgen [-r 1,2,4,8] [-c channels] [-m messages] [-s sizes] [-i interval_ms]
+ *           [-l channel_limit] <extension> [extension args...]
+ *
+ * For every step of the ramp the tool starts that many instances of the
+ * extension at once, each running the coroutine based echo flow with the
+ * given channel count and traffic (--async --channels --messages --size
+ * --interval), and stands in for DCV for all of them: it answers their
+ * requests, serves their relays and echoes their data. With a channel limit,
+ * setup requests beyond that many open channels on the host fail with
+ * ERROR_TOO_MANY_VIRTUAL_CHANNELS as they would with DCV. Each step reports
+ * setup latency, aggregate echo throughput, CPU and peak RSS of the
+ * instances, and errors. Linux only.
+ */
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcvstandin.h"
+
+using namespace dcv::extensions;
+using namespace dcvext;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum
+{
+    ACCEPT_TIMEOUT_MS = 10000,
+    EXIT_TIMEOUT_MS = 10000,
+    ECHO_BUFFER_SIZE = 64 * 1024
+};
+
+const std::string TOKEN = "loadgen";
+
+struct Options
+{
+    std::vector<int> ramp = { 1, 2, 4, 8, 16 };
+    std::string channels = "1";
+    std::string messages = "100";
+    std::string sizes = "64,1024,16384";
+    std::string interval_ms = "10";
+    int channel_limit = 0;
+    std::vector<char*> extension;
+};
+
+// Everything the stand-in saw of one step, updated by all instance threads
+struct StepCounters
+{
+    std::mutex lock;
+    std::vector<double> setup_ms;
+    uint64_t bytes = 0;
+    int channels_ready = 0;
+    int too_many_channels = 0;
+    int setup_failures = 0;
+    int instances_failed = 0;
+    double cpu_seconds = 0;
+    std::vector<long> max_rss_kb;
+};
+
+std::atomic<int> open_channels{ 0 };
+std::atomic<int> relay_serial{ 0 };
+
+class Instance
+{
+public:
+    Instance(const Options& options,
+             StepCounters& counters)
+        : m_options(options),
+          m_counters(counters)
+    {
+    }
+
+    bool
+    Start(char* const argv[])
+    {
+        if (!SpawnExtension(argv, m_process)) {
+            return false;
+        }
+
+        m_control = std::thread(&Instance::Control, this);
+        return true;
+    }
+
+    void
+    Join()
+    {
+        m_control.join();
+    }
+
+private:
+    bool
+    Send(const DcvMessage& msg)
+    {
+        std::lock_guard<std::mutex> guard(m_send_lock);
+        return WriteDcvMessage(m_process.input, msg, m_send_scratch);
+    }
+
+    void
+    Control()
+    {
+        ExtensionMessage msg;
+        std::string scratch;
+
+        while (ReadExtensionMessage(m_process.output, msg, scratch)) {
+            if (!msg.has_request()) {
+                continue;
+            }
+
+            const Request& request = msg.request();
+            DcvMessage reply;
+            Response* response = reply.mutable_response();
+            response->set_request_id(request.request_id());
+            response->set_status(Response_Status_SUCCESS);
+
+            if (request.has_get_dcv_info_request()) {
+                response->mutable_get_dcv_info_response()->set_dcv_role(GetDcvInfoResponse_DcvRole_Server);
+                response->mutable_get_dcv_info_response()->set_dcv_process_id(getpid());
+            } else if (request.has_setup_virtual_channel_request()) {
+                SetupChannel(request.setup_virtual_channel_request().virtual_channel_name(), *response);
+            } else if (request.has_close_virtual_channel_request()) {
+                response->mutable_close_virtual_channel_response()->set_virtual_channel_name(
+                    request.close_virtual_channel_request().virtual_channel_name());
+            }
+
+            if (!Send(reply)) {
+                break;
+            }
+        }
+
+        for (std::thread& relay : m_relays) {
+            relay.join();
+        }
+
+        rusage usage = {};
+        int status = StopExtension(m_process, EXIT_TIMEOUT_MS, &usage);
+
+        std::lock_guard<std::mutex> guard(m_counters.lock);
+        if (status != 0) {
+            m_counters.instances_failed++;
+        }
+        m_counters.cpu_seconds += static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+            + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        m_counters.max_rss_kb.push_back(usage.ru_maxrss);
+    }
+
+    void
+    SetupChannel(const std::string& name,
+                 Response& response)
+    {
+        // Counted as open from the request on, as DCV would
+        if (m_options.channel_limit > 0 && open_channels.fetch_add(1) >= m_options.channel_limit) {
+            open_channels--;
+            response.set_status(Response_Status_ERROR_TOO_MANY_VIRTUAL_CHANNELS);
+
+            std::lock_guard<std::mutex> guard(m_counters.lock);
+            m_counters.too_many_channels++;
+            return;
+        }
+        if (m_options.channel_limit <= 0) {
+            open_channels++;
+        }
+
+        auto listener = std::make_unique<RelayListener>();
+        std::string relay = "loadgen-" + std::to_string(getpid()) + "-" + std::to_string(relay_serial++);
+
+        if (!listener->Listen(relay)) {
+            open_channels--;
+            response.set_status(Response_Status_ERROR_GENERIC);
+
+            std::lock_guard<std::mutex> guard(m_counters.lock);
+            m_counters.setup_failures++;
+            return;
+        }
+
+        SetupVirtualChannelResponse* setup = response.mutable_setup_virtual_channel_response();
+        setup->set_virtual_channel_name(name);
+        setup->set_relay_path(relay);
+        setup->set_relay_server_process_id(getpid());
+        setup->set_virtual_channel_auth_token(TOKEN);
+
+        m_relays.emplace_back(&Instance::Relay, this, std::move(listener), name, Clock::now());
+    }
+
+    // Wait for the extension to connect, tell it the channel is ready and echo
+    void
+    Relay(std::unique_ptr<RelayListener> listener,
+          std::string name,
+          Clock::time_point requested)
+    {
+        int fd = listener->Accept(ACCEPT_TIMEOUT_MS);
+        std::string token(TOKEN.size(), '\0');
+
+        if (fd < 0 || !ReadExact(fd, &token[0], token.size()) || token != TOKEN) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            open_channels--;
+
+            std::lock_guard<std::mutex> guard(m_counters.lock);
+            m_counters.setup_failures++;
+            return;
+        }
+
+        DcvMessage ready;
+        ready.mutable_event()->mutable_virtual_channel_ready_event()->set_virtual_channel_name(name);
+        Send(ready);
+
+        {
+            std::lock_guard<std::mutex> guard(m_counters.lock);
+            m_counters.setup_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - requested).count());
+            m_counters.channels_ready++;
+        }
+
+        std::vector<uint8_t> buffer(ECHO_BUFFER_SIZE);
+        uint64_t bytes = 0;
+
+        for (;;) {
+            ssize_t res = read(fd, buffer.data(), buffer.size());
+            if (res <= 0 || !WriteExact(fd, buffer.data(), static_cast<size_t>(res))) {
+                break;
+            }
+            bytes += static_cast<uint64_t>(res);
+        }
+
+        close(fd);
+        open_channels--;
+
+        std::lock_guard<std::mutex> guard(m_counters.lock);
+        m_counters.bytes += bytes;
+    }
+
+    const Options& m_options;
+    StepCounters& m_counters;
+    ExtensionProcess m_process;
+    std::thread m_control;
+    std::vector<std::thread> m_relays;
+    std::mutex m_send_lock;
+    std::string m_send_scratch;
+};
+
+double
+Percentile(std::vector<double> values,
+           double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())))];
+}
+
+double
+SelfCpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+bool
+ParseRamp(const char* list,
+          std::vector<int>& ramp)
+{
+    ramp.clear();
+
+    while (*list != '\0') {
+        char* end;
+        long value = strtol(list, &end, 10);
+
+        if (end == list || value <= 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+
+        ramp.push_back(static_cast<int>(value));
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return !ramp.empty();
+}
+
+void
+Usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-r 1,2,4,8] [-c channels] [-m messages] [-s sizes] [-i interval_ms] [-l channel_limit]\n"
+            "       <extension> [extension args...]\n",
+            name);
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    Options options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        const char* value = argv[arg + 1];
+
+        if (strcmp(argv[arg], "-r") == 0) {
+            if (!ParseRamp(value, options.ramp)) {
+                Usage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            options.channels = value;
+        } else if (strcmp(argv[arg], "-m") == 0) {
+            options.messages = value;
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            options.sizes = value;
+        } else if (strcmp(argv[arg], "-i") == 0) {
+            options.interval_ms = value;
+        } else if (strcmp(argv[arg], "-l") == 0) {
+            options.channel_limit = atoi(value);
+        } else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (arg >= argc) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<std::string> async_args = { "--async",   "--channels",       options.channels, "--messages",
+                                            options.messages, "--size", options.sizes,    "--interval",
+                                            options.interval_ms };
+
+    options.extension.push_back(argv[arg]);
+    for (std::string& async_arg : async_args) {
+        options.extension.push_back(&async_arg[0]);
+    }
+    for (int extra = arg + 1; extra < argc; ++extra) {
+        options.extension.push_back(argv[extra]);
+    }
+    options.extension.push_back(nullptr);
+
+    printf("%s channels, %s messages of %s bytes, %s ms apart, channel limit %i\n\n",
+           options.channels.c_str(),
+           options.messages.c_str(),
+           options.sizes.c_str(),
+           options.interval_ms.c_str(),
+           options.channel_limit);
+    printf("%9s %7s %8s %9s %9s %9s %10s %9s %9s %10s %10s\n",
+           "instances",
+           "failed",
+           "channels",
+           "too many",
+           "setup p50",
+           "setup p99",
+           "echo MB/s",
+           "CPU %",
+           "CPU ms/i",
+           "RSS kB avg",
+           "RSS kB max");
+    fflush(stdout);
+
+    bool clean = true;
+
+    for (int count : options.ramp) {
+        StepCounters counters;
+        std::vector<std::unique_ptr<Instance>> instances;
+        double self_cpu = SelfCpuSeconds();
+        Clock::time_point start = Clock::now();
+
+        for (int i = 0; i < count; ++i) {
+            auto instance = std::make_unique<Instance>(options, counters);
+            if (!instance->Start(options.extension.data())) {
+                std::lock_guard<std::mutex> guard(counters.lock);
+                counters.instances_failed++;
+                continue;
+            }
+            instances.push_back(std::move(instance));
+        }
+
+        for (auto& instance : instances) {
+            instance->Join();
+        }
+
+        double wall = std::chrono::duration<double>(Clock::now() - start).count();
+        double rss_sum = 0;
+        long rss_max = 0;
+        for (long rss : counters.max_rss_kb) {
+            rss_sum += static_cast<double>(rss);
+            rss_max = std::max(rss_max, rss);
+        }
+
+        printf("%9i %7i %8i %9i %7.2fms %7.2fms %10.2f %9.1f %9.1f %10.0f %10li\n",
+               count,
+               counters.instances_failed,
+               counters.channels_ready,
+               counters.too_many_channels,
+               Percentile(counters.setup_ms, 0.5),
+               Percentile(counters.setup_ms, 0.99),
+               static_cast<double>(counters.bytes) / wall / 1e6,
+               100.0 * counters.cpu_seconds / wall,
+               1000.0 * counters.cpu_seconds / count,
+               counters.max_rss_kb.empty() ? 0.0 : rss_sum / static_cast<double>(counters.max_rss_kb.size()),
+               rss_max);
+        fflush(stdout);
+        fprintf(stderr,
+                "  step of %i: %.2f s, %i setup failures, stand-in CPU %.1f%%\n",
+                count,
+                wall,
+                counters.setup_failures,
+                100.0 * (SelfCpuSeconds() - self_cpu) / wall);
+
+        clean = clean && counters.instances_failed == 0 && counters.setup_failures == 0
+            && counters.too_many_channels == 0;
+    }
+
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Compares the latency of blocking and busy polling event loops reading a
+ * relay-like unix socket:
+ *
+ *   pollbench [-n messages] [-i interval_us] [-c loop_cpu] [-s sender_cpu]
+ *
+ * A sender thread writes small messages stamped with the monotonic clock at
+ * randomized intervals, as interactive traffic would come in. For every
+ * message the reader reports the wake up latency (until the loop saw the read
+ * complete) and the read latency (until the reading coroutine got to run),
+ * along with the CPU time the loop thread used. Linux only.
+ */
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/eventloop.h"
+#include "../src/task.h"
+
+using namespace dcvext;
+
+namespace {
+
+enum
+{
+    MESSAGE_SIZE = 64,
+    READ_BUFFER_SIZE = 64 * 1024
+};
+
+struct Options
+{
+    int messages = 20000;
+    int interval_us = 500;
+    int loop_cpu = -1;
+    int sender_cpu = -1;
+};
+
+struct Result
+{
+    std::vector<int64_t> wake_ns;
+    std::vector<int64_t> read_ns;
+    double cpu_seconds = 0;
+    double wall_seconds = 0;
+    BusyPollStats busy;
+};
+
+int64_t
+Nanoseconds(Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+double
+ThreadCpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void
+PinThread(int cpu)
+{
+    if (cpu < 0) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof set, &set) != 0) {
+        fprintf(stderr, "Could not pin the sender to CPU %i\n", cpu);
+    }
+}
+
+// Messages go out at exponentially distributed intervals around interval_us
+void
+Sender(int fd,
+       const Options& options)
+{
+    PinThread(options.sender_cpu);
+
+    std::mt19937_64 rng(1);
+    std::exponential_distribution<double> gap(1.0 / options.interval_us);
+    uint8_t message[MESSAGE_SIZE] = {};
+    Clock::time_point next = Clock::now();
+
+    for (int i = 0; i < options.messages; ++i) {
+        next += std::chrono::microseconds(static_cast<int64_t>(gap(rng)));
+        std::this_thread::sleep_until(next);
+
+        int64_t sent = Nanoseconds(Clock::now().time_since_epoch());
+        memcpy(message, &sent, sizeof sent);
+
+        if (send(fd, message, sizeof message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof message)) {
+            fprintf(stderr, "Send failed: %i\n", errno);
+            break;
+        }
+    }
+}
+
+Task<void>
+Reader(EventLoop& loop,
+       IoObject& socket,
+       int messages,
+       Result& result)
+{
+    std::vector<uint8_t> buffer(READ_BUFFER_SIZE);
+    size_t pending = 0;
+    int received = 0;
+
+    while (received < messages) {
+        IoAwaiter read = loop.Read(socket, buffer.data() + pending, buffer.size() - pending);
+        IoResult res = co_await read;
+        Clock::time_point resumed = Clock::now();
+
+        if (!res.Ok() || res.bytes == 0) {
+            fprintf(stderr, "Read failed: %u\n", res.error);
+            break;
+        }
+
+        pending += res.bytes;
+
+        size_t offset = 0;
+        for (; pending - offset >= MESSAGE_SIZE; offset += MESSAGE_SIZE) {
+            int64_t sent;
+            memcpy(&sent, buffer.data() + offset, sizeof sent);
+
+            result.wake_ns.push_back(Nanoseconds(read.completed.time_since_epoch()) - sent);
+            result.read_ns.push_back(Nanoseconds(resumed.time_since_epoch()) - sent);
+            received++;
+        }
+
+        memmove(buffer.data(), buffer.data() + offset, pending - offset);
+        pending -= offset;
+    }
+
+    loop.Stop();
+}
+
+bool
+RunCase(bool busy,
+        const Options& options,
+        Result& result)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        fprintf(stderr, "socketpair failed: %i\n", errno);
+        return false;
+    }
+
+    EventLoop loop;
+    IoObject socket = {};
+    socket.handle = fds[0];
+    socket.socket = true;
+
+    if (!loop.IsValid() || !loop.Register(socket)) {
+        return false;
+    }
+
+    BusyPollOptions busy_options;
+    busy_options.enabled = busy;
+    busy_options.cpu = options.loop_cpu;
+    loop.SetBusyPoll(busy_options);
+
+    result.wake_ns.reserve(options.messages);
+    result.read_ns.reserve(options.messages);
+
+    double cpu_start = ThreadCpuSeconds();
+    Clock::time_point wall_start = Clock::now();
+
+    std::thread sender(Sender, fds[1], std::cref(options));
+    Spawn(Reader(loop, socket, options.messages, result));
+    loop.Run();
+    sender.join();
+
+    result.cpu_seconds = ThreadCpuSeconds() - cpu_start;
+    result.wall_seconds = std::chrono::duration<double>(Clock::now() - wall_start).count();
+    result.busy = loop.GetBusyPollStats();
+
+    loop.Unregister(socket);
+    close(fds[0]);
+    close(fds[1]);
+
+    return true;
+}
+
+double
+Percentile(std::vector<int64_t>& values,
+           double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+
+    return static_cast<double>(values[index]) / 1000.0;
+}
+
+void
+PrintRow(const char* name,
+         std::vector<int64_t>& values)
+{
+    printf("  %-14s p50 %8.1f   p90 %8.1f   p99 %8.1f   p99.9 %8.1f   max %8.1f us\n",
+           name,
+           Percentile(values, 0.5),
+           Percentile(values, 0.9),
+           Percentile(values, 0.99),
+           Percentile(values, 0.999),
+           Percentile(values, 1.0));
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    Options options;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+            options.messages = atoi(argv[++arg]);
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-i") == 0) {
+            options.interval_us = atoi(argv[++arg]);
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-c") == 0) {
+            options.loop_cpu = atoi(argv[++arg]);
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-s") == 0) {
+            options.sender_cpu = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "usage: %s [-n messages] [-i interval_us] [-c loop_cpu] [-s sender_cpu]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (options.messages <= 0 || options.interval_us <= 0) {
+        fprintf(stderr, "Messages and interval must be positive\n");
+        return 2;
+    }
+
+    printf("%i messages of %i bytes, %i us apart on average, %u CPUs\n",
+           options.messages,
+           MESSAGE_SIZE,
+           options.interval_us,
+           std::thread::hardware_concurrency());
+
+    for (bool busy : { false, true }) {
+        Result result;
+
+        // Each case on its own thread, so that pinning the loop does not stick
+        bool ok = false;
+        std::thread runner([&] { ok = RunCase(busy, options, result); });
+        runner.join();
+        if (!ok) {
+            return 1;
+        }
+
+        printf("%s\n", busy ? "busy poll" : "blocking");
+        PrintRow("wake up", result.wake_ns);
+        PrintRow("read", result.read_ns);
+        printf("  loop CPU       %.1f%% of %.2f s\n", 100.0 * result.cpu_seconds / result.wall_seconds,
+               result.wall_seconds);
+
+        if (busy && result.busy.spins == 0 && result.busy.parks == 0) {
+            printf("  spinning is disabled on a single CPU, the numbers above are for blocking reads\n");
+        } else if (busy) {
+            printf("  spins          %" PRIu64 ", %.1f%% found work, %" PRIu64 " parks, budget %lld us\n",
+                   result.busy.spins,
+                   result.busy.spins != 0
+                       ? 100.0 * static_cast<double>(result.busy.spin_hits) / static_cast<double>(result.busy.spins)
+                       : 0.0,
+                   result.busy.parks,
+                   static_cast<long long>(
+                       std::chrono::duration_cast<std::chrono::microseconds>(result.busy.spin_budget).count()));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Checks the guarantees of HandlerPool under saturation:
+ *
+ *   poolcheck [workers]
+ *
+ * Submitters push numbered messages on streams of their own into a pool
+ * that only takes a few pending messages, so most submissions have to wait
+ * for room. Handlers take a little random time and assert that the messages
+ * of a stream come one at a time, in order, none lost or repeated. The
+ * submitters block in Submit() on threads, wait in SubmitAsync() on an
+ * event loop, and then do both on the same pool at once. A phase that does
+ * not finish within a deadline means a submitter was never woken up again.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/bufferpool.h"
+#include "../src/eventloop.h"
+#include "../src/handlerpool.h"
+#include "../src/task.h"
+
+using namespace dcvext;
+
+namespace {
+
+enum
+{
+    MAX_PENDING = 8,
+    STREAMS_PER_SUBMITTER = 4,
+    MESSAGES_PER_STREAM = 20000,
+    SUBMITTER_THREADS = 3,
+    SUBMITTER_COROUTINES = 3,
+    PHASE_TIMEOUT_S = 60
+};
+
+struct StreamCheck
+{
+    HandlerStream* stream = nullptr;
+    uint32_t next = 0;
+    std::atomic<int> running{ 0 };
+    std::atomic<bool> failed{ false };
+};
+
+struct Message
+{
+    uint32_t stream;
+    uint32_t sequence;
+};
+
+std::vector<std::unique_ptr<StreamCheck>> streams;
+std::atomic<uint64_t> unordered{ 0 };
+
+void
+Work(uint32_t seed)
+{
+    // Up to about 20 us, enough for the submitters to fill the pool up
+    auto until = Clock::now() + std::chrono::nanoseconds(seed % 20000);
+    while (Clock::now() < until) {
+    }
+}
+
+void
+HandleOrdered(void* context,
+              BufferSlice& message)
+{
+    StreamCheck& check = *static_cast<StreamCheck*>(context);
+    Message header;
+    memcpy(&header, message.Data(), sizeof header);
+
+    if (check.running.fetch_add(1) != 0) {
+        fprintf(stderr, "stream %u: two messages handled at once\n", header.stream);
+        check.failed = true;
+    }
+    if (header.sequence != check.next) {
+        fprintf(stderr, "stream %u: got message %u, expected %u\n", header.stream, header.sequence, check.next);
+        check.failed = true;
+    }
+
+    check.next = header.sequence + 1;
+    Work(header.sequence * 2654435761u);
+    check.running--;
+}
+
+void
+HandleUnordered(void* /*context*/,
+                BufferSlice& message)
+{
+    Message header;
+    memcpy(&header, message.Data(), sizeof header);
+    Work(header.sequence * 40503u);
+    unordered++;
+}
+
+BufferSlice
+MakeMessage(ReceiveBuffer& buffer,
+            uint32_t stream,
+            uint32_t sequence)
+{
+    size_t size;
+    uint8_t* data = buffer.Prepare(size);
+    Message header = { stream, sequence };
+    memcpy(data, &header, sizeof header);
+    return buffer.Commit(sizeof header);
+}
+
+// Streams first .. first + STREAMS_PER_SUBMITTER - 1 in turn, every fifth message without a stream
+void
+SubmitBlocking(HandlerPool& pool,
+               uint32_t first)
+{
+    ReceiveBuffer buffer(DefaultBufferPool());
+
+    for (uint32_t sequence = 0; sequence < MESSAGES_PER_STREAM; ++sequence) {
+        for (uint32_t i = first; i < first + STREAMS_PER_SUBMITTER; ++i) {
+            StreamCheck& check = *streams[i];
+            pool.Submit(check.stream, HandleOrdered, &check, MakeMessage(buffer, i, sequence));
+        }
+        if (sequence % 5 == 0) {
+            pool.Submit(nullptr, HandleUnordered, nullptr, MakeMessage(buffer, 0, sequence));
+        }
+    }
+}
+
+Task<void>
+SubmitAsync(EventLoop& loop,
+            HandlerPool& pool,
+            uint32_t first,
+            int& running)
+{
+    ReceiveBuffer buffer(DefaultBufferPool());
+
+    for (uint32_t sequence = 0; sequence < MESSAGES_PER_STREAM; ++sequence) {
+        for (uint32_t i = first; i < first + STREAMS_PER_SUBMITTER; ++i) {
+            StreamCheck& check = *streams[i];
+            co_await pool.SubmitAsync(loop, check.stream, HandleOrdered, &check, MakeMessage(buffer, i, sequence));
+        }
+        if (sequence % 5 == 0) {
+            co_await pool.SubmitAsync(loop, nullptr, HandleUnordered, nullptr, MakeMessage(buffer, 0, sequence));
+        }
+    }
+
+    if (--running == 0) {
+        loop.Stop();
+    }
+}
+
+// Fails the whole run when a phase takes too long, a lost wake up hangs forever
+class Watchdog
+{
+public:
+    explicit Watchdog(const char* phase)
+        : m_phase(phase),
+          m_thread(&Watchdog::Watch, this)
+    {
+    }
+
+    ~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_done = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+private:
+    void
+    Watch()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        if (!m_wake.wait_for(lock, std::chrono::seconds(PHASE_TIMEOUT_S), [this]() { return m_done; })) {
+            fflush(stdout);
+            fprintf(stderr, "%s: not done after %d s, a submitter was not woken up\n", m_phase, PHASE_TIMEOUT_S);
+            std::_Exit(1);
+        }
+    }
+
+    const char* m_phase;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_done = false;
+    std::thread m_thread;
+};
+
+bool
+RunPhase(const char* phase,
+         unsigned workers,
+         int threads,
+         int coroutines)
+{
+    HandlerPool pool(workers, MAX_PENDING);
+    int submitters = threads + coroutines;
+
+    streams.clear();
+    for (int i = 0; i < submitters * STREAMS_PER_SUBMITTER; ++i) {
+        streams.push_back(std::make_unique<StreamCheck>());
+        streams.back()->stream = pool.OpenStream();
+    }
+    unordered = 0;
+
+    auto start = Clock::now();
+    {
+        Watchdog watchdog(phase);
+        std::vector<std::thread> blocking;
+
+        for (int i = 0; i < threads; ++i) {
+            blocking.emplace_back(SubmitBlocking, std::ref(pool), static_cast<uint32_t>(i * STREAMS_PER_SUBMITTER));
+        }
+
+        if (coroutines > 0) {
+            EventLoop loop;
+            if (!loop.IsValid()) {
+                std::_Exit(1);
+            }
+
+            int running = coroutines;
+            for (int i = threads; i < submitters; ++i) {
+                Spawn(SubmitAsync(loop, pool, static_cast<uint32_t>(i * STREAMS_PER_SUBMITTER), running));
+            }
+            loop.Run();
+        }
+
+        for (std::thread& thread : blocking) {
+            thread.join();
+        }
+        pool.Drain();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    bool ok = true;
+    for (const auto& check : streams) {
+        if (check->failed || check->next != MESSAGES_PER_STREAM) {
+            ok = false;
+        }
+    }
+
+    uint64_t expected_unordered = static_cast<uint64_t>(submitters) * ((MESSAGES_PER_STREAM + 4) / 5);
+    if (unordered != expected_unordered) {
+        fprintf(stderr, "%s: %llu messages without a stream handled, expected %llu\n", phase,
+                static_cast<unsigned long long>(unordered.load()), static_cast<unsigned long long>(expected_unordered));
+        ok = false;
+    }
+
+    HandlerPoolStats stats = pool.Stats();
+    if (stats.saturated == 0) {
+        fprintf(stderr, "%s: the pool never saturated, nothing was checked\n", phase);
+        ok = false;
+    }
+
+    printf("%-24s %10llu %10llu %8.2f s  %s\n",
+           phase,
+           static_cast<unsigned long long>(stats.submitted),
+           static_cast<unsigned long long>(stats.saturated),
+           seconds,
+           ok ? "ok" : "FAILED");
+    return ok;
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    unsigned workers = 4;
+
+    if (argc > 1) {
+        workers = static_cast<unsigned>(atoi(argv[1]));
+        if (workers == 0) {
+            fprintf(stderr, "usage: poolcheck [workers]\n");
+            return 2;
+        }
+    }
+
+    printf("%u workers, at most %d pending, %d messages on each of %d streams per submitter\n\n",
+           workers,
+           MAX_PENDING,
+           MESSAGES_PER_STREAM,
+           STREAMS_PER_SUBMITTER);
+    printf("%-24s %10s %10s %10s\n", "submitters", "submitted", "waited", "time");
+
+    bool ok = RunPhase("Submit() threads", workers, SUBMITTER_THREADS, 0);
+    ok = RunPhase("SubmitAsync() coroutines", workers, 0, SUBMITTER_COROUTINES) && ok;
+    ok = RunPhase("both at once", workers, SUBMITTER_THREADS, SUBMITTER_COROUTINES) && ok;
+
+    return ok ? 0 : 1;
+}
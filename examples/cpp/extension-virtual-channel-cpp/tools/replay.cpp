@@ -0,0 +1,318 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Replays a capture taken with DCV_EXTENSION_CAPTURE against an extension:
+ *
+ *   dcvreplay [--fast] <capture.dcvcap> <extension> [extension args...]
+ *
+ * The tool stands in for DCV. Control messages and channel data that DCV
+ * sent in the capture are fed to the extension, either at their original
+ * pacing or, with --fast, as fast as the extension takes them. What the
+ * extension sends back is drained and counted against the capture, and
+ * also keeps the replay causal: nothing is fed to the extension before it
+ * has sent what it had sent at that point of the capture (a response never
+ * overtakes its request, an echo never overtakes the data echoed).
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/trafficlog.h"
+#include "dcvstandin.h"
+
+using namespace dcv::extensions;
+using namespace dcvext;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum
+{
+    ACCEPT_TIMEOUT_MS = 10000,
+    EXIT_TIMEOUT_MS = 10000,
+    SYNC_TIMEOUT_MS = 10000,
+    DRAIN_BUFFER_SIZE = 64 * 1024
+};
+
+// Recorded tokens are redacted, the extension gets this one instead
+const std::string REPLAY_TOKEN = "dcvreplay";
+
+struct Counters
+{
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+};
+
+struct Channel
+{
+    int fd = -1;
+    std::thread drain;
+};
+
+// What the extension has sent so far, updated by the drain threads
+std::mutex progress_lock;
+std::condition_variable progress_changed;
+Counters control_sent;
+uint64_t channel_bytes_sent = 0;
+
+void
+DrainControl(int fd)
+{
+    ExtensionMessage msg;
+    std::string scratch;
+
+    while (ReadExtensionMessage(fd, msg, scratch)) {
+        std::lock_guard<std::mutex> guard(progress_lock);
+        control_sent.messages++;
+        control_sent.bytes += scratch.size();
+        progress_changed.notify_all();
+    }
+}
+
+void
+DrainChannel(int fd)
+{
+    std::vector<uint8_t> buffer(DRAIN_BUFFER_SIZE);
+
+    for (;;) {
+        ssize_t res = read(fd, buffer.data(), buffer.size());
+        if (res <= 0) {
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard(progress_lock);
+        channel_bytes_sent += static_cast<uint64_t>(res);
+        progress_changed.notify_all();
+    }
+}
+
+// Wait until the extension has caught up with the capture
+bool
+WaitForExtension(const Counters& control_out,
+                 const Counters& channel_out)
+{
+    std::unique_lock<std::mutex> guard(progress_lock);
+
+    return progress_changed.wait_for(guard, std::chrono::milliseconds(SYNC_TIMEOUT_MS), [&] {
+        return control_sent.messages >= control_out.messages && channel_bytes_sent >= channel_out.bytes;
+    });
+}
+
+double
+Milliseconds(uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e6;
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    bool fast = false;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "--fast") == 0) {
+        fast = true;
+        arg++;
+    }
+
+    if (argc - arg < 2) {
+        fprintf(stderr, "usage: %s [--fast] <capture.dcvcap> <extension> [extension args...]\n", argv[0]);
+        return 2;
+    }
+
+    TrafficLogReader reader;
+    if (!reader.Open(argv[arg])) {
+        return 1;
+    }
+
+    ExtensionProcess extension;
+    if (!SpawnExtension(argv + arg + 1, extension)) {
+        return 1;
+    }
+
+    std::thread control_drain(DrainControl, extension.output);
+    std::deque<std::unique_ptr<RelayListener>> listeners;
+    std::unordered_map<uint32_t, Channel> channels;
+    Counters control_in, control_out, channel_in, channel_out;
+    std::string scratch;
+    uint64_t last_timestamp_ns = 0;
+    uint64_t diverged = 0;
+    int relays = 0;
+    bool failed = false;
+
+    Clock::time_point start = Clock::now();
+    TrafficRecord record;
+
+    while (!failed && reader.Next(record)) {
+        last_timestamp_ns = record.timestamp_ns;
+
+        if (!fast) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(record.timestamp_ns));
+        }
+
+        if (record.kind != TRAFFIC_CONTROL_OUT && record.kind != TRAFFIC_CHANNEL_OUT
+            && !WaitForExtension(control_out, channel_out)) {
+            fprintf(stderr, "Extension diverged from the capture at %.3f ms\n", Milliseconds(record.timestamp_ns));
+            diverged++;
+        }
+
+        switch (record.kind) {
+        case TRAFFIC_CONTROL_IN: {
+            DcvMessage msg;
+
+            control_in.messages++;
+            control_in.bytes += record.length;
+
+            if (!msg.ParseFromArray(record.data, static_cast<int>(record.length))) {
+                fprintf(stderr, "Skipping unparseable control message at %.3f ms\n",
+                        Milliseconds(record.timestamp_ns));
+                break;
+            }
+
+            if (msg.has_response() && msg.response().has_setup_virtual_channel_response()
+                && msg.response().status() == Response_Status_SUCCESS) {
+                // Point the extension to a relay of ours
+                auto listener = std::make_unique<RelayListener>();
+                std::string name = "dcvreplay-" + std::to_string(getpid()) + "-" + std::to_string(relays++);
+
+                if (!listener->Listen(name)) {
+                    failed = true;
+                    break;
+                }
+
+                SetupVirtualChannelResponse* setup = msg.mutable_response()->mutable_setup_virtual_channel_response();
+                setup->set_relay_path(name);
+                setup->set_virtual_channel_auth_token(REPLAY_TOKEN);
+                listeners.push_back(std::move(listener));
+
+                failed = !WriteDcvMessage(extension.input, msg, scratch);
+                break;
+            }
+
+            failed = !WriteFrame(extension.input, record.data, record.length);
+            break;
+        }
+
+        case TRAFFIC_CHANNEL_OPEN: {
+            if (listeners.empty()) {
+                fprintf(stderr, "Channel %u opened without a setup response\n", record.channel);
+                failed = true;
+                break;
+            }
+
+            // The extension connects before DCV sends the ready event, wait for it here
+            int fd = listeners.front()->Accept(ACCEPT_TIMEOUT_MS);
+            listeners.pop_front();
+
+            std::string token(REPLAY_TOKEN.size(), '\0');
+            if (fd < 0 || !ReadExact(fd, &token[0], token.size()) || token != REPLAY_TOKEN) {
+                fprintf(stderr, "Extension did not connect to relay for channel %u\n", record.channel);
+                failed = true;
+                break;
+            }
+
+            channels[record.channel].fd = fd;
+            channels[record.channel].drain = std::thread(DrainChannel, fd);
+            break;
+        }
+
+        case TRAFFIC_CHANNEL_IN: {
+            channel_in.messages++;
+            channel_in.bytes += record.length;
+
+            auto channel = channels.find(record.channel);
+            if (channel == channels.end()) {
+                fprintf(stderr, "Data for unknown channel %u\n", record.channel);
+                break;
+            }
+
+            failed = !WriteExact(channel->second.fd, record.data, record.length);
+            break;
+        }
+
+        case TRAFFIC_CHANNEL_CLOSED: {
+            auto channel = channels.find(record.channel);
+            if (channel != channels.end()) {
+                shutdown(channel->second.fd, SHUT_RDWR);
+            }
+            break;
+        }
+
+        case TRAFFIC_CONTROL_OUT:
+            control_out.messages++;
+            control_out.bytes += record.length;
+            break;
+
+        case TRAFFIC_CHANNEL_OUT:
+            channel_out.messages++;
+            channel_out.bytes += record.length;
+            break;
+
+        default:
+            fprintf(stderr, "Unknown record kind %u\n", record.kind);
+            break;
+        }
+    }
+
+    Clock::duration elapsed = Clock::now() - start;
+
+    if (failed) {
+        fprintf(stderr, "Extension stopped accepting input, replay aborted\n");
+    }
+
+    int status = StopExtension(extension, EXIT_TIMEOUT_MS);
+
+    for (auto& [index, channel] : channels) {
+        shutdown(channel.fd, SHUT_RDWR);
+        channel.drain.join();
+        close(channel.fd);
+    }
+    control_drain.join();
+
+    printf("mode                %s\n", fast ? "fast" : "paced");
+    printf("captured duration   %.3f ms\n", Milliseconds(last_timestamp_ns));
+    printf("replay duration     %.3f ms\n",
+           Milliseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    printf("control in          %" PRIu64 " messages, %" PRIu64 " bytes\n", control_in.messages, control_in.bytes);
+    printf("channel in          %" PRIu64 " frames, %" PRIu64 " bytes\n", channel_in.messages, channel_in.bytes);
+    printf("control out         %" PRIu64 " messages, %" PRIu64 " bytes (captured %" PRIu64 ", %" PRIu64 ")\n",
+           control_sent.messages, control_sent.bytes, control_out.messages, control_out.bytes);
+    printf("channel out         %" PRIu64 " bytes (captured %" PRIu64 ")\n", channel_bytes_sent, channel_out.bytes);
+    printf("diverged            %" PRIu64 " times\n", diverged);
+    printf("extension exit      %i\n", status);
+
+    return failed || diverged > 0 || status != 0 ? 1 : 0;
+}
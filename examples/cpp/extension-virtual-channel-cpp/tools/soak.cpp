@@ -0,0 +1,199 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Stand-in for DCV during a soak of the extension:
+ *
+ *   soak <extension> [--blocking] [--rounds n] [--requests n] [--frames n]
+ *        [--size a,b,...] [--warmup n] [--max-rss-growth kB]
+ *        [--max-allocation-growth n]
+ *
+ * Runs the extension with --soak and the given options, answers its
+ * requests and echoes its channel until it exits, then reports what went
+ * through and how much memory the extension peaked at. --blocking soaks the
+ * flow of main.cpp on the protocol core instead of the coroutine based
+ * one. The extension judges its own memory growth, see src/soak.h; its log
+ * has the details. Exits with 0 only if the soak passed. Linux only.
+ */
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcvstandin.h"
+
+using namespace dcv::extensions;
+using namespace dcvext;
+
+namespace {
+
+enum
+{
+    ACCEPT_TIMEOUT_MS = 10000,
+    EXIT_TIMEOUT_MS = 10000,
+    ECHO_BUFFER_SIZE = 64 * 1024
+};
+
+const std::string TOKEN = "soak";
+
+std::mutex send_lock;
+std::atomic<uint64_t> echoed_bytes{ 0 };
+
+bool
+Send(int fd,
+     const DcvMessage& msg)
+{
+    static std::string scratch;
+    std::lock_guard<std::mutex> guard(send_lock);
+
+    return WriteDcvMessage(fd, msg, scratch);
+}
+
+void
+Relay(std::unique_ptr<RelayListener> listener,
+      std::string name,
+      int control)
+{
+    int fd = listener->Accept(ACCEPT_TIMEOUT_MS);
+    std::string token(TOKEN.size(), '\0');
+
+    if (fd < 0 || !ReadExact(fd, &token[0], token.size()) || token != TOKEN) {
+        fprintf(stderr, "soak: channel '%s' did not connect\n", name.c_str());
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    DcvMessage ready;
+    ready.mutable_event()->mutable_virtual_channel_ready_event()->set_virtual_channel_name(name);
+    Send(control, ready);
+
+    std::vector<uint8_t> buffer(ECHO_BUFFER_SIZE);
+
+    for (;;) {
+        ssize_t res = read(fd, buffer.data(), buffer.size());
+        if (res <= 0 || !WriteExact(fd, buffer.data(), static_cast<size_t>(res))) {
+            break;
+        }
+        echoed_bytes += static_cast<uint64_t>(res);
+    }
+
+    close(fd);
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr,
+                "usage: %s <extension> [--blocking] [--rounds n] [--requests n] [--frames n] [--size a,b,...]\n"
+                "       [--warmup n] [--max-rss-growth kB] [--max-allocation-growth n]\n",
+                argv[0]);
+        return 2;
+    }
+
+    std::string soak = "--soak";
+    std::vector<char*> extension = { argv[1], &soak[0] };
+    for (int arg = 2; arg < argc; ++arg) {
+        extension.push_back(argv[arg]);
+    }
+    extension.push_back(nullptr);
+
+    ExtensionProcess process;
+    if (!SpawnExtension(extension.data(), process)) {
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> relays;
+    ExtensionMessage msg;
+    std::string scratch;
+    uint64_t requests = 0;
+
+    while (ReadExtensionMessage(process.output, msg, scratch)) {
+        if (!msg.has_request()) {
+            continue;
+        }
+
+        const Request& request = msg.request();
+        DcvMessage reply;
+        Response* response = reply.mutable_response();
+        response->set_request_id(request.request_id());
+        response->set_status(Response_Status_SUCCESS);
+        requests++;
+
+        if (request.has_get_dcv_info_request()) {
+            response->mutable_get_dcv_info_response()->set_dcv_role(GetDcvInfoResponse_DcvRole_Server);
+            response->mutable_get_dcv_info_response()->set_dcv_process_id(getpid());
+        } else if (request.has_setup_virtual_channel_request()) {
+            const std::string& name = request.setup_virtual_channel_request().virtual_channel_name();
+            auto listener = std::make_unique<RelayListener>();
+
+            if (listener->Listen("soak-" + std::to_string(getpid()) + "-" + std::to_string(relays.size()))) {
+                SetupVirtualChannelResponse* setup = response->mutable_setup_virtual_channel_response();
+                setup->set_virtual_channel_name(name);
+                setup->set_relay_path(listener->Path());
+                setup->set_relay_server_process_id(getpid());
+                setup->set_virtual_channel_auth_token(TOKEN);
+                relays.emplace_back(Relay, std::move(listener), name, process.input);
+            } else {
+                response->set_status(Response_Status_ERROR_GENERIC);
+            }
+        } else if (request.has_close_virtual_channel_request()) {
+            response->mutable_close_virtual_channel_response()->set_virtual_channel_name(
+                request.close_virtual_channel_request().virtual_channel_name());
+        }
+
+        if (!Send(process.input, reply)) {
+            break;
+        }
+    }
+
+    for (std::thread& relay : relays) {
+        relay.join();
+    }
+
+    rusage usage = {};
+    int status = StopExtension(process, EXIT_TIMEOUT_MS, &usage);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s after %.1f s: %llu requests answered, %.1f MB echoed, peak RSS %ld kB, "
+           "CPU %.1f s, exit status %i\n",
+           status == 0 ? "passed" : "failed",
+           seconds,
+           static_cast<unsigned long long>(requests),
+           static_cast<double>(echoed_bytes.load()) / 1e6,
+           usage.ru_maxrss,
+           static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+               + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6,
+           status);
+
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+// /*
+//  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//  * SPDX-License-Identifier: MIT-0
+//  *
+//  * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+//  * software and associated documentation files (the "Software"), to deal in the Software
+//  * without restriction, including without limitation the rights to use, copy, modify,
+//  * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  * permit persons to whom the Software is furnished to do so.
+//  *
+//  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//  */
+
+/*
+ * Measures how fast an extension comes up:
+ *
+ *   startupbench [-n runs] <extension> [extension args...]
+ *
+ * Each run launches the extension and times it from just before the fork
+ * until its first SetupVirtualChannelRequest has been written to its stdout,
+ * answering anything it asks before that the way DCV would. The setup
+ * request is then left unanswered so the extension idles, and its resident
+ * set size is sampled from /proc once it has settled.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcvstandin.h"
+
+using namespace dcv::extensions;
+using namespace dcvext;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum
+{
+    DEFAULT_RUNS = 20,
+    IDLE_SETTLE_MS = 200,
+    EXIT_TIMEOUT_MS = 2000
+};
+
+struct Run
+{
+    double startup_ms = 0;
+    long rss_kb = 0;
+    long hwm_kb = 0;
+};
+
+// Read a "VmXXX:   1234 kB" line from /proc/<pid>/status
+long
+ReadStatusKb(pid_t pid,
+             const char* field)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", static_cast<int>(pid));
+
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return -1;
+    }
+
+    size_t field_len = strlen(field);
+    long value = -1;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            value = strtol(line + field_len + 1, nullptr, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+    return value;
+}
+
+// Answer what the extension asks until it requests its virtual channel
+bool
+WaitForSetupRequest(ExtensionProcess& extension)
+{
+    ExtensionMessage msg;
+    std::string scratch;
+
+    while (ReadExtensionMessage(extension.output, msg, scratch)) {
+        if (!msg.has_request()) {
+            continue;
+        }
+
+        const Request& request = msg.request();
+        if (request.has_setup_virtual_channel_request()) {
+            return true;
+        }
+
+        DcvMessage reply;
+        Response* response = reply.mutable_response();
+        response->set_request_id(request.request_id());
+        response->set_status(Response_Status_SUCCESS);
+
+        if (request.has_get_dcv_info_request()) {
+            GetDcvInfoResponse* info = response->mutable_get_dcv_info_response();
+            info->set_dcv_role(GetDcvInfoResponse_DcvRole_Server);
+            info->set_dcv_process_id(getpid());
+        }
+
+        if (!WriteDcvMessage(extension.input, reply, scratch)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+template<typename T>
+T
+Percentile(std::vector<T> values,
+           double fraction)
+{
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(fraction * static_cast<double>(values.size() - 1) + 0.5);
+    return values[index];
+}
+
+} // namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    int runs = DEFAULT_RUNS;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+        runs = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+
+    if (arg >= argc || runs <= 0) {
+        fprintf(stderr, "usage: %s [-n runs] <extension> [extension args...]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Run> results;
+
+    for (int i = 0; i < runs; i++) {
+        ExtensionProcess extension;
+        Run run;
+
+        Clock::time_point start = Clock::now();
+        if (!SpawnExtension(argv + arg, extension)) {
+            return 1;
+        }
+
+        bool requested = WaitForSetupRequest(extension);
+        run.startup_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        if (requested) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SETTLE_MS));
+            run.rss_kb = ReadStatusKb(extension.pid, "VmRSS");
+            run.hwm_kb = ReadStatusKb(extension.pid, "VmHWM");
+        }
+
+        StopExtension(extension, EXIT_TIMEOUT_MS);
+
+        if (!requested) {
+            fprintf(stderr, "Run %i: the extension exited before requesting a virtual channel\n", i);
+            return 1;
+        }
+
+        results.push_back(run);
+    }
+
+    std::vector<double> startup;
+    std::vector<long> rss, hwm;
+    for (const Run& run : results) {
+        startup.push_back(run.startup_ms);
+        rss.push_back(run.rss_kb);
+        hwm.push_back(run.hwm_kb);
+    }
+
+    printf("runs                %i\n", runs);
+    printf("startup min         %.3f ms\n", Percentile(startup, 0));
+    printf("startup median      %.3f ms\n", Percentile(startup, 0.5));
+    printf("startup p90         %.3f ms\n", Percentile(startup, 0.9));
+    printf("startup max         %.3f ms\n", Percentile(startup, 1));
+    printf("idle rss median     %li kB\n", Percentile(rss, 0.5));
+    printf("peak rss median     %li kB\n", Percentile(hwm, 0.5));
+
+    return 0;
+}